@@ -7,6 +7,9 @@
 #include <stdio.h>
 #include <pthread.h>
 #include <errno.h>
+#include <stdarg.h>
+#include <string.h>
+#include <time.h>
 
 #include "ftlh_private.h"
 
@@ -14,11 +17,33 @@ FTLH_PRIVATE_FUNC inline void * ftlh_zalloc_aligned(size_t size) __attribute__ (
 FTLH_PRIVATE_FUNC inline void ftlh_free_aligned(void *ptr) __attribute__ ((always_inline));
 
 FTLH_PRIVATE_FUNC void *ftlh_hash_worker_thread(void *thid);
+FTLH_PRIVATE_FUNC void ftlh_worker_wake(struct ftlh_thread_status_s *worker);
+FTLH_PRIVATE_FUNC void ftlh_table_wake(struct ftlh_hash_table_s *table);
+FTLH_PRIVATE_FUNC uint_fast64_t ftlh_monotonic_usec(void);
+FTLH_PRIVATE_FUNC uint_fast8_t ftlh_hash_table_service(struct ftlh_hash_table_s *table);
+FTLH_PRIVATE_FUNC void ftlh_key_destroy(ftlh_key_t key);
+FTLH_PRIVATE_FUNC void ftlh_key_destroy_func(void *key);
+
+FTLH_PRIVATE_FUNC uint_fast8_t ftlh_epoch_enter(void);
+FTLH_PRIVATE_FUNC void ftlh_epoch_exit(void);
+FTLH_PRIVATE_FUNC void ftlh_epoch_retire(void *ptr, void (*free_func)(void *));
+FTLH_PRIVATE_FUNC void ftlh_epoch_reclaim(void);
+FTLH_PRIVATE_FUNC void ftlh_request_pool_drain(void);
+
+
+/* Maps a position onto its node */
+FTLH_PRIVATE_FUNC inline struct ftlh_queue_node_s *ftlh_queue_node(ftlh_queue_t queue, uint_fast64_t pos)
+{
+	uint_fast64_t idx = (queue->mask ? (pos & queue->mask) : (pos % queue->size));
 
+	return (struct ftlh_queue_node_s *)((char *)queue->nodes + (idx << queue->node_shift));
+}
 
-ftlh_queue_t ftlh_queue_create(uint_fast32_t size)
+/* Creates a queue whose nodes are 1 << node_shift bytes apart */
+FTLH_PRIVATE_FUNC ftlh_queue_t ftlh_queue_alloc(uint_fast64_t size, uint_fast64_t node_shift)
 {
 	ftlh_queue_t queue = NULL;
+	uint_fast64_t n = 0;
 
 	/* Perform basic sanity checks first. */
 	if (size < 64) size = 64;
@@ -32,16 +57,27 @@ ftlh_queue_t ftlh_queue_create(uint_fast32_t size)
 
 	/* Store the size of the queue we are creating */
 	queue->size = size;
+	if ((size & (size - 1)) == 0) {
+		queue->mask = size - 1;
+	}
+	queue->node_shift = node_shift;
+
+	/* Producers order their publish against the waiters check with a light
+	 * fence; get the heavy side registered before the first one runs */
+	ftlh_atomic_fence_heavy_init();
 
 	/* Allocate an aligned memory segment for the nodes */
-	queue->nodes = (struct ftlh_queue_node_s *)ftlh_zalloc_aligned(sizeof(struct ftlh_queue_node_s) * size);
+	queue->nodes = (struct ftlh_queue_node_s *)ftlh_zalloc_aligned(size << node_shift);
 	if (!queue->nodes) {
 		/* out of memory error */
 		goto fail;
 	}
 
-	//ftlh_atomic64_set(&queue->prod_cons_pos, ((uint_fast64_t)(size-1) << 32));
-  
+	/* Every node starts out waiting for the producer of the first lap */
+	for (n = 0; n < size; ++n) {
+		ftlh_queue_node(queue, n)->seq = n;
+	}
+
 	goto done;
 
  fail:
@@ -55,13 +91,23 @@ ftlh_queue_t ftlh_queue_create(uint_fast32_t size)
 	return queue;
 }
 
+ftlh_queue_t ftlh_queue_create(uint_fast64_t size)
+{
+	return ftlh_queue_alloc(size, FTLH_QUEUE_NODE_SHIFT);
+}
+
+ftlh_queue_t ftlh_queue_create_padded(uint_fast64_t size)
+{
+	return ftlh_queue_alloc(size, FTLH_QUEUE_PADDED_NODE_SHIFT);
+}
+
 
 void ftlh_queue_destroy(ftlh_queue_t *queue_in)
 {
 	ftlh_queue_t queue = NULL;
 
 	/* Basic sanity checks */
-	if (!queue) {
+	if (!queue_in || !*queue_in) {
 		goto done;
 	}
 
@@ -86,293 +132,3371 @@ uint_fast64_t ftlh_queue_size(ftlh_queue_t queue)
 	return queue->size;
 }
 
-
-uint_fast64_t ftlh_queue_enqueue(ftlh_queue_t queue, void *value)
+/* Items in the queue, from the positions. Claimed nodes which are not yet
+ * published count as items, so this can run a little ahead. */
+static inline __attribute__ ((always_inline)) uint_fast64_t ftlh_queue_count(ftlh_queue_t queue)
 {
-	uint_fast64_t items = 0;
-	//uint_fast64_t prod_cons_pos = 0, new_prod_cons_pos = 0;
-	uint_fast64_t orig_prod_pos = 0, prod_pos = 0, cons_pos = 0;
+	/* Read cons_pos first: prod_pos can only have grown since, so the
+	 * difference never goes negative */
+	uint_fast64_t cons_pos = ftlh_atomic64_load_acquire(&queue->cons_pos);
+	uint_fast64_t items = ftlh_atomic64_load_relaxed(&queue->prod_pos) - cons_pos;
 
-	assert(queue);
+	return (items > queue->size ? queue->size : items);
+}
 
-	/* Obtain the producer / consumer position value
-	 * Update the producer location
-	 * Re-encode the values into a new 64-bit value
-	 * Attempt to store the new value
-	 * If it was changed on us, try it all over again
-	 * Also, back off if we fill the queue
-	 */
- again:
-	do {
-		void *node_value = NULL;
+/* Runs the high watermark callback when a producer takes the queue to the mark.
+ * Only queues with watermarks pay for reading the positions. */
+static inline __attribute__ ((always_inline)) void ftlh_queue_check_high(ftlh_queue_t queue)
+{
+	if (queue->watermark_func && !ftlh_atomic32_load_relaxed(&queue->above_high) &&
+		ftlh_queue_count(queue) >= queue->high_mark && ftlh_atomic32_cas_relaxed(&queue->above_high, 0, 1)) {
+		queue->watermark_func(queue, 1, queue->watermark_data);
+	}
+}
 
-		prod_pos = ftlh_atomic64_get(&queue->prod_pos);
+/* Runs the low watermark callback when a consumer drains the queue to the mark */
+static inline __attribute__ ((always_inline)) void ftlh_queue_check_low(ftlh_queue_t queue)
+{
+	if (queue->watermark_func && ftlh_atomic32_load_relaxed(&queue->above_high) &&
+		ftlh_queue_count(queue) <= queue->low_mark && ftlh_atomic32_cas_relaxed(&queue->above_high, 1, 0)) {
+		queue->watermark_func(queue, 0, queue->watermark_data);
+	}
+}
 
-		/* Producers might catch the consumers and need to wait for the clearing of data from a node before writing */
-		node_value = ftlh_atomic_ptr_get(&queue->nodes[prod_pos].data);
-		if (node_value) {
-			ftlh_yield(10);
-			goto again;
+/* Wakes consumers parked in ftlh_queue_dequeue_wait(), if there are any. The
+ * caller must have published its items and then issued a light fence, which
+ * pairs with the heavy one a consumer issues between registering in waiters and
+ * its last look at the queue: either we see the waiter or it sees our items.
+ * Queues nobody waits on never pay for more than the relaxed load. */
+static inline __attribute__ ((always_inline)) void ftlh_queue_wake_consumers(ftlh_queue_t queue, uint_fast64_t n)
+{
+	if (ftlh_atomic32_load_relaxed(&queue->waiters)) {
+		ftlh_atomic32_fetch_add_relaxed(&queue->signal, 1);
+		if (n == 1) {
+			ftlh_atomic32_notify_one(&queue->signal);
+		} else {
+			ftlh_atomic32_notify_all(&queue->signal);
 		}
+	}
+}
 
-		cons_pos = ftlh_atomic64_get(&queue->cons_pos);
-		if (prod_pos == cons_pos+2 || (prod_pos == 0 && cons_pos == ftlh_atomic64_get(&queue->size) - 2) ||
-			(prod_pos == 1 && cons_pos == ftlh_atomic64_get(&queue->size) - 1))
-		{
-			/* Producer wrapped and caught consumer; we should back off */
-			ftlh_yield(10);
-			goto again;
-		}
+/* Claims the next position to fill. A full queue makes us wait if wait is set,
+ * until deadline (monotonic usec, 0 = forever), and give up otherwise. Returns
+ * the node, which is ours until ftlh_queue_publish(), or NULL if we gave up. */
+static inline __attribute__ ((always_inline)) struct ftlh_queue_node_s *ftlh_queue_claim(ftlh_queue_t queue, uint_fast8_t wait,
+																						 uint_fast64_t deadline, uint_fast64_t *pos)
+{
+	struct ftlh_queue_node_s *node = NULL;
+	uint_fast64_t prod_pos = 0, seq = 0;
+	ftlh_backoff_t backoff;
 
-		/* The node is empty, and we didn't wrap and catch the consumer(s) */
-		orig_prod_pos = prod_pos;
-		if (prod_pos != 0) {
-			--prod_pos;
-		} else {
-			prod_pos = ftlh_atomic64_get(&queue->size) - 1;
-		}
+	assert(queue);
+	ftlh_backoff_init(&backoff);
 
-	} while (!ftlh_atomic64_bool_cas(&queue->prod_pos, orig_prod_pos, prod_pos));
-	
-	/* At this point, we just moved the producer to a new node (we won the race),
-	 * and no other producer should see this node. A consumer may be inspecting
-	 * this node, but won't touch it because the state is not full. It is now
-	 * safe to store the values in this node.
+	/* Claim the next position by moving the producer position past it. We may
+	 * only claim it once the node's sequence says the consumer of the previous
+	 * lap is done with it.
 	 */
-	ftlh_atomic_ptr_set(&queue->nodes[orig_prod_pos].data, value);
-
-	/* We can now increment the number of items in the queue. */
-	ftlh_atomic64_inc(&queue->items);
+	prod_pos = ftlh_atomic64_load_relaxed(&queue->prod_pos);
+	for (;;) {
+		node = ftlh_queue_node(queue, prod_pos);
+		seq = ftlh_atomic64_load_acquire(&node->seq);
+
+		if (seq == prod_pos) {
+			if (ftlh_atomic64_cas_relaxed(&queue->prod_pos, prod_pos, prod_pos + 1)) {
+				break;
+			}
+			/* Lost the race to another producer; back off so we don't keep
+			 * hammering the same line with them */
+			ftlh_backoff_wait(&backoff, NULL, 0);
+			prod_pos = ftlh_atomic64_load_relaxed(&queue->prod_pos);
+		} else if ((int64_t)(seq - prod_pos) < 0) {
+			/* The node still holds an item from the last lap: the queue is full.
+			 * This is the only place we ever give up the CPU. */
+			if (!wait || (deadline && ftlh_monotonic_usec() >= deadline)) {
+				return NULL;
+			}
+			ftlh_backoff_wait(&backoff, NULL, 0);
+			prod_pos = ftlh_atomic64_load_relaxed(&queue->prod_pos);
+		} else {
+			/* Another producer took this position */
+			prod_pos = ftlh_atomic64_load_relaxed(&queue->prod_pos);
+		}
+	}
 
-	/* Read the current number of items -- which may have already changed, or may
-	 * change again before we return from this function. */
-	items = ftlh_atomic64_get(&queue->items);
+	*pos = prod_pos;
+	return node;
+}
 
-	return items;
+/* Hands a claimed and filled node to the consumer of this lap. Returns the
+ * approximate number of items, never 0. */
+static inline __attribute__ ((always_inline)) uint_fast64_t ftlh_queue_publish(ftlh_queue_t queue, struct ftlh_queue_node_s *node,
+																			   uint_fast64_t pos)
+{
+	uint_fast64_t cons_pos = 0;
+	int64_t items = 0;
+
+	ftlh_atomic64_store_release(&node->seq, pos + 1);
+	ftlh_atomic_fence_light();
+	ftlh_queue_wake_consumers(queue, 1);
+	ftlh_queue_check_high(queue);
+
+	/* Items up to and including ours, counted from the producers' copy of the
+	 * consumer position so the consumers' line stays out of the hot path. One
+	 * position in FTLH_QUEUE_COUNT_REFRESH refreshes the copy. It only ever
+	 * lags, so the count errs high. Never 0: we only got here by adding an
+	 * item. */
+	if (!(pos & (FTLH_QUEUE_COUNT_REFRESH - 1))) {
+		cons_pos = ftlh_atomic64_load_relaxed(&queue->cons_pos);
+		ftlh_atomic64_store_relaxed(&queue->prod_cached_cons, cons_pos);
+	} else {
+		cons_pos = ftlh_atomic64_load_relaxed(&queue->prod_cached_cons);
+	}
+	items = (int64_t)(pos + 1 - cons_pos);
+	if (items <= 0) {
+		return 1;
+	}
+	return ((uint_fast64_t)items > queue->size ? queue->size : (uint_fast64_t)items);
 }
 
-void *ftlh_queue_dequeue(ftlh_queue_t queue)
+/* Claims the oldest published node. Returns NULL if the queue is empty; else
+ * the node is ours until ftlh_queue_hand_back(). */
+static inline __attribute__ ((always_inline)) struct ftlh_queue_node_s *ftlh_queue_take(ftlh_queue_t queue, uint_fast64_t *pos)
 {
-	void *value = NULL;
-	//uint_fast64_t prod_cons_pos = 0, new_prod_cons_pos = 0;
-	uint_fast64_t cons_pos = 0, orig_cons_pos = 0;
+	struct ftlh_queue_node_s *node = NULL;
+	uint_fast64_t cons_pos = 0, seq = 0;
 
 	assert(queue);
 
-	/* Obtain the producer / consumer position value
-	 * Validate we are pointing at a full node
-	 * Update the consumer location
-	 * Re-encode the values into a new 64-bit value
-	 * Attempt to store the new value
-	 * If it was changed on us, try it all over again
-	 */
-	do {
-		cons_pos = ftlh_atomic64_get(&queue->cons_pos);
-
-		value = ftlh_atomic_ptr_get(&queue->nodes[cons_pos].data);
-		if (!value) {
-			goto fail;
-		}
-
-		orig_cons_pos = cons_pos;
-		if (cons_pos != 0) {
-			--cons_pos;
+	cons_pos = ftlh_atomic64_load_relaxed(&queue->cons_pos);
+	for (;;) {
+		node = ftlh_queue_node(queue, cons_pos);
+		seq = ftlh_atomic64_load_acquire(&node->seq);
+
+		if (seq == cons_pos + 1) {
+			if (ftlh_atomic64_cas_relaxed(&queue->cons_pos, cons_pos, cons_pos + 1)) {
+				break;
+			}
+			cons_pos = ftlh_atomic64_load_relaxed(&queue->cons_pos);
+		} else if ((int64_t)(seq - (cons_pos + 1)) < 0) {
+			/* Nothing has been published at this position yet */
+			return NULL;
 		} else {
-			cons_pos = ftlh_atomic64_get(&queue->size) - 1;
+			/* Another consumer took this position */
+			cons_pos = ftlh_atomic64_load_relaxed(&queue->cons_pos);
 		}
+	}
 
-	} while (!ftlh_atomic64_bool_cas(&queue->cons_pos, orig_cons_pos, cons_pos));
-	
-	/* At this point, we just moved the consumer position to a new node,
-	 * and no other consumer should see this node. A producer may see
-	 * this node, but should not touch it because it is full.
-	 */
-	ftlh_atomic_ptr_set(&queue->nodes[orig_cons_pos].data, NULL);
+	*pos = cons_pos;
+	return node;
+}
 
-	/* We can now decrement the number of items in the queue. */
-	ftlh_atomic64_dec(&queue->items);
+/* Hands an emptied node to the producer of the next lap */
+static inline __attribute__ ((always_inline)) void ftlh_queue_hand_back(ftlh_queue_t queue, struct ftlh_queue_node_s *node,
+																		uint_fast64_t pos)
+{
+	ftlh_atomic64_store_release(&node->seq, pos + queue->size);
+	ftlh_queue_check_low(queue);
+}
 
+/* Adds one item; see ftlh_queue_claim(). Returns 0 if we gave up, else the
+ * approximate number of items after ours was added. */
+static inline __attribute__ ((always_inline)) uint_fast64_t ftlh_queue_push(ftlh_queue_t queue, void *value,
+																			uint_fast8_t wait, uint_fast64_t deadline)
+{
+	struct ftlh_queue_node_s *node = NULL;
+	uint_fast64_t pos = 0;
 
- fail:
-	return value;
+	node = ftlh_queue_claim(queue, wait, deadline, &pos);
+	if (!node) {
+		return 0;
+	}
+
+	/* The node is ours until we publish it to the consumer of this lap */
+	ftlh_atomic_ptr_store_relaxed(&node->data, value);
+	return ftlh_queue_publish(queue, node, pos);
 }
 
+uint_fast64_t ftlh_queue_enqueue(ftlh_queue_t queue, void *value)
+{
+	return ftlh_queue_push(queue, value, 1, 0);
+}
 
-uint_fast64_t ftlh_queue_approx_items(ftlh_queue_t queue)
+uint_fast8_t ftlh_queue_try_enqueue(ftlh_queue_t queue, void *value)
 {
-	if (queue) {
-		return ftlh_atomic64_get(&queue->items);
+	return (ftlh_queue_push(queue, value, 0, 0) != 0);
+}
+
+uint_fast8_t ftlh_queue_enqueue_timed(ftlh_queue_t queue, void *value, uint_fast64_t timeout_usec)
+{
+	/* A zero timeout would otherwise mean forever */
+	if (!timeout_usec) {
+		return ftlh_queue_try_enqueue(queue, value);
 	}
-	return 0;
+	return (ftlh_queue_push(queue, value, 1, ftlh_monotonic_usec() + timeout_usec) != 0);
 }
 
+uint_fast8_t ftlh_queue_set_watermarks(ftlh_queue_t queue, uint_fast64_t high, uint_fast64_t low,
+									   ftlh_queue_watermark_func_t func, void *user_data)
+{
+	if (!queue || (func && (low >= high || high > queue->size))) {
+		errno = EINVAL;
+		return 1;
+	}
 
+	queue->high_mark = high;
+	queue->low_mark = low;
+	queue->watermark_data = user_data;
+	queue->watermark_func = func;
+	ftlh_atomic32_set(&queue->above_high, 0);
 
-struct ftlh_globals_s ftlh_globals = {0};
+	return 0;
+}
 
-uint_fast8_t ftlh_start()
+uint_fast8_t ftlh_queue_try_dequeue(ftlh_queue_t queue, void **value)
 {
-	return ftlh_start_advanced(4096, 2);
+	struct ftlh_queue_node_s *node = NULL;
+	uint_fast64_t pos = 0;
+
+	node = ftlh_queue_take(queue, &pos);
+	if (!node) {
+		return 0;
+	}
+
+	if (value) {
+		*value = ftlh_atomic_ptr_load_relaxed(&node->data);
+	}
+	ftlh_queue_hand_back(queue, node, pos);
+
+	return 1;
 }
 
-uint_fast8_t ftlh_start_advanced(uint64_t max_tables, uint32_t threads)
+/* Payload bytes sit right after the sequence number */
+#define ftlh_queue_payload(node) ((void *)((char *)(node) + sizeof(ftlh_atomic64_t)))
+
+ftlh_queue_t ftlh_queue_create_payload(uint_fast64_t size, uint_fast64_t elem_size)
 {
-	uint_fast8_t ret_val = 0;
-	pthread_attr_t attr;
+	ftlh_queue_t queue = NULL;
+	uint_fast64_t node_shift = FTLH_QUEUE_PADDED_NODE_SHIFT;
 
-	if ((errno = pthread_attr_init(&attr)) != 0) {
-		ret_val = 1;
-		goto fail1;
+	if (!elem_size || elem_size > FTLH_QUEUE_MAX_PAYLOAD) {
+		errno = EINVAL;
+		return NULL;
 	}
 
-	if ((errno = pthread_attr_setstacksize(&attr, 262144)) != 0) {
-		ret_val = 1;
-		goto fail2;
+	/* Whole cache lines per node, so no two nodes ever share one */
+	while (((uint_fast64_t)1 << node_shift) < sizeof(ftlh_atomic64_t) + elem_size) {
+		++node_shift;
 	}
 
-	ret_val = ftlh_start_expert(max_tables, threads, &attr);
+	queue = ftlh_queue_alloc(size, node_shift);
+	if (queue) {
+		queue->elem_size = elem_size;
+	}
+	return queue;
+}
 
- fail2:
-	if ((errno = pthread_attr_destroy(&attr)) != 0) {
-		ret_val = 1;
+uint_fast64_t ftlh_queue_elem_size(ftlh_queue_t queue)
+{
+	if (!queue) {
+		return 0;
 	}
+	return queue->elem_size;
+}
 
- fail1:
-	return ret_val;
+void ftlh_queue_enqueue_copy(ftlh_queue_t queue, const void *elem)
+{
+	struct ftlh_queue_node_s *node = NULL;
+	uint_fast64_t pos = 0;
+
+	node = ftlh_queue_claim(queue, 1, 0, &pos);
+	memcpy(ftlh_queue_payload(node), elem, queue->elem_size);
+	ftlh_queue_publish(queue, node, pos);
 }
 
-uint_fast8_t ftlh_start_expert(uint64_t max_tables, uint32_t threads, const pthread_attr_t *attr)
+uint_fast8_t ftlh_queue_try_enqueue_copy(ftlh_queue_t queue, const void *elem)
 {
-	uint_fast8_t status = 0;
-	uint_fast32_t th = 0;
+	struct ftlh_queue_node_s *node = NULL;
+	uint_fast64_t pos = 0;
 
-	ftlh_globals.tables = ftlh_zalloc_aligned(sizeof(ftlh_atomicptr_t) * max_tables);
-	if (!ftlh_globals.tables) {
-		errno = ENOMEM;
-		status = 1;
-		goto done;
+	node = ftlh_queue_claim(queue, 0, 0, &pos);
+	if (!node) {
+		return 0;
 	}
+	memcpy(ftlh_queue_payload(node), elem, queue->elem_size);
+	ftlh_queue_publish(queue, node, pos);
 
-	ftlh_globals.table_count = max_tables;
+	return 1;
+}
 
-	ftlh_globals.threads = ftlh_zalloc_aligned(sizeof(struct ftlh_thread_status_s) * threads);
+uint_fast8_t ftlh_queue_try_dequeue_copy(ftlh_queue_t queue, void *elem)
+{
+	struct ftlh_queue_node_s *node = NULL;
+	uint_fast64_t pos = 0;
 
-	if (!ftlh_globals.threads) {
-		errno = ENOMEM;
-		status = 1;
-		goto fail;
+	node = ftlh_queue_take(queue, &pos);
+	if (!node) {
+		return 0;
 	}
+	memcpy(elem, ftlh_queue_payload(node), queue->elem_size);
+	ftlh_queue_hand_back(queue, node, pos);
 
-	ftlh_globals.thread_count = threads;
-	ftlh_atomic_ptr_set(&ftlh_globals.running, (void*)1);
+	return 1;
+}
 
-	for (th = 0; th < ftlh_globals.thread_count; ++th) {
-		ftlh_globals.threads[th].id = th;
-		pthread_create(&ftlh_globals.threads[th].thread, attr, ftlh_hash_worker_thread, (void *)&ftlh_globals.threads[th]);
+void *ftlh_queue_reserve(ftlh_queue_t queue, ftlh_queue_ticket_t *ticket)
+{
+	struct ftlh_queue_node_s *node = NULL;
+
+	node = ftlh_queue_claim(queue, 1, 0, ticket);
+	return ftlh_queue_payload(node);
+}
+
+void ftlh_queue_commit(ftlh_queue_t queue, ftlh_queue_ticket_t ticket)
+{
+	ftlh_queue_publish(queue, ftlh_queue_node(queue, ticket), ticket);
+}
+
+void *ftlh_queue_try_acquire(ftlh_queue_t queue, ftlh_queue_ticket_t *ticket)
+{
+	struct ftlh_queue_node_s *node = NULL;
+
+	node = ftlh_queue_take(queue, ticket);
+	if (!node) {
+		return NULL;
 	}
+	return ftlh_queue_payload(node);
+}
 
-	for (th = 0; th < ftlh_globals.thread_count; ++th) {
-		while(ftlh_atomic64_get(&ftlh_globals.threads[th].running) != 1) {
-			ftlh_yield(100);
+void ftlh_queue_release(ftlh_queue_t queue, ftlh_queue_ticket_t ticket)
+{
+	ftlh_queue_hand_back(queue, ftlh_queue_node(queue, ticket), ticket);
+}
+
+uint_fast64_t ftlh_queue_enqueue_bulk(ftlh_queue_t queue, void * const *values, uint_fast64_t count)
+{
+	struct ftlh_queue_node_s *node = NULL;
+	uint_fast64_t prod_pos = 0, done = 0, n = 0;
+	ftlh_backoff_t backoff;
+
+	assert(queue);
+	ftlh_backoff_init(&backoff);
+
+	while (done < count) {
+		/* Count the free nodes from the producer position on. If the position
+		 * has not moved when we claim them, nobody else can have taken them,
+		 * and a free node stays free until its producer fills it. */
+		prod_pos = ftlh_atomic64_load_relaxed(&queue->prod_pos);
+		for (n = 0; n < count - done && n < queue->size; ++n) {
+			if (ftlh_atomic64_load_acquire(&ftlh_queue_node(queue, prod_pos + n)->seq) != prod_pos + n) {
+				break;
+			}
+		}
+
+		if (!n) {
+			/* Either full or another producer got in first; only wait if full */
+			node = ftlh_queue_node(queue, prod_pos);
+			if ((int64_t)(ftlh_atomic64_load_acquire(&node->seq) - prod_pos) < 0) {
+				ftlh_backoff_wait(&backoff, NULL, 0);
+			}
+			continue;
+		}
+
+		if (!ftlh_atomic64_cas_relaxed(&queue->prod_pos, prod_pos, prod_pos + n)) {
+			ftlh_backoff_wait(&backoff, NULL, 0);
+			continue;
+		}
+		ftlh_backoff_reset(&backoff);
+
+		/* Consumers take the nodes in order, so publish them in order too */
+		for (; n; --n, ++prod_pos, ++done) {
+			node = ftlh_queue_node(queue, prod_pos);
+			ftlh_atomic_ptr_store_relaxed(&node->data, values[done]);
+			ftlh_atomic64_store_release(&node->seq, prod_pos + 1);
 		}
+		ftlh_atomic_fence_light();
+		ftlh_queue_wake_consumers(queue, count);
+		ftlh_queue_check_high(queue);
 	}
 
-	goto done;
- fail:
-	__attribute__ ((cold));
-	ftlh_free_aligned((void*)ftlh_globals.tables);
-	
- done:
-	__attribute__ ((hot));
-	return status;
+	return ftlh_queue_count(queue);
 }
 
-void ftlh_stop()
+uint_fast64_t ftlh_queue_dequeue_bulk(ftlh_queue_t queue, void **values, uint_fast64_t max)
 {
-	uint_fast32_t th = 0;
+	struct ftlh_queue_node_s *node = NULL;
+	uint_fast64_t cons_pos = 0, n = 0, taken = 0;
 
-	ftlh_atomic_ptr_set(&ftlh_globals.running, (void*)0);
+	assert(queue);
 
-	for (th = 0; th < ftlh_globals.thread_count; ++th) {
-		pthread_join(ftlh_globals.threads[th].thread, NULL);
+	do {
+		/* Count the published nodes from the consumer position on. As with
+		 * enqueue, an unchanged position means they are all still ours to take. */
+		cons_pos = ftlh_atomic64_load_relaxed(&queue->cons_pos);
+		for (n = 0; n < max; ++n) {
+			if (ftlh_atomic64_load_acquire(&ftlh_queue_node(queue, cons_pos + n)->seq) != cons_pos + n + 1) {
+				break;
+			}
+		}
+		if (!n) {
+			return 0;
+		}
+	} while (!ftlh_atomic64_cas_relaxed(&queue->cons_pos, cons_pos, cons_pos + n));
+
+	for (taken = 0; taken < n; ++taken, ++cons_pos) {
+		node = ftlh_queue_node(queue, cons_pos);
+		values[taken] = ftlh_atomic_ptr_load_relaxed(&node->data);
+		ftlh_atomic64_store_release(&node->seq, cons_pos + queue->size);
 	}
-	ftlh_free_aligned(ftlh_globals.threads);
-	ftlh_free_aligned((void*)ftlh_globals.tables);
-}
+	ftlh_queue_check_low(queue);
 
+	return n;
+}
 
-void *ftlh_hash_worker_thread(void *info)
+uint_fast8_t ftlh_queue_dequeue_wait(ftlh_queue_t queue, void **value, uint_fast64_t timeout_usec)
 {
-	uint_fast64_t thread_id = 0;
-	uint_fast64_t table_count = ftlh_globals.table_count;
-	struct ftlh_thread_status_s *thread_info = (struct ftlh_thread_status_s *)info;
+	uint_fast64_t deadline = 0, now = 0;
+	ftlh_backoff_t backoff;
+	uint32_t signal = 0;
 
-	ftlh_atomic64_set(&thread_info->running, 1);
-	thread_id = ftlh_atomic64_get(&thread_info->id);
+	assert(queue);
+
+	/* The common case: there is something to take, so no clock and no syscall */
+	if (ftlh_queue_try_dequeue(queue, value)) {
+		return 1;
+	}
 
-	while ((uintptr_t)ftlh_atomic_ptr_get(&ftlh_globals.running) == 1) {
-		int_fast64_t table_num = table_count - 1;
-		for (; table_num != 0; --table_num) {
-			/* Skip tables not handled by this thread */
-			if (table_num % table_count != thread_id) continue;
+	if (timeout_usec) {
+		deadline = ftlh_monotonic_usec() + timeout_usec;
+	}
 
-			
+	/* Spin a little first; an item may be on its way */
+	ftlh_backoff_init(&backoff);
+	while (backoff.round < backoff.spin_rounds) {
+		ftlh_backoff_wait(&backoff, NULL, 0);
+		if (ftlh_queue_try_dequeue(queue, value)) {
+			return 1;
 		}
-		ftlh_yield(10000);
 	}
-	ftlh_atomic64_set(&thread_info->running, 0);
 
+	for (;;) {
+		/* Register before the last look, so a producer who publishes after it
+		 * sees us and bumps signal, and the wait below returns at once. */
+		signal = ftlh_atomic32_load_acquire(&queue->signal);
+		ftlh_atomic32_fetch_add_relaxed(&queue->waiters, 1);
+		ftlh_atomic_fence_heavy();
 
-	return NULL;
+		if (ftlh_queue_try_dequeue(queue, value)) {
+			ftlh_atomic32_fetch_sub_relaxed(&queue->waiters, 1);
+			return 1;
+		}
+
+		if (deadline) {
+			now = ftlh_monotonic_usec();
+			if (now >= deadline) {
+				ftlh_atomic32_fetch_sub_relaxed(&queue->waiters, 1);
+				return 0;
+			}
+		}
+		ftlh_atomic32_wait(&queue->signal, signal, deadline ? deadline - now : 0);
+		ftlh_atomic32_fetch_sub_relaxed(&queue->waiters, 1);
+
+		if (ftlh_queue_try_dequeue(queue, value)) {
+			return 1;
+		}
+	}
 }
 
+void *ftlh_queue_dequeue(ftlh_queue_t queue)
+{
+	void *value = NULL;
 
+	ftlh_queue_try_dequeue(queue, &value);
 
+	return value;
+}
 
 
-/**************************************************
- * Private functions follow
- *************************************************/
+uint_fast64_t ftlh_queue_approx_items(ftlh_queue_t queue)
+{
+	if (queue) {
+		return ftlh_queue_count(queue);
+	}
+	return 0;
+}
 
-void * ftlh_zalloc_aligned(size_t size)
+
+
+ftlh_spsc_queue_t ftlh_spsc_queue_create(uint_fast64_t size)
 {
-	uintptr_t *storage = NULL;
+	ftlh_spsc_queue_t queue = NULL;
+	uint_fast64_t rounded = 64;
 
-	/* Allocate zeroed memory big enough for an extra pointer and alignment */
-	void *start = calloc(1, size + 15 + sizeof(uintptr_t));
+	while (rounded < size) {
+		rounded <<= 1;
+	}
 
-	/* Compute the aligned location */
-	void *aligned = (void *)(((uintptr_t)start + 15 + sizeof(uintptr_t)) & ~((uintptr_t)0x0F));
+	queue = ftlh_zalloc_aligned(sizeof(struct ftlh_spsc_queue_s));
+	if (!queue) {
+		goto done;
+	}
 
-	storage = (uintptr_t *)((uintptr_t)aligned - sizeof(uintptr_t));
-	/* Back up by the size of uintptr_t and store the start of the block */
-	*storage = (uintptr_t)start;
+	queue->size = rounded;
+	queue->mask = rounded - 1;
+	queue->nodes = ftlh_zalloc_aligned(sizeof(ftlh_atomicptr_t) * rounded);
+	if (!queue->nodes) {
+		goto fail;
+	}
 
-	return aligned;
+	goto done;
+
+ fail:
+	__attribute__ ((cold));
+	ftlh_free_aligned(queue);
+	queue = NULL;
+
+ done:
+	__attribute__ ((hot));
+	return queue;
 }
 
-void ftlh_free_aligned(void *ptr)
+void ftlh_spsc_queue_destroy(ftlh_spsc_queue_t *queue_in)
 {
-	/* Back up the size of uintptr_t and retrieve the start of the block */
-	/* Syntactic explaination: Convert ptr to uintptr_t so we can do arithmetic on it
-	 * without emitting a warning. Then, subtract the size of a uintptr_t to find
-	 * where we stored the start address. Convert that computation into a uintptr_t pointer
-	 * so that we can dereference the location and retrieve the value. Finally,
-	 * convert that retrieved numeric value into a void pointer so we can free it.
-	 */
-	void *start = (void *)(*(uintptr_t *)((uintptr_t)ptr - sizeof(uintptr_t)));
-	free(start);
+	if (!queue_in || !*queue_in) {
+		return;
+	}
+
+	ftlh_free_aligned((void *)(*queue_in)->nodes);
+	ftlh_free_aligned(*queue_in);
+	*queue_in = NULL;
 }
 
-void ftlh_yield(uint_fast64_t usec)
+uint_fast8_t ftlh_spsc_queue_try_enqueue(ftlh_spsc_queue_t queue, void *value)
 {
-	struct timeval tv;
-	tv.tv_sec = 0;
-	tv.tv_usec = usec;
+	uint_fast64_t prod_pos = 0;
+
+	assert(queue);
+
+	/* Only we write prod_pos, so our own read needs no ordering */
+	prod_pos = ftlh_atomic64_load_relaxed(&queue->prod_pos);
+	if (prod_pos - queue->prod_cached_cons >= queue->size) {
+		/* Looks full; see how far the consumer really got. The acquire pairs
+		 * with its release, so it is done with the node we are about to reuse. */
+		queue->prod_cached_cons = ftlh_atomic64_load_acquire(&queue->cons_pos);
+		if (prod_pos - queue->prod_cached_cons >= queue->size) {
+			return 0;
+		}
+	}
+
+	ftlh_atomic_ptr_store_relaxed(&queue->nodes[prod_pos & queue->mask], value);
+	ftlh_atomic64_store_release(&queue->prod_pos, prod_pos + 1);
+
+	return 1;
+}
+
+void ftlh_spsc_queue_enqueue(ftlh_spsc_queue_t queue, void *value)
+{
+	ftlh_backoff_t backoff;
+
+	if (ftlh_spsc_queue_try_enqueue(queue, value)) {
+		return;
+	}
+
+	ftlh_backoff_init(&backoff);
+	while (!ftlh_spsc_queue_try_enqueue(queue, value)) {
+		ftlh_backoff_wait(&backoff, NULL, 0);
+	}
+}
+
+uint_fast8_t ftlh_spsc_queue_try_dequeue(ftlh_spsc_queue_t queue, void **value)
+{
+	uint_fast64_t cons_pos = 0;
+
+	assert(queue);
+
+	cons_pos = ftlh_atomic64_load_relaxed(&queue->cons_pos);
+	if (cons_pos == queue->cons_cached_prod) {
+		/* Looks empty; the acquire pairs with the producer's release of the node */
+		queue->cons_cached_prod = ftlh_atomic64_load_acquire(&queue->prod_pos);
+		if (cons_pos == queue->cons_cached_prod) {
+			return 0;
+		}
+	}
+
+	if (value) {
+		*value = ftlh_atomic_ptr_load_relaxed(&queue->nodes[cons_pos & queue->mask]);
+	}
+	ftlh_atomic64_store_release(&queue->cons_pos, cons_pos + 1);
+
+	return 1;
+}
+
+uint_fast64_t ftlh_spsc_queue_size(ftlh_spsc_queue_t queue)
+{
+	if (!queue) {
+		return 0;
+	}
+	return queue->size;
+}
+
+uint_fast64_t ftlh_spsc_queue_approx_items(ftlh_spsc_queue_t queue)
+{
+	uint_fast64_t cons_pos = 0;
+
+	if (!queue) {
+		return 0;
+	}
+	/* Read cons_pos first: prod_pos can only have grown since */
+	cons_pos = ftlh_atomic64_load_acquire(&queue->cons_pos);
+	return ftlh_atomic64_load_acquire(&queue->prod_pos) - cons_pos;
+}
+
+
+/* Takes a clean segment from the pool, or from the heap if the pool is empty */
+FTLH_PRIVATE_FUNC struct ftlh_queue_segment_s *ftlh_segment_alloc(ftlh_unbounded_queue_t queue)
+{
+	ftlh_tagged_ptr_t head = ftlh_atomic128_get(&queue->pool);
+	struct ftlh_queue_segment_s *seg = NULL;
+
+	/* Callers are inside an epoch, and a segment only leaves the pool for the
+	 * heap through the epoch, so reading next of a segment somebody else just
+	 * popped is harmless; the tag makes us retry */
+	while ((seg = ftlh_tagged_ptr_ptr(head))) {
+		if (ftlh_atomic128_cas(&queue->pool, &head,
+							   ftlh_tagged_ptr_make(ftlh_atomic_ptr_load_relaxed(&seg->pool_next), ftlh_tagged_ptr_tag(head) + 1))) {
+			ftlh_atomic64_fetch_sub_relaxed(&queue->pool_count, 1);
+			return seg;
+		}
+	}
+
+	seg = ftlh_zalloc_aligned(sizeof(struct ftlh_queue_segment_s) + sizeof(struct ftlh_segment_node_s) * queue->segment_size);
+	if (seg) {
+		seg->owner = queue;
+		ftlh_atomic64_fetch_add_relaxed(&queue->segments, 1);
+	}
+	return seg;
+}
+
+/* Returns a segment nobody can see any more to the pool, or to the heap. Only
+ * call this once an epoch has passed: a popper may still be reading seg. */
+FTLH_PRIVATE_FUNC void ftlh_segment_release(ftlh_unbounded_queue_t queue, struct ftlh_queue_segment_s *seg)
+{
+	ftlh_tagged_ptr_t head;
+
+	if (ftlh_atomic64_load_relaxed(&queue->pool_count) >= FTLH_SEGMENT_POOL_MAX) {
+		ftlh_free_aligned(seg);
+		ftlh_atomic64_fetch_sub_relaxed(&queue->segments, 1);
+		return;
+	}
+
+	memset(seg->nodes, 0, sizeof(struct ftlh_segment_node_s) * queue->segment_size);
+	ftlh_atomic64_store_relaxed(&seg->enq_idx, 0);
+	ftlh_atomic64_store_relaxed(&seg->deq_idx, 0);
+	ftlh_atomic_ptr_store_relaxed(&seg->next, NULL);
+
+	ftlh_atomic64_fetch_add_relaxed(&queue->pool_count, 1);
+	head = ftlh_atomic128_get(&queue->pool);
+	do {
+		ftlh_atomic_ptr_store_relaxed(&seg->pool_next, ftlh_tagged_ptr_ptr(head));
+	} while (!ftlh_atomic128_cas(&queue->pool, &head, ftlh_tagged_ptr_make(seg, ftlh_tagged_ptr_tag(head) + 1)));
+}
+
+FTLH_PRIVATE_FUNC void ftlh_unbounded_queue_unref(ftlh_unbounded_queue_t queue)
+{
+	struct ftlh_queue_segment_s *seg = NULL, *next = NULL;
+
+	if (ftlh_atomic64_fetch_sub_seq_cst(&queue->refs, 1) != 1) {
+		return;
+	}
+
+	for (seg = ftlh_tagged_ptr_ptr(ftlh_atomic128_get(&queue->pool)); seg; seg = next) {
+		next = ftlh_atomic_ptr_load_relaxed(&seg->pool_next);
+		ftlh_free_aligned(seg);
+	}
+	ftlh_free_aligned(queue);
+}
+
+/* Epoch free function for drained and unlinked segments: every thread is done
+ * with it now */
+FTLH_PRIVATE_FUNC void ftlh_segment_recycle(void *ptr)
+{
+	struct ftlh_queue_segment_s *seg = (struct ftlh_queue_segment_s *)ptr;
+	ftlh_unbounded_queue_t queue = seg->owner;
+
+	ftlh_segment_release(queue, seg);
+	ftlh_unbounded_queue_unref(queue);
+}
+
+ftlh_unbounded_queue_t ftlh_unbounded_queue_create(uint_fast64_t segment_size)
+{
+	ftlh_unbounded_queue_t queue = NULL;
+	struct ftlh_queue_segment_s *seg = NULL;
+
+	queue = ftlh_zalloc_aligned(sizeof(struct ftlh_unbounded_queue_s));
+	if (!queue) {
+		goto done;
+	}
+
+	queue->segment_size = (segment_size < 64 ? 64 : segment_size);
+	queue->refs = 1;
+
+	seg = ftlh_segment_alloc(queue);
+	if (!seg) {
+		goto fail;
+	}
+	queue->head = seg;
+	queue->tail = seg;
+
+	goto done;
+
+ fail:
+	__attribute__ ((cold));
+	ftlh_free_aligned(queue);
+	queue = NULL;
+
+ done:
+	__attribute__ ((hot));
+	return queue;
+}
+
+void ftlh_unbounded_queue_destroy(ftlh_unbounded_queue_t *queue_in)
+{
+	ftlh_unbounded_queue_t queue = NULL;
+	struct ftlh_queue_segment_s *seg = NULL, *next = NULL;
+
+	if (!queue_in || !*queue_in) {
+		return;
+	}
+	queue = *queue_in;
+
+	/* Give segments drained earlier a chance to come home first */
+	ftlh_epoch_reclaim();
+
+	for (seg = ftlh_atomic_ptr_get(&queue->head); seg; seg = next) {
+		next = ftlh_atomic_ptr_get(&seg->next);
+		ftlh_free_aligned(seg);
+		ftlh_atomic64_fetch_sub_relaxed(&queue->segments, 1);
+	}
+
+	ftlh_unbounded_queue_unref(queue);
+	*queue_in = NULL;
+}
+
+uint_fast8_t ftlh_unbounded_queue_enqueue(ftlh_unbounded_queue_t queue, void *value)
+{
+	struct ftlh_queue_segment_s *seg = NULL, *next = NULL;
+	struct ftlh_segment_node_s *node = NULL;
+	uint_fast64_t idx = 0;
+	uint_fast8_t ret_val = 0, retired = 0;
+
+	assert(queue);
+
+	if (!ftlh_epoch_enter()) {
+		return 0;
+	}
+
+	/* Count the item before anyone can take it, so the count never wraps */
+	ftlh_atomic64_fetch_add_relaxed(&queue->items, 1);
+
+	for (;;) {
+		seg = ftlh_atomic_ptr_load_acquire(&queue->tail);
+		idx = ftlh_atomic64_fetch_add_relaxed(&seg->enq_idx, 1);
+
+		if (idx < queue->segment_size) {
+			node = &seg->nodes[idx];
+			ftlh_atomic_ptr_store_relaxed(&node->data, value);
+			if (ftlh_atomic64_cas_release(&node->state, FTLH_SEG_NODE_EMPTY, FTLH_SEG_NODE_FULL)) {
+				ret_val = 1;
+				break;
+			}
+			/* A consumer gave up on this node before we got here */
+			continue;
+		}
+
+		/* The segment is closed. Help move the tail on, or link a new segment
+		 * which already holds our item in its first node. */
+		if (seg != ftlh_atomic_ptr_load_acquire(&queue->tail)) {
+			continue;
+		}
+		next = ftlh_atomic_ptr_load_acquire(&seg->next);
+		if (next) {
+			ftlh_atomic_ptr_cas(&queue->tail, seg, next);
+			continue;
+		}
+
+		next = ftlh_segment_alloc(queue);
+		if (!next) {
+			ftlh_atomic64_fetch_sub_relaxed(&queue->items, 1);
+			break;
+		}
+		ftlh_atomic64_store_relaxed(&next->enq_idx, 1);
+		ftlh_atomic_ptr_store_relaxed(&next->nodes[0].data, value);
+		ftlh_atomic64_store_relaxed(&next->nodes[0].state, FTLH_SEG_NODE_FULL);
+
+		if (ftlh_atomic_ptr_cas_release(&seg->next, NULL, next)) {
+			ftlh_atomic_ptr_cas(&queue->tail, seg, next);
+			ret_val = 1;
+			break;
+		}
+
+		/* Somebody else linked one first. Ours was never linked, but it may have
+		 * come from the pool, where a popper can still be reading it. */
+		ftlh_atomic64_fetch_add_relaxed(&queue->refs, 1);
+		ftlh_epoch_retire(next, ftlh_segment_recycle);
+		retired = 1;
+	}
+
+	ftlh_epoch_exit();
+
+	if (retired) {
+		ftlh_epoch_reclaim();
+	}
+
+	return ret_val;
+}
+
+uint_fast8_t ftlh_unbounded_queue_try_dequeue(ftlh_unbounded_queue_t queue, void **value)
+{
+	struct ftlh_queue_segment_s *seg = NULL, *next = NULL;
+	struct ftlh_segment_node_s *node = NULL;
+	uint_fast64_t idx = 0;
+	uint_fast8_t ret_val = 0, retired = 0;
+
+	assert(queue);
+
+	if (!ftlh_epoch_enter()) {
+		return 0;
+	}
+
+	for (;;) {
+		seg = ftlh_atomic_ptr_load_acquire(&queue->head);
+
+		/* Check before taking an index, so polling an empty queue does not
+		 * burn through the nodes producers are about to fill */
+		if (ftlh_atomic64_load_relaxed(&seg->deq_idx) >= ftlh_atomic64_load_relaxed(&seg->enq_idx) &&
+			!ftlh_atomic_ptr_load_acquire(&seg->next)) {
+			break;
+		}
+
+		idx = ftlh_atomic64_fetch_add_relaxed(&seg->deq_idx, 1);
+		if (idx >= queue->segment_size) {
+			/* Drained; move on to the next segment, if there is one */
+			next = ftlh_atomic_ptr_load_acquire(&seg->next);
+			if (!next) {
+				break;
+			}
+			if (ftlh_atomic_ptr_cas(&queue->head, seg, next) == seg) {
+				ftlh_atomic64_fetch_add_relaxed(&queue->refs, 1);
+				ftlh_epoch_retire(seg, ftlh_segment_recycle);
+				retired = 1;
+			}
+			continue;
+		}
+
+		node = &seg->nodes[idx];
+		if (ftlh_atomic64_exchange_acquire(&node->state, FTLH_SEG_NODE_TAKEN) == FTLH_SEG_NODE_FULL) {
+			if (value) {
+				*value = ftlh_atomic_ptr_load_relaxed(&node->data);
+			}
+			ftlh_atomic64_fetch_sub_relaxed(&queue->items, 1);
+			ret_val = 1;
+			break;
+		}
+		/* We beat the producer of this node; it will move on to another */
+	}
+
+	ftlh_epoch_exit();
+
+	if (retired) {
+		ftlh_epoch_reclaim();
+	}
+
+	return ret_val;
+}
+
+uint_fast64_t ftlh_unbounded_queue_approx_items(ftlh_unbounded_queue_t queue)
+{
+	if (!queue) {
+		return 0;
+	}
+	return ftlh_atomic64_load_relaxed(&queue->items);
+}
+
+uint_fast64_t ftlh_unbounded_queue_segments(ftlh_unbounded_queue_t queue)
+{
+	if (!queue) {
+		return 0;
+	}
+	return ftlh_atomic64_load_relaxed(&queue->segments);
+}
+
+
+ftlh_ring_t ftlh_ring_create(uint_fast64_t size)
+{
+	ftlh_ring_t ring = NULL;
+	uint_fast64_t rounded = 64;
+
+	while (rounded < size) {
+		rounded <<= 1;
+	}
+
+	ring = ftlh_zalloc_aligned(sizeof(struct ftlh_ring_s));
+	if (!ring) {
+		goto done;
+	}
+
+	ring->size = rounded;
+	ring->mask = rounded - 1;
+	ring->nodes = ftlh_zalloc_aligned(sizeof(struct ftlh_queue_node_s) * rounded);
+	if (!ring->nodes) {
+		goto fail;
+	}
+
+	goto done;
+
+ fail:
+	__attribute__ ((cold));
+	ftlh_free_aligned(ring);
+	ring = NULL;
+
+ done:
+	__attribute__ ((hot));
+	return ring;
+}
+
+void ftlh_ring_destroy(ftlh_ring_t *ring_in)
+{
+	ftlh_ring_t ring = NULL;
+	uint64_t n = 0;
+
+	if (!ring_in || !*ring_in) {
+		return;
+	}
+	ring = *ring_in;
+
+	for (n = 0; n < ring->consumer_count; ++n) {
+		ftlh_safe_free(ring->consumers[n]->deps);
+		ftlh_free_aligned(ring->consumers[n]);
+	}
+	ftlh_free_aligned(ring->nodes);
+	ftlh_free_aligned(ring);
+	*ring_in = NULL;
+}
+
+ftlh_ring_consumer_t ftlh_ring_add_consumer(ftlh_ring_t ring, ftlh_ring_consumer_t *deps, uint_fast32_t dep_count)
+{
+	ftlh_ring_consumer_t consumer = NULL;
+	uint_fast32_t n = 0;
+
+	if (!ring || ring->consumer_count >= FTLH_RING_MAX_CONSUMERS || (dep_count && !deps)) {
+		goto fail;
+	}
+	for (n = 0; n < dep_count; ++n) {
+		if (!deps[n] || deps[n]->ring != ring) {
+			goto fail;
+		}
+	}
+
+	consumer = ftlh_zalloc_aligned(sizeof(struct ftlh_ring_consumer_s));
+	if (!consumer) {
+		goto fail;
+	}
+	if (dep_count) {
+		consumer->deps = malloc(sizeof(ftlh_ring_consumer_t) * dep_count);
+		if (!consumer->deps) {
+			goto fail;
+		}
+		memcpy(consumer->deps, deps, sizeof(ftlh_ring_consumer_t) * dep_count);
+	}
+	consumer->dep_count = dep_count;
+	consumer->ring = ring;
+	consumer->dep_cached = ftlh_atomic64_load_acquire(&ring->prod_pos);
+	ftlh_atomic64_store_relaxed(&consumer->cursor, consumer->dep_cached);
+
+	/* Producers scan the list on every gate refresh; publish the new entry last */
+	ring->consumers[ring->consumer_count] = consumer;
+	ftlh_atomic_fence_release();
+	++ring->consumer_count;
+
+	goto done;
+
+ fail:
+	__attribute__ ((cold));
+	ftlh_free_aligned(consumer);
+	consumer = NULL;
+
+ done:
+	__attribute__ ((hot));
+	return consumer;
+}
+
+/* Lowest cursor of all consumers, or limit if there are none or all are past it */
+static inline __attribute__ ((always_inline)) uint_fast64_t ftlh_ring_gate(ftlh_ring_t ring, uint_fast64_t limit)
+{
+	uint_fast64_t n = 0, cursor = 0, count = ring->consumer_count;
+
+	for (n = 0; n < count; ++n) {
+		cursor = ftlh_atomic64_load_acquire(&ring->consumers[n]->cursor);
+		if (cursor < limit) {
+			limit = cursor;
+		}
+	}
+	return limit;
+}
+
+FTLH_PRIVATE_FUNC uint_fast8_t ftlh_ring_push(ftlh_ring_t ring, void *value, uint_fast8_t wait)
+{
+	struct ftlh_queue_node_s *node = NULL;
+	uint_fast64_t prod_pos = 0, gate = 0;
+	ftlh_backoff_t backoff;
+
+	assert(ring);
+	ftlh_backoff_init(&backoff);
+
+	prod_pos = ftlh_atomic64_load_relaxed(&ring->prod_pos);
+	for (;;) {
+		/* The node for prod_pos last held prod_pos - size; every consumer must
+		 * be past that. Only rescan the cursors when the cached gate says no. */
+		gate = ftlh_atomic64_load_relaxed(&ring->gate_cached);
+		if (prod_pos - gate >= ring->size) {
+			gate = ftlh_ring_gate(ring, prod_pos);
+			ftlh_atomic64_store_relaxed(&ring->gate_cached, gate);
+			if (prod_pos - gate >= ring->size) {
+				if (!wait) {
+					return 0;
+				}
+				ftlh_backoff_wait(&backoff, NULL, 0);
+				prod_pos = ftlh_atomic64_load_relaxed(&ring->prod_pos);
+				continue;
+			}
+		}
+
+		if (ftlh_atomic64_cas_relaxed(&ring->prod_pos, prod_pos, prod_pos + 1)) {
+			break;
+		}
+		prod_pos = ftlh_atomic64_load_relaxed(&ring->prod_pos);
+	}
+
+	node = &ring->nodes[prod_pos & ring->mask];
+	ftlh_atomic_ptr_store_relaxed(&node->data, value);
+	ftlh_atomic64_store_release(&node->seq, prod_pos + 1);
+
+	return 1;
+}
+
+void ftlh_ring_publish(ftlh_ring_t ring, void *value)
+{
+	ftlh_ring_push(ring, value, 1);
+}
+
+uint_fast8_t ftlh_ring_try_publish(ftlh_ring_t ring, void *value)
+{
+	return ftlh_ring_push(ring, value, 0);
+}
+
+/* How many items from the consumer's cursor on it may read, up to max */
+static inline __attribute__ ((always_inline)) uint_fast64_t ftlh_ring_available(ftlh_ring_consumer_t consumer,
+																				uint_fast64_t cursor, uint_fast64_t max)
+{
+	ftlh_ring_t ring = consumer->ring;
+	uint_fast64_t n = 0, limit = cursor + max, dep_cursor = 0;
+
+	/* Stay behind every stage we depend on */
+	if (consumer->dep_count) {
+		if (consumer->dep_cached <= cursor) {
+			for (n = 0; n < consumer->dep_count; ++n) {
+				dep_cursor = ftlh_atomic64_load_acquire(&consumer->deps[n]->cursor);
+				if (n == 0 || dep_cursor < consumer->dep_cached) {
+					consumer->dep_cached = dep_cursor;
+				}
+			}
+		}
+		if (consumer->dep_cached < limit) {
+			limit = consumer->dep_cached;
+		}
+	}
+
+	/* Producers may publish out of order; stop at the first gap */
+	for (n = cursor; n < limit; ++n) {
+		if (ftlh_atomic64_load_acquire(&ring->nodes[n & ring->mask].seq) != n + 1) {
+			break;
+		}
+	}
+	return n - cursor;
+}
+
+uint_fast8_t ftlh_ring_try_read(ftlh_ring_consumer_t consumer, void **value)
+{
+	return (ftlh_ring_read_batch(consumer, value, 1) != 0);
+}
+
+uint_fast64_t ftlh_ring_peek_batch(ftlh_ring_consumer_t consumer, void **values, uint_fast64_t max)
+{
+	uint_fast64_t cursor = 0, n = 0, count = 0;
+
+	assert(consumer);
+
+	cursor = ftlh_atomic64_load_relaxed(&consumer->cursor);
+	count = ftlh_ring_available(consumer, cursor, max);
+
+	if (values) {
+		for (n = 0; n < count; ++n) {
+			values[n] = ftlh_atomic_ptr_load_relaxed(&consumer->ring->nodes[(cursor + n) & consumer->ring->mask].data);
+		}
+	}
+
+	return count;
+}
+
+void ftlh_ring_advance(ftlh_ring_consumer_t consumer, uint_fast64_t count)
+{
+	assert(consumer);
+
+	/* Done with the batch: dependents may read it, producers may reuse it */
+	ftlh_atomic64_store_release(&consumer->cursor, ftlh_atomic64_load_relaxed(&consumer->cursor) + count);
+}
+
+uint_fast64_t ftlh_ring_read_batch(ftlh_ring_consumer_t consumer, void **values, uint_fast64_t max)
+{
+	uint_fast64_t count = ftlh_ring_peek_batch(consumer, values, max);
+
+	if (count) {
+		ftlh_ring_advance(consumer, count);
+	}
+
+	return count;
+}
+
+struct ftlh_globals_s ftlh_globals = { .epoch = 1 };
+
+uint_fast8_t ftlh_start()
+{
+	return ftlh_start_advanced(4096, 2);
+}
+
+uint_fast8_t ftlh_start_advanced(uint64_t max_tables, uint32_t threads)
+{
+	uint_fast8_t ret_val = 0;
+	pthread_attr_t attr;
+
+	if ((errno = pthread_attr_init(&attr)) != 0) {
+		ret_val = 1;
+		goto fail1;
+	}
+
+	if ((errno = pthread_attr_setstacksize(&attr, 262144)) != 0) {
+		ret_val = 1;
+		goto fail2;
+	}
+
+	ret_val = ftlh_start_expert(max_tables, threads, &attr);
+
+ fail2:
+	if ((errno = pthread_attr_destroy(&attr)) != 0) {
+		ret_val = 1;
+	}
+
+ fail1:
+	return ret_val;
+}
+
+uint_fast8_t ftlh_start_expert(uint64_t max_tables, uint32_t threads, const pthread_attr_t *attr)
+{
+	uint_fast8_t status = 0;
+	uint_fast32_t th = 0;
+	uint32_t started = 0;
+	ftlh_backoff_t backoff;
+
+	ftlh_globals.tables = ftlh_zalloc_aligned(sizeof(ftlh_atomicptr_t) * max_tables);
+	if (!ftlh_globals.tables) {
+		errno = ENOMEM;
+		status = 1;
+		goto done;
+	}
+
+	ftlh_globals.table_count = max_tables;
+
+	ftlh_globals.threads = ftlh_zalloc_aligned(sizeof(struct ftlh_thread_status_s) * threads);
+
+	if (!ftlh_globals.threads) {
+		errno = ENOMEM;
+		status = 1;
+		goto fail;
+	}
+
+	ftlh_globals.thread_count = threads;
+	ftlh_atomic32_set(&ftlh_globals.started, 0);
+	ftlh_atomic_ptr_set(&ftlh_globals.running, (void*)1);
+
+	for (th = 0; th < ftlh_globals.thread_count; ++th) {
+		ftlh_globals.threads[th].id = th;
+		pthread_create(&ftlh_globals.threads[th].thread, attr, ftlh_hash_worker_thread, (void *)&ftlh_globals.threads[th]);
+	}
+
+	/* Each worker bumps started and notifies us once it is running */
+	ftlh_backoff_init(&backoff);
+	while ((started = ftlh_atomic32_load_acquire(&ftlh_globals.started)) < ftlh_globals.thread_count) {
+		ftlh_backoff_wait(&backoff, &ftlh_globals.started, started);
+	}
+
+	goto done;
+ fail:
+	__attribute__ ((cold));
+	ftlh_free_aligned((void*)ftlh_globals.tables);
+	
+ done:
+	__attribute__ ((hot));
+	return status;
+}
+
+void ftlh_stop()
+{
+	uint_fast32_t th = 0;
+
+	ftlh_atomic_ptr_set(&ftlh_globals.running, (void*)0);
+
+	for (th = 0; th < ftlh_globals.thread_count; ++th) {
+		ftlh_atomic32_inc(&ftlh_globals.threads[th].wake);
+		ftlh_atomic32_notify_one(&ftlh_globals.threads[th].wake);
+		pthread_join(ftlh_globals.threads[th].thread, NULL);
+	}
+
+	/* Only now: a worker still running may be stealing from any other's list */
+	for (th = 0; th < ftlh_globals.thread_count; ++th) {
+		ftlh_free_aligned(ftlh_atomic_ptr_get(&ftlh_globals.threads[th].tables));
+	}
+
+	/* No worker is left to reclaim what they retired */
+	ftlh_epoch_reclaim();
+	ftlh_request_pool_drain();
+
+	ftlh_free_aligned(ftlh_globals.threads);
+	ftlh_free_aligned((void*)ftlh_globals.tables);
+}
+
+void ftlh_set_worker_spin(uint_fast64_t max_usec)
+{
+	ftlh_atomic64_set(&ftlh_globals.worker_spin_usec, max_usec);
+}
+
+void ftlh_set_work_stealing(uint_fast8_t enabled)
+{
+	ftlh_atomic32_set(&ftlh_globals.no_stealing, !enabled);
+}
+
+
+/* Wakes the worker if it is parked. Must follow the enqueue it is signalling. */
+void ftlh_worker_wake(struct ftlh_thread_status_s *worker)
+{
+	/* Pairs with the fence in ftlh_worker_idle(): either we see the worker asleep
+	 * here or the worker sees the new request when it re-checks before parking. */
+	ftlh_atomic_fence_seq_cst();
+	if (ftlh_atomic32_load_acquire(&worker->sleeping)) {
+		ftlh_atomic32_inc(&worker->wake);
+		ftlh_atomic32_notify_one(&worker->wake);
+	}
+}
+
+/* Signals that a request was queued on the table. The owner is woken if it is
+ * parked. If the owner is busy elsewhere and a backlog builds up, a parked peer
+ * is woken to steal the table instead. */
+void ftlh_table_wake(struct ftlh_hash_table_s *table)
+{
+	struct ftlh_thread_status_s *worker = table->worker;
+	uint_fast32_t th = 0;
+
+	ftlh_atomic_fence_seq_cst();
+	if (ftlh_atomic32_load_acquire(&worker->sleeping)) {
+		ftlh_worker_wake(worker);
+		return;
+	}
+
+	if (ftlh_globals.thread_count < 2 || ftlh_atomic32_load_acquire(&ftlh_globals.no_stealing) ||
+		ftlh_atomic32_load_acquire(&table->servicing) ||
+		ftlh_queue_approx_items(table->requests) < FTLH_STEAL_DEPTH)
+	{
+		return;
+	}
+
+	for (th = 0; th < ftlh_globals.thread_count; ++th) {
+		if (ftlh_atomic32_load_acquire(&ftlh_globals.threads[th].sleeping)) {
+			ftlh_worker_wake(&ftlh_globals.threads[th]);
+			return;
+		}
+	}
+}
+
+FTLH_PRIVATE_FUNC uint_fast8_t ftlh_worker_has_work(struct ftlh_thread_status_s *thread_info)
+{
+	struct ftlh_table_list_s *list = NULL;
+	uint_fast8_t found = 0;
+	uint64_t n = 0;
+
+	/* A table a thief is servicing is not work for us: we could not get it, and
+	 * would only spin until the thief is done. The thief wakes us if it leaves
+	 * requests behind. */
+	ftlh_epoch_enter();
+	list = ftlh_atomic_ptr_load_acquire(&thread_info->tables);
+	for (n = 0; list && n < list->count && !found; ++n) {
+		found = (!ftlh_atomic32_load_acquire(&list->tables[n]->servicing) &&
+				 ftlh_queue_approx_items(list->tables[n]->requests) != 0);
+	}
+	ftlh_epoch_exit();
+
+	return found;
+}
+
+/* Adds or removes a table from a worker's list by swapping in a modified copy.
+ * Returns 0 if out of memory. */
+FTLH_PRIVATE_FUNC uint_fast8_t ftlh_worker_update_tables(struct ftlh_thread_status_s *worker,
+														 struct ftlh_hash_table_s *add, struct ftlh_hash_table_s *remove)
+{
+	struct ftlh_table_list_s *old_list = NULL, *new_list = NULL;
+	uint64_t count = 0, n = 0;
+
+	do {
+		ftlh_free_aligned(new_list);
+		new_list = NULL;
+
+		old_list = ftlh_atomic_ptr_get(&worker->tables);
+		count = (old_list ? old_list->count : 0);
+
+		new_list = ftlh_zalloc_aligned(sizeof(struct ftlh_table_list_s) + (sizeof(struct ftlh_hash_table_s *) * (count + 1)));
+		if (!new_list) {
+			return 0;
+		}
+
+		for (n = 0; n < count; ++n) {
+			if (old_list->tables[n] != remove) {
+				new_list->tables[new_list->count++] = old_list->tables[n];
+			}
+		}
+		if (add) {
+			new_list->tables[new_list->count++] = add;
+		}
+	} while (ftlh_atomic_ptr_cas(&worker->tables, old_list, new_list) != old_list);
+
+	if (old_list) {
+		ftlh_epoch_retire(old_list, ftlh_free_aligned);
+	}
+
+	return 1;
+}
+
+/* Called when our own tables had nothing queued. Services tables of the other
+ * workers which have requests waiting and which nobody is servicing right now.
+ * Returns 1 if anything was applied.
+ */
+FTLH_PRIVATE_FUNC uint_fast8_t ftlh_worker_steal(struct ftlh_thread_status_s *thread_info)
+{
+	struct ftlh_thread_status_s *victim = NULL;
+	struct ftlh_hash_table_s *table = NULL;
+	struct ftlh_table_list_s *list = NULL;
+	uint_fast32_t th = 0;
+	uint_fast8_t worked = 0;
+	uint64_t n = 0;
+
+	if (ftlh_atomic32_load_acquire(&ftlh_globals.no_stealing)) {
+		return 0;
+	}
+
+	/* Start with the next worker so thieves spread over their victims */
+	for (th = 1; th < ftlh_globals.thread_count && !worked; ++th) {
+		victim = &ftlh_globals.threads[(thread_info->id + th) % ftlh_globals.thread_count];
+
+		ftlh_epoch_enter();
+		list = ftlh_atomic_ptr_load_acquire(&victim->tables);
+		for (n = 0; list && n < list->count; ++n) {
+			table = list->tables[n];
+			if (ftlh_atomic32_load_acquire(&table->servicing) || ftlh_queue_approx_items(table->requests) == 0 ||
+				!ftlh_hash_table_service(table))
+			{
+				continue;
+			}
+			worked = 1;
+
+			/* The owner may have parked while we held the table. Unless somebody
+			 * holds it again, who will do the same, hand it what we left. The
+			 * fence orders our release of servicing before the look at the
+			 * queue, as the owner orders sleeping before its look at servicing. */
+			ftlh_atomic_fence_seq_cst();
+			if (!ftlh_atomic32_load_acquire(&table->servicing) && ftlh_queue_approx_items(table->requests) != 0) {
+				ftlh_table_wake(table);
+			}
+		}
+		ftlh_epoch_exit();
+	}
+
+	return worked;
+}
+
+/* Called when a pass found no work. Optionally spins, then parks on the wake
+ * futex until a producer queues a request for one of our tables.
+ */
+FTLH_PRIVATE_FUNC void ftlh_worker_idle(struct ftlh_thread_status_s *thread_info)
+{
+	uint_fast64_t max_spin = ftlh_atomic64_get(&ftlh_globals.worker_spin_usec);
+	uint_fast64_t start = 0, now = 0, parked = 0;
+	uint32_t wake = 0;
+
+	if (thread_info->spin_usec > max_spin) {
+		thread_info->spin_usec = max_spin;
+	}
+
+	if (thread_info->spin_usec) {
+		start = ftlh_monotonic_usec();
+		do {
+			ftlh_cpu_relax();
+			if (ftlh_worker_has_work(thread_info)) {
+				return;
+			}
+			now = ftlh_monotonic_usec();
+		} while (now - start < thread_info->spin_usec);
+
+		/* Spinning did not pay off this time */
+		thread_info->spin_usec >>= 1;
+	}
+
+	ftlh_atomic32_store_relaxed(&thread_info->sleeping, 1);
+	ftlh_atomic_fence_seq_cst();
+	wake = ftlh_atomic32_get(&thread_info->wake);
+
+	if (!ftlh_worker_has_work(thread_info) && (uintptr_t)ftlh_atomic_ptr_get(&ftlh_globals.running) == 1) {
+		parked = ftlh_monotonic_usec();
+		ftlh_atomic32_wait(&thread_info->wake, wake,
+						   ftlh_atomic_ptr_get(&ftlh_globals.retired) ? FTLH_RECLAIM_PARK_USEC : 0);
+
+		/* Work arriving soon after we parked means spinning would have caught it */
+		if (max_spin && ftlh_monotonic_usec() - parked < max_spin) {
+			thread_info->spin_usec = (thread_info->spin_usec ? thread_info->spin_usec << 1 : 1);
+		}
+	}
+
+	ftlh_atomic32_store_release(&thread_info->sleeping, 0);
+}
+
+void *ftlh_hash_worker_thread(void *info)
+{
+	struct ftlh_thread_status_s *thread_info = (struct ftlh_thread_status_s *)info;
+
+	ftlh_atomic64_set(&thread_info->running, 1);
+	ftlh_atomic32_fetch_add_release(&ftlh_globals.started, 1);
+	ftlh_atomic32_notify_all(&ftlh_globals.started);
+
+	while ((uintptr_t)ftlh_atomic_ptr_load_acquire(&ftlh_globals.running) == 1) {
+		struct ftlh_table_list_s *list = NULL;
+		uint_fast8_t worked = 0;
+		uint64_t n = 0;
+
+		/* Only the tables we own, so a pass costs nothing for unused table slots.
+		 * The list may be swapped by a create / destroy while we walk it. */
+		ftlh_epoch_enter();
+		list = ftlh_atomic_ptr_load_acquire(&thread_info->tables);
+		for (n = 0; list && n < list->count; ++n) {
+			worked |= ftlh_hash_table_service(list->tables[n]);
+		}
+		ftlh_epoch_exit();
+
+		if (!worked) {
+			worked = ftlh_worker_steal(thread_info);
+		}
+
+		ftlh_epoch_reclaim();
+
+		/* Only go idle when a full pass found nothing to do */
+		if (!worked) {
+			ftlh_worker_idle(thread_info);
+		}
+	}
+	ftlh_atomic64_set(&thread_info->running, 0);
+
+
+	return NULL;
+}
+
+
+
+/**************************************************
+ * Epoch based reclamation
+ *
+ * Lock-free readers announce the global epoch in their thread's record while they
+ * look at shared memory. Writers retire memory instead of freeing it, stamping it
+ * with the epoch at the time. Reclaiming advances the epoch and frees whatever
+ * was retired before the oldest epoch any reader still has announced.
+ *************************************************/
+
+static __thread struct ftlh_epoch_rec_s *ftlh_epoch_self = NULL;
+static __thread uint_fast32_t ftlh_epoch_depth = 0;
+
+/* Memory retired while out of memory and inside an epoch, where we can neither
+ * track it nor wait for readers. Freed at our outermost ftlh_epoch_exit(). */
+struct ftlh_epoch_deferred_s {
+	void *ptr;
+	void (*free_func)(void *);
+};
+
+#define FTLH_EPOCH_DEFER_MAX 64
+
+static __thread struct ftlh_epoch_deferred_s ftlh_epoch_deferred[FTLH_EPOCH_DEFER_MAX];
+static __thread uint_fast32_t ftlh_epoch_deferred_count = 0;
+
+/* See ftlh_private.h */
+ftlh_atomic32_t ftlh_epoch_fail_alloc = 0;
+static pthread_key_t ftlh_epoch_key;
+static pthread_once_t ftlh_epoch_once = PTHREAD_ONCE_INIT;
+
+FTLH_PRIVATE_FUNC void ftlh_epoch_release(void *rec_in)
+{
+	struct ftlh_epoch_rec_s *rec = (struct ftlh_epoch_rec_s *)rec_in;
+
+	ftlh_atomic64_set(&rec->epoch, 0);
+	ftlh_atomic64_set(&rec->in_use, 0);
+}
+
+FTLH_PRIVATE_FUNC void ftlh_epoch_key_create(void)
+{
+	pthread_key_create(&ftlh_epoch_key, ftlh_epoch_release);
+}
+
+FTLH_PRIVATE_FUNC struct ftlh_epoch_rec_s *ftlh_epoch_register(void)
+{
+	struct ftlh_epoch_rec_s *rec = NULL, *head = NULL;
+
+	/* Reuse a record left behind by an exited thread if there is one */
+	for (rec = ftlh_atomic_ptr_get(&ftlh_globals.epoch_recs); rec; rec = rec->next) {
+		if (!ftlh_atomic64_get(&rec->in_use) && ftlh_atomic64_bool_cas(&rec->in_use, 0, 1)) {
+			goto done;
+		}
+	}
+
+	rec = ftlh_zalloc_aligned(sizeof(struct ftlh_epoch_rec_s));
+	if (!rec) {
+		return NULL;
+	}
+	rec->in_use = 1;
+
+	do {
+		head = ftlh_atomic_ptr_get(&ftlh_globals.epoch_recs);
+		rec->next = head;
+	} while (ftlh_atomic_ptr_cas(&ftlh_globals.epoch_recs, head, rec) != head);
+
+ done:
+	pthread_once(&ftlh_epoch_once, ftlh_epoch_key_create);
+	pthread_setspecific(ftlh_epoch_key, rec);
+	ftlh_epoch_self = rec;
+
+	return rec;
+}
+
+uint_fast8_t ftlh_epoch_enter(void)
+{
+	struct ftlh_epoch_rec_s *rec = ftlh_epoch_self;
+
+	if (ftlh_epoch_depth++) {
+		return 1;
+	}
+
+	if (!rec && !(rec = ftlh_epoch_register())) {
+		ftlh_epoch_depth = 0;
+		return 0;
+	}
+
+	/* Must be a full barrier: our reads of shared memory may not move above it.
+	 * A seq_cst store alone does not stop later acquire or relaxed loads from
+	 * doing so; the fence does, and pairs with the increment and scan in
+	 * ftlh_epoch_reclaim(). */
+	ftlh_atomic64_store_seq_cst(&rec->epoch, ftlh_atomic64_load_acquire(&ftlh_globals.epoch));
+	ftlh_atomic_fence_seq_cst();
+
+	return 1;
+}
+
+/* Waits until every other thread has left the read section it was in, if any.
+ * The caller must not be in one itself, or a thread waiting on it in turn would
+ * never get out. */
+FTLH_PRIVATE_FUNC void ftlh_epoch_wait_readers(void)
+{
+	struct ftlh_epoch_rec_s *rec = NULL;
+	uint64_t epoch = ftlh_atomic64_inc(&ftlh_globals.epoch) + 1;
+	uint64_t rec_epoch = 0;
+	ftlh_backoff_t backoff;
+
+	for (rec = ftlh_atomic_ptr_get(&ftlh_globals.epoch_recs); rec; rec = rec->next) {
+		if (rec == ftlh_epoch_self) {
+			continue;
+		}
+		ftlh_backoff_init(&backoff);
+		while ((rec_epoch = ftlh_atomic64_load_acquire(&rec->epoch)) != 0 && rec_epoch < epoch) {
+			ftlh_backoff_wait(&backoff, NULL, 0);
+		}
+	}
+}
+
+FTLH_PRIVATE_FUNC void ftlh_epoch_free_deferred(void)
+{
+	struct ftlh_epoch_deferred_s item;
+
+	ftlh_epoch_wait_readers();
+
+	/* A free function may retire more, so take each item off before calling it */
+	while (ftlh_epoch_deferred_count) {
+		item = ftlh_epoch_deferred[--ftlh_epoch_deferred_count];
+		item.free_func(item.ptr);
+	}
+}
+
+void ftlh_epoch_exit(void)
+{
+	if (--ftlh_epoch_depth) {
+		return;
+	}
+	ftlh_atomic64_store_release(&ftlh_epoch_self->epoch, 0);
+
+	if (ftlh_epoch_deferred_count) {
+		ftlh_epoch_free_deferred();
+	}
+}
+
+void ftlh_epoch_retire(void *ptr, void (*free_func)(void *))
+{
+	struct ftlh_retired_s *node = NULL, *head = NULL;
+
+	if (!ptr) {
+		return;
+	}
+
+	if (!ftlh_atomic32_load_relaxed(&ftlh_epoch_fail_alloc)) {
+		node = malloc(sizeof(struct ftlh_retired_s));
+	}
+	if (!node) {
+		/* No memory to track it. Outside a read section we can wait out every
+		 * reader and free it now. Inside one we cannot: a reader may be waiting
+		 * on us, so keep it until we leave. */
+		if (!ftlh_epoch_depth) {
+			ftlh_epoch_wait_readers();
+			free_func(ptr);
+		} else if (ftlh_epoch_deferred_count < FTLH_EPOCH_DEFER_MAX) {
+			ftlh_epoch_deferred[ftlh_epoch_deferred_count].ptr = ptr;
+			ftlh_epoch_deferred[ftlh_epoch_deferred_count].free_func = free_func;
+			++ftlh_epoch_deferred_count;
+		}
+		/* Else nowhere is left to keep it; leaking it beats freeing it early */
+		return;
+	}
+
+	node->ptr = ptr;
+	node->free_func = free_func;
+	node->epoch = ftlh_atomic64_get(&ftlh_globals.epoch);
+
+	do {
+		head = ftlh_atomic_ptr_get(&ftlh_globals.retired);
+		node->next = head;
+	} while (ftlh_atomic_ptr_cas(&ftlh_globals.retired, head, node) != head);
+}
+
+void ftlh_epoch_reclaim(void)
+{
+	struct ftlh_retired_s *list = NULL, *node = NULL, *next = NULL, *keep = NULL, *keep_tail = NULL, *head = NULL;
+	struct ftlh_epoch_rec_s *rec = NULL;
+	uint64_t safe = 0;
+
+	if (!ftlh_atomic_ptr_get(&ftlh_globals.retired)) {
+		return;
+	}
+
+	list = ftlh_atomic_ptr_set(&ftlh_globals.retired, NULL);
+
+	/* Readers which enter from now on cannot see anything on the list */
+	safe = ftlh_atomic64_inc(&ftlh_globals.epoch) + 1;
+	for (rec = ftlh_atomic_ptr_get(&ftlh_globals.epoch_recs); rec; rec = rec->next) {
+		uint64_t rec_epoch = ftlh_atomic64_get(&rec->epoch);
+		if (rec_epoch && rec_epoch < safe) {
+			safe = rec_epoch;
+		}
+	}
+
+	for (node = list; node; node = next) {
+		next = node->next;
+		if (node->epoch < safe) {
+			node->free_func(node->ptr);
+			free(node);
+			continue;
+		}
+		node->next = keep;
+		if (!keep) {
+			keep_tail = node;
+		}
+		keep = node;
+	}
+
+	if (!keep) {
+		return;
+	}
+
+	/* Put back whatever is still visible to a reader */
+	do {
+		head = ftlh_atomic_ptr_get(&ftlh_globals.retired);
+		keep_tail->next = head;
+	} while (ftlh_atomic_ptr_cas(&ftlh_globals.retired, head, keep) != head);
+}
+
+
+
+/**************************************************
+ * Keys
+ *************************************************/
+
+FTLH_PRIVATE_FUNC ftlh_key_t ftlh_key_alloc(size_t len)
+{
+	ftlh_key_t key = NULL;
+	void *mem = NULL;
+
+	if (len <= FTLH_KEY_INLINE_MAX) {
+		if (posix_memalign(&mem, FTLH_CACHE_LINE, FTLH_CACHE_LINE)) {
+			goto done;
+		}
+		key = mem;
+	} else {
+		if (len > SIZE_MAX - offsetof(struct ftlh_key_s, str) - 1) {
+			goto done;
+		}
+		key = malloc(offsetof(struct ftlh_key_s, str) + len + 1);
+		if (!key) {
+			goto done;
+		}
+	}
+
+	/* Keep a trailing NUL so string keys can be printed */
+	key->str[len] = '\0';
+	key->len = len;
+	key->hash = 0;
+	key->hash_func = NULL;
+	key->owner = NULL;
+
+ done:
+	return key;
+}
+
+/* Called by every builder once the bytes are in place. Keys never change after
+ * this, so the hash is computed once in the key's lifetime, unless the key is
+ * inserted into a table which uses another hash function. */
+static inline __attribute__ ((always_inline)) ftlh_key_t ftlh_key_seal(ftlh_key_t key)
+{
+	if (key) {
+		key->hash_func = ftlh_hash_best();
+		key->hash = key->hash_func(key->str, key->len);
+	}
+	return key;
+}
+
+ftlh_key_t ftlh_build_key_concat(const char *str1, ...)
+{
+	ftlh_key_t key = NULL;
+	const char *str = NULL;
+	size_t len = 0, pos = 0, n = 0;
+	va_list ap;
+
+	va_start(ap, str1);
+	for (str = str1; str; str = va_arg(ap, const char *)) {
+		len += strlen(str);
+	}
+	va_end(ap);
+
+	key = ftlh_key_alloc(len);
+	if (!key) {
+		goto done;
+	}
+
+	va_start(ap, str1);
+	for (str = str1; str; str = va_arg(ap, const char *)) {
+		n = strlen(str);
+		memcpy(key->str + pos, str, n);
+		pos += n;
+	}
+	va_end(ap);
+
+ done:
+	return ftlh_key_seal(key);
+}
+
+ftlh_key_t ftlh_build_key_printf(const char *fmt, ...)
+{
+	ftlh_key_t key = NULL;
+	int len = 0;
+	va_list ap;
+
+	/* Measure first so the text can be formatted straight into the key */
+	va_start(ap, fmt);
+	len = vsnprintf(NULL, 0, fmt, ap);
+	va_end(ap);
+
+	if (len < 0) {
+		goto done;
+	}
+
+	key = ftlh_key_alloc((size_t)len);
+	if (!key) {
+		goto done;
+	}
+
+	va_start(ap, fmt);
+	vsnprintf(key->str, (size_t)len + 1, fmt, ap);
+	va_end(ap);
+
+ done:
+	return ftlh_key_seal(key);
+}
+
+ftlh_key_t ftlh_build_key_binary(const void *loc, size_t len)
+{
+	ftlh_key_t key = NULL;
+
+	if (!loc && len) {
+		goto done;
+	}
+
+	key = ftlh_key_alloc(len);
+	if (!key) {
+		goto done;
+	}
+
+	if (len) {
+		memcpy(key->str, loc, len);
+	}
+
+ done:
+	return ftlh_key_seal(key);
+}
+
+ftlh_key_t ftlh_build_key_binary_concat(const void *loc, size_t len, ...)
+{
+	ftlh_key_t key = NULL;
+	const void *cur = NULL;
+	size_t total = 0, pos = 0, n = 0;
+	va_list ap;
+
+	total = len;
+	va_start(ap, len);
+	while ((cur = va_arg(ap, const void *))) {
+		total += va_arg(ap, size_t);
+	}
+	va_end(ap);
+
+	key = ftlh_key_alloc(total);
+	if (!key) {
+		goto done;
+	}
+
+	if (len) {
+		memcpy(key->str, loc, len);
+	}
+	pos = len;
+
+	va_start(ap, len);
+	while ((cur = va_arg(ap, const void *))) {
+		n = va_arg(ap, size_t);
+		memcpy(key->str + pos, cur, n);
+		pos += n;
+	}
+	va_end(ap);
+
+ done:
+	return ftlh_key_seal(key);
+}
+
+ftlh_key_t ftlh_key_clone(const ftlh_key_t key_src)
+{
+	ftlh_key_t key = NULL;
+
+	if (!key_src) {
+		goto done;
+	}
+
+	key = ftlh_key_alloc(key_src->len);
+	if (!key) {
+		goto done;
+	}
+
+	/* Same bytes, same hash; no need to hash them again */
+	memcpy(key->str, key_src->str, key_src->len);
+	key->hash = key_src->hash;
+	key->hash_func = key_src->hash_func;
+
+ done:
+	return key;
+}
+
+uint_fast8_t ftlh_key_eq(const ftlh_key_t key1, const ftlh_key_t key2)
+{
+	if (key1 == key2) {
+		return 1;
+	}
+	if (!key1 || !key2 || key1->len != key2->len) {
+		return 0;
+	}
+	/* Different hashes from the same function rule out a match without touching
+	 * the bytes */
+	if (key1->hash_func == key2->hash_func && ftlh_hash_neq(key1->hash, key2->hash)) {
+		return 0;
+	}
+	return memcmp(key1->str, key2->str, key1->len) == 0;
+}
+
+void ftlh_key_free(ftlh_key_t *key)
+{
+	if (!key || !*key) {
+		return;
+	}
+
+	/* Keys owned by a table are freed by the table */
+	if (!(*key)->owner) {
+		ftlh_key_destroy(*key);
+	}
+
+	*key = NULL;
+}
+
+ftlh_hash_t ftlh_hash_key(const ftlh_key_t key)
+{
+	if (!key) {
+		return 0;
+	}
+	return key->hash;
+}
+
+ftlh_key_view_t ftlh_key_view(const void *ptr, size_t len)
+{
+	ftlh_hash_func_t hash_func = ftlh_hash_best();
+	ftlh_key_view_t view = { .ptr = ptr, .len = len, .hash = hash_func(ptr, len), .hash_func = hash_func };
+
+	return view;
+}
+
+/* A view of a key's own bytes, for code which works on views */
+static inline __attribute__ ((always_inline)) ftlh_key_view_t ftlh_key_as_view(const ftlh_key_t key)
+{
+	ftlh_key_view_t view = { .ptr = key->str, .len = key->len, .hash = key->hash, .hash_func = key->hash_func };
+
+	return view;
+}
+
+/* Whether a key holds the bytes a view points at */
+static inline __attribute__ ((always_inline)) uint_fast8_t ftlh_key_matches(const ftlh_key_t key, const ftlh_key_view_t *view)
+{
+	return key->len == view->len && ftlh_hash_eq(key->hash, view->hash) && memcmp(key->str, view->ptr, view->len) == 0;
+}
+
+/* Copies a view's bytes into a new key, reusing the view's hash */
+FTLH_PRIVATE_FUNC ftlh_key_t ftlh_key_from_view(const ftlh_key_view_t *view)
+{
+	ftlh_key_t key = ftlh_key_alloc(view->len);
+
+	if (key) {
+		if (view->len) {
+			memcpy(key->str, view->ptr, view->len);
+		}
+		key->hash = view->hash;
+		key->hash_func = view->hash_func;
+	}
+	return key;
+}
+
+
+
+/**************************************************
+ * Hash tables
+ *
+ * Each table is a single flat array of slots using linear probing. Only the
+ * worker which owns a table ever writes to its slots, so the probe sequences do
+ * not need to cope with concurrent writers. Slots are still claimed and released
+ * with CAS so that the publication of a key is a single atomic step, which is
+ * what lets ftlh_find() read the slots from any thread without a lock. Anything
+ * a reader might still be looking at (replaced keys, removed keys, old slot
+ * arrays) is retired through the epoch code rather than freed directly.
+ *************************************************/
+
+#define FTLH_PUT_FAILED   0
+#define FTLH_PUT_INSERTED 1
+#define FTLH_PUT_REPLACED 2
+
+FTLH_PRIVATE_FUNC struct ftlh_slot_array_s *ftlh_slot_array_create(uint64_t capacity)
+{
+	struct ftlh_slot_array_s *array = NULL;
+
+	array = ftlh_zalloc_aligned(sizeof(struct ftlh_slot_array_s) + (sizeof(struct ftlh_slot_s) * capacity));
+	if (!array) {
+		goto done;
+	}
+
+	array->capacity = capacity;
+	array->mask = capacity - 1;
+
+ done:
+	return array;
+}
+
+/* Scrambles a u64 key so both its low bits (slot index) and high bits
+ * (partition) depend on all of it. This is the MurmurHash3 finalizer: a few
+ * cycles, against a full CityHash64 call for an 8 byte ftlh_key_t. */
+static inline __attribute__ ((always_inline)) uint64_t ftlh_u64_mix(uint64_t key)
+{
+	key ^= key >> 33;
+	key *= UINT64_C(0xff51afd7ed558ccd);
+	key ^= key >> 33;
+	key *= UINT64_C(0xc4ceb53fe1a85363);
+	key ^= key >> 33;
+	return key;
+}
+
+FTLH_PRIVATE_FUNC struct ftlh_u64_slot_array_s *ftlh_u64_slot_array_create(uint64_t capacity)
+{
+	struct ftlh_u64_slot_array_s *array = NULL;
+
+	array = ftlh_zalloc_aligned(sizeof(struct ftlh_u64_slot_array_s) + (sizeof(struct ftlh_u64_slot_s) * capacity));
+	if (!array) {
+		goto done;
+	}
+
+	array->capacity = capacity;
+	array->mask = capacity - 1;
+
+ done:
+	return array;
+}
+
+/* Rebuilds a u64 table's slot array at the given capacity, dropping all
+ * tombstones. */
+FTLH_PRIVATE_FUNC uint_fast8_t ftlh_u64_rebuild(struct ftlh_hash_table_s *table, uint64_t capacity)
+{
+	struct ftlh_u64_slot_array_s *old_array = (struct ftlh_u64_slot_array_s *)table->slots;
+	struct ftlh_u64_slot_array_s *new_array = NULL;
+	uint64_t n = 0, idx = 0, live = 0;
+
+	new_array = ftlh_u64_slot_array_create(capacity);
+	if (!new_array) {
+		return 0;
+	}
+
+	for (n = 0; n < old_array->capacity; ++n) {
+		uint64_t key = old_array->slots[n].key;
+
+		if (key == FTLH_U64_EMPTY || key == FTLH_U64_TOMBSTONE) continue;
+
+		/* Keys are unique, so the first empty slot is the right one */
+		for (idx = ftlh_u64_mix(key) & new_array->mask; new_array->slots[idx].key != FTLH_U64_EMPTY;
+			 idx = (idx + 1) & new_array->mask);
+		new_array->slots[idx].value = old_array->slots[n].value;
+		new_array->slots[idx].key = key;
+		++live;
+	}
+
+	ftlh_atomic_ptr_store_release(&table->slots, new_array);
+	ftlh_atomic64_store_relaxed(&table->used, live);
+
+	/* Readers may still be probing the old array */
+	ftlh_epoch_retire(old_array, ftlh_free_aligned);
+
+	return 1;
+}
+
+/* Walks the probe sequence for the view's hash and returns the slot holding a key
+ * with the view's bytes, or NULL. If free_slot is not NULL, it receives the first
+ * empty or tombstoned slot seen on the way, which is where the key should go if
+ * absent.
+ */
+FTLH_PRIVATE_FUNC struct ftlh_slot_s *ftlh_slot_probe(struct ftlh_slot_array_s *array, const ftlh_key_view_t *view,
+													   struct ftlh_slot_s **free_slot)
+{
+	uint64_t idx = view->hash & array->mask, n = 0;
+
+	for (n = 0; n < array->capacity; ++n, idx = (idx + 1) & array->mask) {
+		struct ftlh_slot_s *slot = &array->slots[idx];
+		/* Only the owning worker writes slots, so a plain read is sufficient */
+		ftlh_key_t slot_key = (ftlh_key_t)slot->key;
+
+		if (!slot_key || slot_key == FTLH_SLOT_TOMBSTONE) {
+			if (free_slot && !*free_slot) {
+				*free_slot = slot;
+			}
+			if (!slot_key) {
+				break;
+			}
+			continue;
+		}
+
+		if (ftlh_hash_eq(slot->hash, view->hash) && ftlh_key_matches(slot_key, view)) {
+			return slot;
+		}
+	}
+
+	return NULL;
+}
+
+/* Rebuilds the slot array at the given capacity, dropping all tombstones. */
+FTLH_PRIVATE_FUNC uint_fast8_t ftlh_hash_table_rebuild(struct ftlh_hash_table_s *table, uint64_t capacity)
+{
+	struct ftlh_slot_array_s *old_array = (struct ftlh_slot_array_s *)table->slots;
+	struct ftlh_slot_array_s *new_array = NULL;
+	uint64_t n = 0;
+
+	if (table->u64) {
+		return ftlh_u64_rebuild(table, capacity);
+	}
+
+	new_array = ftlh_slot_array_create(capacity);
+	if (!new_array) {
+		return 0;
+	}
+
+	for (n = 0; n < old_array->capacity; ++n) {
+		struct ftlh_slot_s *src = &old_array->slots[n];
+		struct ftlh_slot_s *dst = NULL;
+		ftlh_key_t key = (ftlh_key_t)src->key;
+		ftlh_key_view_t view;
+
+		if (!key || key == FTLH_SLOT_TOMBSTONE) continue;
+
+		/* Keys are unique, so the first free slot is the right one */
+		view = ftlh_key_as_view(key);
+		ftlh_slot_probe(new_array, &view, &dst);
+		dst->hash = src->hash;
+		dst->value = src->value;
+		dst->key = key;
+	}
+
+	ftlh_atomic_ptr_store_release(&table->slots, new_array);
+	ftlh_atomic64_store_relaxed(&table->used, ftlh_atomic64_load_relaxed(&table->items));
+
+	/* Readers may still be probing the old array */
+	ftlh_epoch_retire(old_array, ftlh_free_aligned);
+
+	return 1;
+}
+
+/* Makes sure there is room for one more key without passing the load factor. */
+FTLH_PRIVATE_FUNC uint_fast8_t ftlh_hash_table_reserve(struct ftlh_hash_table_s *table)
+{
+	struct ftlh_slot_array_s *array = (struct ftlh_slot_array_s *)table->slots;
+	uint64_t capacity = array->capacity;
+	uint64_t items = ftlh_atomic64_load_relaxed(&table->items);
+
+	if ((ftlh_atomic64_load_relaxed(&table->used) + 1) * FTLH_MAX_LOAD_DEN <= capacity * FTLH_MAX_LOAD_NUM) {
+		return 1;
+	}
+
+	/* Mostly tombstones: rebuilding at the same size is enough */
+	while ((items + 1) * 2 > capacity) {
+		capacity <<= 1;
+	}
+
+	return ftlh_hash_table_rebuild(table, capacity);
+}
+
+/* Stores value under the view's key. key is the caller's copy of the key to
+ * store, or NULL to have one copied from the view only if a new slot is used.
+ * When replacing without a key, the stored key stays and only the value changes.
+ */
+FTLH_PRIVATE_FUNC uint_fast8_t ftlh_hash_table_put(struct ftlh_hash_table_s *table, const ftlh_key_view_t *view,
+												   ftlh_key_t key, void *value, uint_fast8_t replace, void **old_value)
+{
+	struct ftlh_slot_array_s *array = NULL;
+	struct ftlh_slot_s *slot = NULL, *free_slot = NULL;
+	ftlh_key_t old_key = NULL;
+	uint_fast8_t copied = 0;
+
+	/* A key built for another hash function takes on the table's for good */
+	if (key && key->hash_func != view->hash_func) {
+		key->hash = view->hash;
+		key->hash_func = view->hash_func;
+	}
+
+ again:
+	array = (struct ftlh_slot_array_s *)table->slots;
+	free_slot = NULL;
+	slot = ftlh_slot_probe(array, view, &free_slot);
+
+	if (slot) {
+		if (!replace) {
+			goto fail;
+		}
+
+		old_key = (ftlh_key_t)slot->key;
+		*old_value = slot->value;
+		if (!key || copied) {
+			/* Only the single writer changes values, and readers take whatever
+			 * value the unchanged key points at */
+			ftlh_atomic_ptr_store_release(&slot->value, value);
+			if (copied) {
+				ftlh_key_destroy(key);
+			}
+			return FTLH_PUT_REPLACED;
+		}
+
+		/* Value first, then swap in the caller's key for the old one */
+		slot->value = value;
+		key->owner = table;
+		if (!ftlh_atomic_ptr_cas_release(&slot->key, old_key, key)) {
+			key->owner = NULL;
+			goto again;
+		}
+		ftlh_epoch_retire(old_key, ftlh_key_destroy_func);
+		return FTLH_PUT_REPLACED;
+	}
+
+	if (!free_slot) {
+		/* Only possible if the array is completely full of tombstones */
+		if (!ftlh_hash_table_rebuild(table, array->capacity)) {
+			goto fail;
+		}
+		goto again;
+	}
+
+	if (!ftlh_hash_table_reserve(table)) {
+		goto fail;
+	}
+	if ((struct ftlh_slot_array_s *)table->slots != array) {
+		/* The array was rebuilt, so free_slot is stale */
+		goto again;
+	}
+
+	/* The key is new: this is the only point a view's bytes get copied */
+	if (!key) {
+		key = ftlh_key_from_view(view);
+		if (!key) {
+			return FTLH_PUT_FAILED;
+		}
+		copied = 1;
+	}
+
+	/* Fill in the slot, then publish it by claiming it with the key */
+	old_key = (ftlh_key_t)free_slot->key;
+	free_slot->hash = view->hash;
+	free_slot->value = value;
+	key->owner = table;
+	if (!ftlh_atomic_ptr_cas_release(&free_slot->key, old_key, key)) {
+		key->owner = NULL;
+		goto again;
+	}
+
+	if (!old_key) {
+		ftlh_atomic64_fetch_add_relaxed(&table->used, 1);
+	}
+	ftlh_atomic64_fetch_add_relaxed(&table->items, 1);
+
+	return FTLH_PUT_INSERTED;
+
+ fail:
+	__attribute__ ((cold));
+	if (copied) {
+		ftlh_key_destroy(key);
+	}
+	return FTLH_PUT_FAILED;
+}
+
+FTLH_PRIVATE_FUNC uint_fast8_t ftlh_hash_table_del(struct ftlh_hash_table_s *table, const ftlh_key_view_t *view, void **old_value)
+{
+	struct ftlh_slot_array_s *array = (struct ftlh_slot_array_s *)table->slots;
+	struct ftlh_slot_s *slot = NULL;
+	ftlh_key_t old_key = NULL;
+	void *state = FTLH_SLOT_TOMBSTONE;
+
+	slot = ftlh_slot_probe(array, view, NULL);
+	if (!slot) {
+		return 0;
+	}
+
+	/* If the next slot is empty, no probe sequence runs through this one, so it
+	 * can go straight back to empty instead of becoming a tombstone. */
+	if (!array->slots[((slot - array->slots) + 1) & array->mask].key) {
+		state = NULL;
+	}
+
+	old_key = (ftlh_key_t)slot->key;
+	*old_value = slot->value;
+	if (!ftlh_atomic_ptr_cas_release(&slot->key, old_key, state)) {
+		return 0;
+	}
+
+	ftlh_atomic64_fetch_sub_relaxed(&table->items, 1);
+	if (!state) {
+		ftlh_atomic64_fetch_sub_relaxed(&table->used, 1);
+	}
+	ftlh_epoch_retire(old_key, ftlh_key_destroy_func);
+
+	return 1;
+}
+
+/* ftlh_hash_table_put() for u64 tables. Removed slots are never reused (see
+ * FTLH_U64_TOMBSTONE), so new keys only ever go into empty slots. */
+FTLH_PRIVATE_FUNC uint_fast8_t ftlh_u64_put(struct ftlh_hash_table_s *table, uint64_t key, void *value,
+											uint_fast8_t replace, void **old_value)
+{
+	struct ftlh_u64_slot_array_s *array = NULL;
+	struct ftlh_u64_slot_s *slot = NULL;
+	struct ftlh_u64_special_s *special = NULL;
+	uint64_t idx = 0, n = 0, slot_key = 0;
+
+	if (key == FTLH_U64_EMPTY || key == FTLH_U64_TOMBSTONE) {
+		special = &table->u64_special[key != FTLH_U64_EMPTY];
+		if (special->present) {
+			if (!replace) {
+				return FTLH_PUT_FAILED;
+			}
+			*old_value = special->value;
+			ftlh_atomic_ptr_store_release(&special->value, value);
+			return FTLH_PUT_REPLACED;
+		}
+		special->value = value;
+		ftlh_atomic64_store_release(&special->present, 1);
+		ftlh_atomic64_fetch_add_relaxed(&table->items, 1);
+		return FTLH_PUT_INSERTED;
+	}
+
+ again:
+	array = (struct ftlh_u64_slot_array_s *)table->slots;
+	slot = NULL;
+	idx = ftlh_u64_mix(key) & array->mask;
+
+	for (n = 0; n < array->capacity; ++n, idx = (idx + 1) & array->mask) {
+		slot_key = array->slots[idx].key;
+		if (slot_key == key) {
+			if (!replace) {
+				return FTLH_PUT_FAILED;
+			}
+			*old_value = array->slots[idx].value;
+			ftlh_atomic_ptr_store_release(&array->slots[idx].value, value);
+			return FTLH_PUT_REPLACED;
+		}
+		if (slot_key == FTLH_U64_EMPTY) {
+			slot = &array->slots[idx];
+			break;
+		}
+	}
+
+	if (!slot) {
+		/* Only possible if the array is completely full of tombstones */
+		if (!ftlh_u64_rebuild(table, array->capacity)) {
+			return FTLH_PUT_FAILED;
+		}
+		goto again;
+	}
+
+	if (!ftlh_hash_table_reserve(table)) {
+		return FTLH_PUT_FAILED;
+	}
+	if ((struct ftlh_u64_slot_array_s *)table->slots != array) {
+		/* The array was rebuilt, so slot is stale */
+		goto again;
+	}
+
+	/* Fill in the value, then publish the slot by writing the key */
+	slot->value = value;
+	ftlh_atomic64_store_release(&slot->key, key);
+	ftlh_atomic64_fetch_add_relaxed(&table->used, 1);
+	ftlh_atomic64_fetch_add_relaxed(&table->items, 1);
+
+	return FTLH_PUT_INSERTED;
+}
+
+FTLH_PRIVATE_FUNC uint_fast8_t ftlh_u64_del(struct ftlh_hash_table_s *table, uint64_t key, void **old_value)
+{
+	struct ftlh_u64_slot_array_s *array = (struct ftlh_u64_slot_array_s *)table->slots;
+	struct ftlh_u64_special_s *special = NULL;
+	uint64_t idx = 0, n = 0, slot_key = 0;
+
+	if (key == FTLH_U64_EMPTY || key == FTLH_U64_TOMBSTONE) {
+		special = &table->u64_special[key != FTLH_U64_EMPTY];
+		if (!special->present) {
+			return 0;
+		}
+		*old_value = special->value;
+		ftlh_atomic64_store_release(&special->present, 0);
+		ftlh_atomic64_fetch_sub_relaxed(&table->items, 1);
+		return 1;
+	}
+
+	idx = ftlh_u64_mix(key) & array->mask;
+	for (n = 0; n < array->capacity; ++n, idx = (idx + 1) & array->mask) {
+		slot_key = array->slots[idx].key;
+		if (slot_key == FTLH_U64_EMPTY) {
+			break;
+		}
+		if (slot_key == key) {
+			*old_value = array->slots[idx].value;
+			ftlh_atomic64_store_release(&array->slots[idx].key, FTLH_U64_TOMBSTONE);
+			ftlh_atomic64_fetch_sub_relaxed(&table->items, 1);
+			return 1;
+		}
+	}
+
+	return 0;
+}
+
+/* The table struct outlives the table: a worker may still be looking at it
+ * through an old copy of its table list. */
+FTLH_PRIVATE_FUNC void ftlh_hash_table_release(void *table_in)
+{
+	struct ftlh_hash_table_s *table = (struct ftlh_hash_table_s *)table_in;
+
+	ftlh_queue_destroy(&table->requests);
+	ftlh_free_aligned(table);
+}
+
+FTLH_PRIVATE_FUNC void ftlh_hash_table_free(struct ftlh_hash_table_s *table)
+{
+	struct ftlh_slot_array_s *array = (struct ftlh_slot_array_s *)table->slots;
+	uint64_t n = 0;
+	ftlh_backoff_t backoff;
+
+	/* Removing a table only shrinks the list, so it always finds the memory */
+	ftlh_backoff_init(&backoff);
+	while (!ftlh_worker_update_tables(table->worker, NULL, table)) {
+		ftlh_backoff_wait(&backoff, NULL, 0);
+	}
+	ftlh_atomic_ptr_cas(&ftlh_globals.tables[table->id], table, NULL);
+
+	/* u64 tables hold no key objects */
+	for (n = 0; n < array->capacity && !table->u64; ++n) {
+		ftlh_key_t key = (ftlh_key_t)array->slots[n].key;
+		if (key && key != FTLH_SLOT_TOMBSTONE) {
+			ftlh_key_destroy(key);
+		}
+	}
+
+	ftlh_free_aligned(array);
+	ftlh_epoch_retire(table, ftlh_hash_table_release);
+}
+
+/* Creates a table owned by the given worker, or the least loaded worker when
+ * worker is NULL. */
+FTLH_PRIVATE_FUNC struct ftlh_hash_table_s *ftlh_hash_table_alloc(size_t estimated_items, struct ftlh_thread_status_s *worker,
+																 uint_fast8_t u64, ftlh_hash_func_t hash_func)
+{
+	struct ftlh_hash_table_s *table = NULL;
+	uint64_t capacity = FTLH_MIN_SLOTS;
+	uint64_t n = 0;
+
+	if (!ftlh_globals.tables) {
+		/* ftlh_start() was never called */
+		goto done;
+	}
+
+	/* The table must hold estimated_items without passing the load factor */
+	while (capacity * FTLH_MAX_LOAD_NUM / FTLH_MAX_LOAD_DEN <= estimated_items) {
+		capacity <<= 1;
+	}
+
+	table = ftlh_zalloc_aligned(sizeof(struct ftlh_hash_table_s));
+	if (!table) {
+		goto done;
+	}
+
+	table->u64 = u64;
+	table->hash_func = hash_func;
+	table->slots = (u64 ? (void *)ftlh_u64_slot_array_create(capacity) : (void *)ftlh_slot_array_create(capacity));
+	if (!table->slots) {
+		goto fail;
+	}
+
+	table->requests = ftlh_queue_create(FTLH_REQUEST_QUEUE_SIZE);
+	if (!table->requests) {
+		goto fail;
+	}
+
+	/* Hand the table to the worker which owns the fewest tables */
+	table->worker = &ftlh_globals.threads[0];
+	for (n = 1; n < ftlh_globals.thread_count && !worker; ++n) {
+		struct ftlh_table_list_s *best = ftlh_atomic_ptr_get(&table->worker->tables);
+		struct ftlh_table_list_s *list = ftlh_atomic_ptr_get(&ftlh_globals.threads[n].tables);
+		if ((list ? list->count : 0) < (best ? best->count : 0)) {
+			table->worker = &ftlh_globals.threads[n];
+		}
+	}
+	if (worker) {
+		table->worker = worker;
+	}
+
+	/* Index 0 is never used */
+	for (n = 1; n < ftlh_globals.table_count; ++n) {
+		table->id = n;
+		if (!ftlh_atomic_ptr_cas(&ftlh_globals.tables[n], NULL, table)) {
+			goto registered;
+		}
+	}
+
+	/* Out of table slots */
+	errno = ENOSPC;
+	goto fail;
+
+ registered:
+	if (!ftlh_worker_update_tables(table->worker, table, NULL)) {
+		ftlh_atomic_ptr_set(&ftlh_globals.tables[table->id], NULL);
+		goto fail;
+	}
+
+	goto done;
+
+ fail:
+	__attribute__ ((cold));
+	if (table->requests) {
+		ftlh_queue_destroy(&table->requests);
+	}
+	if (table->slots) {
+		ftlh_free_aligned((void *)table->slots);
+	}
+	ftlh_free_aligned(table);
+	table = NULL;
+
+ done:
+	return table;
+}
+
+ftlh_hash_table_t ftlh_hash_table_create(size_t estimated_items)
+{
+	return ftlh_hash_table_alloc(estimated_items, NULL, 0, ftlh_hash_best());
+}
+
+FTLH_PRIVATE_FUNC struct ftlh_hash_table_s *ftlh_hash_table_create_parts(size_t estimated_items, uint_fast8_t partition_bits,
+																		 uint_fast8_t u64, ftlh_hash_func_t hash_func)
+{
+	struct ftlh_hash_table_s *table = NULL;
+	uint64_t count = (uint64_t)1 << partition_bits;
+	uint64_t first = 0, n = 0;
+
+	if (partition_bits == 0) {
+		return ftlh_hash_table_alloc(estimated_items, NULL, u64, hash_func);
+	}
+
+	if (partition_bits > FTLH_MAX_PARTITION_BITS) {
+		errno = EINVAL;
+		goto done;
+	}
+
+	if (!ftlh_globals.tables) {
+		/* ftlh_start() was never called */
+		goto done;
+	}
+
+	table = ftlh_zalloc_aligned(sizeof(struct ftlh_hash_table_s));
+	if (!table) {
+		goto done;
+	}
+
+	table->part_bits = partition_bits;
+	table->u64 = u64;
+	table->hash_func = hash_func;
+	table->parts = ftlh_zalloc_aligned(sizeof(struct ftlh_hash_table_s *) * count);
+	if (!table->parts) {
+		goto fail;
+	}
+
+	/* The first partition goes to the least loaded worker, the rest to the
+	 * workers after it in turn, so partitions only share a worker when there
+	 * are more partitions than workers. */
+	for (n = 0; n < count; ++n) {
+		table->parts[n] = ftlh_hash_table_alloc(estimated_items / count,
+												n ? &ftlh_globals.threads[(first + n) % ftlh_globals.thread_count] : NULL, u64,
+												hash_func);
+		if (!table->parts[n]) {
+			goto fail;
+		}
+		table->parts[n]->parent = table;
+		if (!n) {
+			first = table->parts[0]->worker - ftlh_globals.threads;
+		}
+	}
+
+	goto done;
+
+ fail:
+	__attribute__ ((cold));
+	for (n = 0; table->parts && n < count; ++n) {
+		ftlh_hash_table_destroy(&table->parts[n]);
+	}
+	ftlh_free_aligned(table->parts);
+	ftlh_free_aligned(table);
+	table = NULL;
+
+ done:
+	return table;
+}
+
+ftlh_hash_table_t ftlh_hash_table_create_partitioned(size_t estimated_items, uint_fast8_t partition_bits)
+{
+	return ftlh_hash_table_create_parts(estimated_items, partition_bits, 0, ftlh_hash_best());
+}
+
+ftlh_hash_table_t ftlh_hash_table_create_hashed(size_t estimated_items, uint_fast8_t partition_bits, ftlh_hash_func_t hash_func)
+{
+	return ftlh_hash_table_create_parts(estimated_items, partition_bits, 0, hash_func ? hash_func : ftlh_hash_best());
+}
+
+ftlh_hash_table_t ftlh_hash_table_create_u64(size_t estimated_items)
+{
+	return ftlh_hash_table_alloc(estimated_items, NULL, 1, NULL);
+}
+
+ftlh_hash_table_t ftlh_hash_table_create_u64_partitioned(size_t estimated_items, uint_fast8_t partition_bits)
+{
+	return ftlh_hash_table_create_parts(estimated_items, partition_bits, 1, NULL);
+}
+
+ftlh_hash_func_t ftlh_hash_table_hash_func(ftlh_hash_table_t table)
+{
+	return (table ? table->hash_func : NULL);
+}
+
+/* Returns the partition which holds keys with the given hash, or the table
+ * itself if it is not partitioned. */
+FTLH_PRIVATE_FUNC inline struct ftlh_hash_table_s *ftlh_hash_table_part(struct ftlh_hash_table_s *table, ftlh_hash_t hash)
+{
+	if (!table->part_bits) {
+		return table;
+	}
+	return table->parts[(uint64_t)hash >> (64 - table->part_bits)];
+}
+
+/* The hash of key under the table's hash function. Keys built for it (the
+ * usual case) already carry it. */
+static inline __attribute__ ((always_inline)) ftlh_hash_t ftlh_hash_table_key_hash(struct ftlh_hash_table_s *table,
+																				   const ftlh_key_t key)
+{
+	if (key->hash_func == table->hash_func) {
+		return key->hash;
+	}
+	return table->hash_func(key->str, key->len);
+}
+
+/* A view of key's bytes hashed with the table's hash function */
+static inline __attribute__ ((always_inline)) ftlh_key_view_t ftlh_hash_table_key_as_view(struct ftlh_hash_table_s *table,
+																						  const ftlh_key_t key)
+{
+	ftlh_key_view_t view = ftlh_key_as_view(key);
+
+	if (view.hash_func != table->hash_func) {
+		view.hash = table->hash_func(key->str, key->len);
+		view.hash_func = table->hash_func;
+	}
+	return view;
+}
+
+/* Returns view if it was hashed with the table's hash function, or else scratch
+ * filled with a rehashed copy of it */
+static inline __attribute__ ((always_inline)) const ftlh_key_view_t *ftlh_hash_table_view(struct ftlh_hash_table_s *table,
+																						  const ftlh_key_view_t *view,
+																						  ftlh_key_view_t *scratch)
+{
+	if (view->hash_func == table->hash_func) {
+		return view;
+	}
+	*scratch = *view;
+	scratch->hash = table->hash_func(view->ptr, view->len);
+	scratch->hash_func = table->hash_func;
+	return scratch;
+}
+
+ftlh_key_view_t ftlh_hash_table_key_view(ftlh_hash_table_t table, const void *ptr, size_t len)
+{
+	ftlh_key_view_t view = { .ptr = ptr, .len = len };
+
+	view.hash_func = ((table && table->hash_func) ? table->hash_func : ftlh_hash_best());
+	view.hash = view.hash_func(ptr, len);
+
+	return view;
+}
+
+uint_fast64_t ftlh_hash_table_items(ftlh_hash_table_t table)
+{
+	uint_fast64_t items = 0;
+	uint64_t n = 0;
+
+	if (!table) {
+		return 0;
+	}
+	if (!table->part_bits) {
+		return ftlh_atomic64_load_relaxed(&table->items);
+	}
+	for (n = 0; n < ((uint64_t)1 << table->part_bits); ++n) {
+		items += ftlh_atomic64_load_relaxed(&table->parts[n]->items);
+	}
+	return items;
+}
+
+/* Sums the slot capacity and the used slots of a table or of all its partitions */
+FTLH_PRIVATE_FUNC uint_fast64_t ftlh_hash_table_usage(ftlh_hash_table_t table, uint_fast64_t *used)
+{
+	struct ftlh_slot_array_s *array = NULL;
+	uint_fast64_t capacity = 0;
+	uint64_t n = 0;
+
+	*used = 0;
+	if (!table || !ftlh_epoch_enter()) {
+		return 0;
+	}
+	for (n = 0; n < ((uint64_t)1 << table->part_bits); ++n) {
+		struct ftlh_hash_table_s *part = (table->part_bits ? table->parts[n] : table);
+		array = ftlh_atomic_ptr_load_acquire(&part->slots);
+		capacity += array->capacity;
+		*used += ftlh_atomic64_load_relaxed(&part->used);
+	}
+	ftlh_epoch_exit();
+
+	return capacity;
+}
+
+uint_fast64_t ftlh_hash_table_capacity(ftlh_hash_table_t table)
+{
+	uint_fast64_t used = 0;
+
+	return ftlh_hash_table_usage(table, &used);
+}
+
+double ftlh_hash_table_load_factor(ftlh_hash_table_t table)
+{
+	uint_fast64_t used = 0;
+	uint_fast64_t capacity = ftlh_hash_table_usage(table, &used);
+
+	if (!capacity) {
+		return 0;
+	}
+	return (double)used / (double)capacity;
+}
+
+FTLH_PRIVATE_FUNC uint_fast8_t ftlh_hash_table_lookup(ftlh_hash_table_t table, const ftlh_key_view_t *view, void **value)
+{
+	struct ftlh_slot_array_s *array = NULL;
+	uint_fast8_t found = 0;
+	uint64_t idx = 0, n = 0;
+
+	if (!ftlh_epoch_enter()) {
+		return 0;
+	}
+	table = ftlh_hash_table_part(table, view->hash);
+
+ again:
+	array = ftlh_atomic_ptr_load_acquire(&table->slots);
+	idx = view->hash & array->mask;
+
+	for (n = 0; n < array->capacity; ++n, idx = (idx + 1) & array->mask) {
+		struct ftlh_slot_s *slot = &array->slots[idx];
+		ftlh_key_t slot_key = ftlh_atomic_ptr_load_acquire(&slot->key);
+		void *slot_value = NULL;
+
+		if (!slot_key) break;
+		if (slot_key == FTLH_SLOT_TOMBSTONE) continue;
+		if (ftlh_hash_neq(ftlh_atomic64_load_acquire(&slot->hash), view->hash) || !ftlh_key_matches(slot_key, view)) continue;
+
+		/* The value belongs to slot_key only if the slot still holds it. The key
+		 * cannot be recycled while we are in the epoch, so comparing pointers is
+		 * enough. */
+		slot_value = ftlh_atomic_ptr_load_acquire(&slot->value);
+		if (ftlh_atomic_ptr_load_acquire(&slot->key) != slot_key) {
+			goto again;
+		}
+
+		if (value) {
+			*value = slot_value;
+		}
+		found = 1;
+		break;
+	}
+
+	ftlh_epoch_exit();
+
+	return found;
+}
+
+uint_fast8_t ftlh_find_hashed(ftlh_hash_table_t table, const ftlh_key_t key, ftlh_hash_t hash, void **value)
+{
+	ftlh_key_view_t view;
+
+	if (!table || !key || table->u64) {
+		return 0;
+	}
+
+	/* The caller's hash is only any use if it came from the table's function */
+	if (key->hash_func == table->hash_func) {
+		view = ftlh_key_as_view(key);
+		view.hash = hash;
+	} else {
+		view = ftlh_hash_table_key_as_view(table, key);
+	}
+
+	return ftlh_hash_table_lookup(table, &view, value);
+}
+
+void *ftlh_find(ftlh_hash_table_t table, const ftlh_key_t key)
+{
+	void *value = NULL;
+
+	if (!ftlh_find_hashed(table, key, ftlh_hash_key(key), &value)) {
+		return NULL;
+	}
+	return value;
+}
+
+uint_fast8_t ftlh_find_view_value(ftlh_hash_table_t table, const ftlh_key_view_t *view, void **value)
+{
+	ftlh_key_view_t scratch;
+
+	if (!table || !view || (!view->ptr && view->len) || table->u64) {
+		return 0;
+	}
+	return ftlh_hash_table_lookup(table, ftlh_hash_table_view(table, view, &scratch), value);
+}
+
+void *ftlh_find_view(ftlh_hash_table_t table, const ftlh_key_view_t *view)
+{
+	void *value = NULL;
+
+	if (!ftlh_find_view_value(table, view, &value)) {
+		return NULL;
+	}
+	return value;
+}
+
+uint_fast8_t ftlh_find_u64_value(ftlh_hash_table_t table, uint64_t key, void **value)
+{
+	struct ftlh_u64_slot_array_s *array = NULL;
+	struct ftlh_u64_special_s *special = NULL;
+	uint_fast8_t found = 0;
+	uint64_t idx = 0, n = 0, hash = ftlh_u64_mix(key);
+	void *slot_value = NULL;
+
+	if (!table || !table->u64) {
+		return 0;
+	}
+	table = ftlh_hash_table_part(table, hash);
+
+	if (key == FTLH_U64_EMPTY || key == FTLH_U64_TOMBSTONE) {
+		special = &table->u64_special[key != FTLH_U64_EMPTY];
+		if (!ftlh_atomic64_load_acquire(&special->present)) {
+			return 0;
+		}
+		if (value) {
+			*value = ftlh_atomic_ptr_load_acquire(&special->value);
+		}
+		return 1;
+	}
+
+	if (!ftlh_epoch_enter()) {
+		return 0;
+	}
+
+ again:
+	array = ftlh_atomic_ptr_load_acquire(&table->slots);
+	idx = hash & array->mask;
+
+	for (n = 0; n < array->capacity; ++n, idx = (idx + 1) & array->mask) {
+		struct ftlh_u64_slot_s *slot = &array->slots[idx];
+		uint64_t slot_key = ftlh_atomic64_load_acquire(&slot->key);
+
+		if (slot_key == FTLH_U64_EMPTY) break;
+		if (slot_key != key) continue;
+
+		/* A slot never gets a different key, so if it still holds ours the value
+		 * is ours too */
+		slot_value = ftlh_atomic_ptr_load_acquire(&slot->value);
+		if (ftlh_atomic64_load_acquire(&slot->key) != key) {
+			goto again;
+		}
+
+		if (value) {
+			*value = slot_value;
+		}
+		found = 1;
+		break;
+	}
+
+	ftlh_epoch_exit();
+
+	return found;
+}
+
+void *ftlh_find_u64(ftlh_hash_table_t table, uint64_t key)
+{
+	void *value = NULL;
+
+	if (!ftlh_find_u64_value(table, key, &value)) {
+		return NULL;
+	}
+	return value;
+}
+
+/* Hands a request on the caller's stack to the worker and waits for it. */
+FTLH_PRIVATE_FUNC void ftlh_hash_table_submit_wait(struct ftlh_hash_table_s *table, struct ftlh_request_s *req)
+{
+	uint_fast8_t in_epoch = ftlh_epoch_enter();
+
+	/* A destroy may be applied and the table retired before the wake below
+	 * touches it; staying in the epoch keeps it from being freed under us */
+	ftlh_queue_enqueue(table->requests, req);
+	ftlh_table_wake(table);
+	if (in_epoch) {
+		ftlh_epoch_exit();
+	}
+
+	while (ftlh_atomic32_get(&req->done) != FTLH_REQ_DONE) {
+		/* Let the worker know it has to wake us, unless it just finished */
+		ftlh_atomic32_bool_cas(&req->done, FTLH_REQ_PENDING, FTLH_REQ_WAITING);
+		ftlh_atomic32_wait(&req->done, FTLH_REQ_WAITING, 0);
+	}
+}
+
+/* Takes a zeroed request from the pool, or from the heap if the pool is empty */
+FTLH_PRIVATE_FUNC struct ftlh_request_s *ftlh_request_alloc(void)
+{
+	ftlh_tagged_ptr_t head;
+	struct ftlh_request_s *req = NULL;
+
+	/* The epoch keeps head alive while we read its next, even if another thread
+	 * pops it and releases it past the cap in the meantime */
+	if (!ftlh_epoch_enter()) {
+		return calloc(1, sizeof(struct ftlh_request_s));
+	}
+
+	head = ftlh_atomic128_get(&ftlh_globals.request_pool);
+	while ((req = ftlh_tagged_ptr_ptr(head))) {
+		if (ftlh_atomic128_cas(&ftlh_globals.request_pool, &head,
+							   ftlh_tagged_ptr_make(ftlh_atomic_ptr_load_relaxed(&req->next), ftlh_tagged_ptr_tag(head) + 1))) {
+			ftlh_atomic64_fetch_sub_relaxed(&ftlh_globals.request_pool_count, 1);
+			break;
+		}
+	}
+	ftlh_epoch_exit();
+
+	if (!req) {
+		return calloc(1, sizeof(struct ftlh_request_s));
+	}
+
+	memset(req, 0, sizeof(*req));
+	return req;
+}
+
+FTLH_PRIVATE_FUNC void ftlh_request_release(struct ftlh_request_s *req)
+{
+	ftlh_tagged_ptr_t head;
+
+	if (ftlh_atomic64_load_relaxed(&ftlh_globals.request_pool_count) >= FTLH_REQUEST_POOL_MAX) {
+		/* A popper may still hold it as the head it is about to read next from */
+		ftlh_epoch_retire(req, free);
+		return;
+	}
+
+	ftlh_atomic64_fetch_add_relaxed(&ftlh_globals.request_pool_count, 1);
+	head = ftlh_atomic128_get(&ftlh_globals.request_pool);
+	do {
+		ftlh_atomic_ptr_store_relaxed(&req->next, ftlh_tagged_ptr_ptr(head));
+	} while (!ftlh_atomic128_cas(&ftlh_globals.request_pool, &head, ftlh_tagged_ptr_make(req, ftlh_tagged_ptr_tag(head) + 1)));
+}
+
+/* Frees every pooled request. Only safe once no thread can touch the pool. */
+FTLH_PRIVATE_FUNC void ftlh_request_pool_drain(void)
+{
+	ftlh_tagged_ptr_t head = ftlh_atomic128_get(&ftlh_globals.request_pool);
+	struct ftlh_request_s *req = ftlh_tagged_ptr_ptr(head);
+	struct ftlh_request_s *next = NULL;
+
+	for (; req; req = next) {
+		next = ftlh_atomic_ptr_load_relaxed(&req->next);
+		free(req);
+	}
+	ftlh_atomic128_set(&ftlh_globals.request_pool, ftlh_tagged_ptr_make(NULL, ftlh_tagged_ptr_tag(head) + 1));
+	ftlh_atomic64_store_relaxed(&ftlh_globals.request_pool_count, 0);
+}
+
+FTLH_PRIVATE_FUNC void ftlh_hash_table_submit_async(struct ftlh_hash_table_s *table, uint_fast8_t op, ftlh_key_t key,
+													void *value, ftlh_status_func_t cb)
+{
+	struct ftlh_request_s *req = NULL;
+
+	req = ftlh_request_alloc();
+	if (!req) {
+		/* Nothing was queued, so report the failure right here */
+		if (cb) {
+			cb(table->parent ? table->parent : table, key, value, 0);
+		}
+		ftlh_key_destroy(key);
+		return;
+	}
+
+	req->op = op;
+	req->async = 1;
+	req->key = key;
+	req->value = value;
+	req->cb = cb;
+
+	ftlh_queue_enqueue(table->requests, req);
+	ftlh_table_wake(table);
+}
+
+void ftlh_hash_table_destroy(ftlh_hash_table_t *table)
+{
+	struct ftlh_request_s req = {0};
+	uint64_t n = 0;
+
+	if (!table || !*table) {
+		return;
+	}
+
+	if ((*table)->part_bits) {
+		for (n = 0; n < ((uint64_t)1 << (*table)->part_bits); ++n) {
+			ftlh_hash_table_destroy(&(*table)->parts[n]);
+		}
+		ftlh_free_aligned((*table)->parts);
+		ftlh_free_aligned(*table);
+		*table = NULL;
+		return;
+	}
+
+	req.op = FTLH_OP_DESTROY;
+	ftlh_hash_table_submit_wait(*table, &req);
+
+	*table = NULL;
+}
+
+uint_fast8_t ftlh_insert(ftlh_hash_table_t table, ftlh_key_t key, void *value)
+{
+	struct ftlh_request_s req = {0};
+
+	if (!table || !key || key->owner || table->u64) {
+		return 0;
+	}
+
+	table = ftlh_hash_table_part(table, ftlh_hash_table_key_hash(table, key));
+	req.op = FTLH_OP_INSERT;
+	req.key = key;
+	req.value = value;
+	ftlh_hash_table_submit_wait(table, &req);
+
+	return req.status;
+}
+
+void ftlh_insert_async(ftlh_hash_table_t table, ftlh_key_t key, void *value, ftlh_status_func_t cb)
+{
+	if (!table || !key || key->owner || table->u64) {
+		return;
+	}
+	ftlh_hash_table_submit_async(ftlh_hash_table_part(table, ftlh_hash_table_key_hash(table, key)), FTLH_OP_INSERT, key, value, cb);
+}
+
+void *ftlh_replace(ftlh_hash_table_t table, ftlh_key_t key, void *value)
+{
+	struct ftlh_request_s req = {0};
+
+	if (!table || !key || key->owner || table->u64) {
+		return NULL;
+	}
+
+	table = ftlh_hash_table_part(table, ftlh_hash_table_key_hash(table, key));
+	req.op = FTLH_OP_REPLACE;
+	req.key = key;
+	req.value = value;
+	ftlh_hash_table_submit_wait(table, &req);
+
+	return req.result;
+}
+
+void *ftlh_remove(ftlh_hash_table_t table, ftlh_key_t key)
+{
+	struct ftlh_request_s req = {0};
+
+	if (!table || !key || table->u64) {
+		return NULL;
+	}
+
+	table = ftlh_hash_table_part(table, ftlh_hash_table_key_hash(table, key));
+	req.op = FTLH_OP_REMOVE;
+	req.key = key;
+	ftlh_hash_table_submit_wait(table, &req);
+
+	return req.result;
+}
+
+void ftlh_remove_async(ftlh_hash_table_t table, ftlh_key_t key)
+{
+	if (!table || !key || table->u64) {
+		return;
+	}
+	ftlh_hash_table_submit_async(ftlh_hash_table_part(table, ftlh_hash_table_key_hash(table, key)), FTLH_OP_REMOVE, key, NULL, NULL);
+}
+
+/* Runs a synchronous write whose key is a view on the caller's stack */
+FTLH_PRIVATE_FUNC void ftlh_hash_table_submit_view(ftlh_hash_table_t table, struct ftlh_request_s *req)
+{
+	ftlh_key_view_t scratch;
+
+	/* scratch outlives the request, which is done once this returns */
+	req->view = ftlh_hash_table_view(table, req->view, &scratch);
+	ftlh_hash_table_submit_wait(ftlh_hash_table_part(table, req->view->hash), req);
+}
+
+uint_fast8_t ftlh_insert_view(ftlh_hash_table_t table, const ftlh_key_view_t *view, void *value)
+{
+	struct ftlh_request_s req = {0};
+
+	if (!table || !view || (!view->ptr && view->len) || table->u64) {
+		return 0;
+	}
+
+	req.op = FTLH_OP_INSERT;
+	req.view = view;
+	req.value = value;
+	ftlh_hash_table_submit_view(table, &req);
+
+	return req.status;
+}
+
+void *ftlh_replace_view(ftlh_hash_table_t table, const ftlh_key_view_t *view, void *value)
+{
+	struct ftlh_request_s req = {0};
+
+	if (!table || !view || (!view->ptr && view->len) || table->u64) {
+		return NULL;
+	}
+
+	req.op = FTLH_OP_REPLACE;
+	req.view = view;
+	req.value = value;
+	ftlh_hash_table_submit_view(table, &req);
+
+	return req.result;
+}
+
+void *ftlh_remove_view(ftlh_hash_table_t table, const ftlh_key_view_t *view)
+{
+	struct ftlh_request_s req = {0};
+
+	if (!table || !view || (!view->ptr && view->len) || table->u64) {
+		return NULL;
+	}
+
+	req.op = FTLH_OP_REMOVE;
+	req.view = view;
+	ftlh_hash_table_submit_view(table, &req);
+
+	return req.result;
+}
+
+/* Runs a synchronous write to a u64 table */
+FTLH_PRIVATE_FUNC void ftlh_hash_table_submit_u64(ftlh_hash_table_t table, struct ftlh_request_s *req)
+{
+	ftlh_hash_table_submit_wait(ftlh_hash_table_part(table, ftlh_u64_mix(req->u64_key)), req);
+}
+
+uint_fast8_t ftlh_insert_u64(ftlh_hash_table_t table, uint64_t key, void *value)
+{
+	struct ftlh_request_s req = {0};
+
+	if (!table || !table->u64) {
+		return 0;
+	}
+
+	req.op = FTLH_OP_INSERT;
+	req.u64_key = key;
+	req.value = value;
+	ftlh_hash_table_submit_u64(table, &req);
+
+	return req.status;
+}
+
+void *ftlh_replace_u64(ftlh_hash_table_t table, uint64_t key, void *value)
+{
+	struct ftlh_request_s req = {0};
+
+	if (!table || !table->u64) {
+		return NULL;
+	}
+
+	req.op = FTLH_OP_REPLACE;
+	req.u64_key = key;
+	req.value = value;
+	ftlh_hash_table_submit_u64(table, &req);
+
+	return req.result;
+}
+
+void *ftlh_remove_u64(ftlh_hash_table_t table, uint64_t key)
+{
+	struct ftlh_request_s req = {0};
+
+	if (!table || !table->u64) {
+		return NULL;
+	}
+
+	req.op = FTLH_OP_REMOVE;
+	req.u64_key = key;
+	ftlh_hash_table_submit_u64(table, &req);
+
+	return req.result;
+}
+
+/* Applies one request to the table. Returns 0 once the table has been freed. */
+FTLH_PRIVATE_FUNC uint_fast8_t ftlh_hash_table_apply(struct ftlh_hash_table_s *table, struct ftlh_request_s *req)
+{
+	uint_fast8_t alive = 1;
+	uint_fast8_t put = FTLH_PUT_FAILED;
+	void *old_value = NULL;
+	ftlh_key_view_t key_view;
+	const ftlh_key_view_t *view = req->view;
+
+	if (req->key) {
+		key_view = ftlh_hash_table_key_as_view(table, req->key);
+		view = &key_view;
+	}
+
+	switch (req->op) {
+	case FTLH_OP_INSERT:
+		put = (table->u64 ? ftlh_u64_put(table, req->u64_key, req->value, 0, &old_value) :
+			   ftlh_hash_table_put(table, view, req->key, req->value, 0, &old_value));
+		req->status = (put != FTLH_PUT_FAILED);
+		break;
+	case FTLH_OP_REPLACE:
+		put = (table->u64 ? ftlh_u64_put(table, req->u64_key, req->value, 1, &old_value) :
+			   ftlh_hash_table_put(table, view, req->key, req->value, 1, &old_value));
+		req->status = (put != FTLH_PUT_FAILED);
+		req->result = (put == FTLH_PUT_REPLACED ? old_value : (put == FTLH_PUT_INSERTED ? req->value : NULL));
+		break;
+	case FTLH_OP_REMOVE:
+		req->status = (table->u64 ? ftlh_u64_del(table, req->u64_key, &old_value) :
+					   ftlh_hash_table_del(table, view, &old_value));
+		req->result = (req->status ? old_value : NULL);
+		break;
+	case FTLH_OP_DESTROY:
+		ftlh_hash_table_free(table);
+		req->status = 1;
+		alive = 0;
+		break;
+	}
+
+	if (!req->async) {
+		/* The request lives on the caller's stack. Once done is set the caller may
+		 * return, so the wake below only uses the address, never the memory. */
+		if (ftlh_atomic32_set(&req->done, FTLH_REQ_DONE) == FTLH_REQ_WAITING) {
+			ftlh_atomic32_notify_one(&req->done);
+		}
+		return alive;
+	}
+
+	if (req->cb) {
+		/* Callers only know the table they passed in, not its partitions */
+		req->cb(table->parent ? table->parent : table, req->key, req->value, req->status);
+	}
+
+	/* Async removes and failed writes leave the key with us */
+	if (req->op == FTLH_OP_REMOVE || !req->status) {
+		ftlh_key_destroy(req->key);
+	}
+	ftlh_request_release(req);
+
+	return alive;
+}
+
+/* Applies up to a batch of queued requests. Any worker may call this, but only
+ * one at a time gets the table; the others return 0 straight away. That keeps a
+ * single writer per table, and the queue keeps the requests in order.
+ */
+uint_fast8_t ftlh_hash_table_service(struct ftlh_hash_table_s *table)
+{
+	struct ftlh_request_s *reqs[FTLH_SERVICE_BATCH];
+	uint_fast64_t count = 0, n = 0;
+
+	if (!ftlh_atomic32_cas_acquire(&table->servicing, 0, 1)) {
+		return 0;
+	}
+
+	/* One claim on the queue for the whole batch */
+	count = ftlh_queue_dequeue_bulk(table->requests, (void **)reqs, FTLH_SERVICE_BATCH);
+	for (n = 0; n < count; ++n) {
+		if (!ftlh_hash_table_apply(table, reqs[n])) {
+			/* The table was destroyed; leave it marked so nobody else touches it */
+			return 1;
+		}
+	}
+
+	ftlh_atomic32_store_release(&table->servicing, 0);
+
+	return (count != 0);
+}
+
+
+
+/**************************************************
+ * Private functions follow
+ *************************************************/
+
+void * ftlh_zalloc_aligned(size_t size)
+{
+	uintptr_t *storage = NULL;
+
+	/* Allocate zeroed memory big enough for an extra pointer and alignment */
+	void *start = calloc(1, size + (FTLH_CACHE_LINE - 1) + sizeof(uintptr_t));
+	void *aligned = NULL;
+
+	if (!start) {
+		return NULL;
+	}
+
+	/* Compute the cache line aligned location */
+	aligned = (void *)(((uintptr_t)start + (FTLH_CACHE_LINE - 1) + sizeof(uintptr_t)) & ~((uintptr_t)(FTLH_CACHE_LINE - 1)));
+
+	storage = (uintptr_t *)((uintptr_t)aligned - sizeof(uintptr_t));
+	/* Back up by the size of uintptr_t and store the start of the block */
+	*storage = (uintptr_t)start;
+
+	return aligned;
+}
+
+void ftlh_key_destroy(ftlh_key_t key)
+{
+	if (!key) {
+		return;
+	}
+	free(key);
+}
+
+void ftlh_key_destroy_func(void *key)
+{
+	ftlh_key_destroy((ftlh_key_t)key);
+}
+
+void ftlh_free_aligned(void *ptr)
+{
+	/* Back up the size of uintptr_t and retrieve the start of the block */
+	/* Syntactic explaination: Convert ptr to uintptr_t so we can do arithmetic on it
+	 * without emitting a warning. Then, subtract the size of a uintptr_t to find
+	 * where we stored the start address. Convert that computation into a uintptr_t pointer
+	 * so that we can dereference the location and retrieve the value. Finally,
+	 * convert that retrieved numeric value into a void pointer so we can free it.
+	 */
+	void *start = NULL;
+
+	/* Like free(), NULL is a no-op */
+	if (!ptr) {
+		return;
+	}
+
+	start = (void *)(*(uintptr_t *)((uintptr_t)ptr - sizeof(uintptr_t)));
+	free(start);
+}
+
+void ftlh_yield(uint_fast64_t usec)
+{
+	struct timeval tv;
+	tv.tv_sec = 0;
+	tv.tv_usec = usec;
 	select(0, NULL, NULL, NULL, &tv);
 }
 
 
+uint_fast64_t ftlh_monotonic_usec(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ((uint_fast64_t)ts.tv_sec * 1000000) + (ts.tv_nsec / 1000);
+}
+
 void ftlh_current_time(struct timeval *dest)
 {
 	gettimeofday(dest, NULL);
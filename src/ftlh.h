@@ -4,6 +4,9 @@
 #define FTLH_H
 
 #include <stdint.h>
+#include <stddef.h>
+#include <pthread.h>
+#include <sys/time.h>
 #include "../cityhash/city.h"
 
 #define FTLH_PUBLIC_FUNC __attribute__ ((used)) extern
@@ -44,7 +47,9 @@
 
 /**
  * A call to ftlh_hash() will produce a hash value for the provided memory location
- * and specified number of bytes.
+ * and specified number of bytes. It is always CityHash64; keys and tables use
+ * the function picked by ftlh_hash_best() unless told otherwise (see
+ * ftlh_hash_func_t).
  *
  * @param loc The memory location to read while building the hash value.
  * @param siz The number of bytes to use to build the hash value.
@@ -54,18 +59,6 @@
  */
 #define ftlh_hash(loc, siz) CityHash64(loc, siz)
 
-/**
- * A call to ftlh_hash_key() will produce a hash value for the provided ftlh_key_t
- * object.
- *
- * @param key A validly constructed ftlh_key_t object.
- *
- * @return Returns a hash value of type ftlh_hash_t. Values of type ftlh_hash_t do
- *         not need to be freed. If the incoming ftlh_key_t is invalid, the
- *         ftlh_hash_t returned will map to hash index 0. 
- */
-#define ftlh_hash_key(key) CityHash64(k->str, k->len)
-
 /**
  * This function returns a value equivalent to a boolean TRUE if the provided
  * ftlh_hash_t values are equivalent. Otherwise, it will return a value equivalent
@@ -92,8 +85,47 @@
  */
 typedef uint64_t ftlh_hash_t;
 
+/**
+ * This type is a function which hashes len bytes at loc. Each table hashes its
+ * keys with one of these, chosen when the table is created. The built-in ones
+ * are ftlh_hash_city(), ftlh_hash_crc32c() and ftlh_hash_wy(); any function
+ * which always returns the same hash for the same bytes may be used.
+ */
+typedef ftlh_hash_t (*ftlh_hash_func_t)(const void *loc, size_t len);
+
 FTLH_BEGIN_EXTERN_C // ;
 
+/**
+ * This hash function is CityHash64, the same as ftlh_hash().
+ */
+FTLH_PUBLIC_FUNC ftlh_hash_t ftlh_hash_city(const void *loc, size_t len) __attribute__ ((pure));
+
+/**
+ * This hash function runs CRC32C over the bytes and spreads the 32-bit result and
+ * the length over 64 bits. It uses the SSE4.2 crc32 instruction when the CPU has
+ * it, which makes it the cheapest built-in for short keys; without it, it falls
+ * back to a slow bit-at-a-time loop.
+ */
+FTLH_PUBLIC_FUNC ftlh_hash_t ftlh_hash_crc32c(const void *loc, size_t len) __attribute__ ((pure));
+
+/**
+ * This hash function is modelled on wyhash: a few 64x64 -> 128 bit multiplies
+ * per 16 bytes, with almost no setup cost for short keys. It needs no special
+ * instructions.
+ */
+FTLH_PUBLIC_FUNC ftlh_hash_t ftlh_hash_wy(const void *loc, size_t len) __attribute__ ((pure));
+
+/**
+ * This function picks the fastest built-in hash function for this CPU:
+ * ftlh_hash_crc32c() if it has SSE4.2, or ftlh_hash_wy() if not. The choice is
+ * made once and never changes while the program runs. Keys are hashed with it
+ * when they are built, and tables use it unless told otherwise, so keys and
+ * tables normally agree and no key is hashed twice.
+ *
+ * @return The chosen hash function.
+ */
+FTLH_PUBLIC_FUNC ftlh_hash_func_t ftlh_hash_best(void) __attribute__ ((warn_unused_result));
+
 /**
  * Before calling any other ftlh_* functions, you must call ftlh_start(). You
  * *should* call ftlh_start() immediately upon entering your program.
@@ -123,9 +155,11 @@ FTLH_PUBLIC_FUNC uint_fast8_t ftlh_start();
  *                and you typically have lots of threads reading / writing to the
  *                hash table(s) heavily, you may need additional worker threads to
  *                handle the load. Regardless of how many workers you create, you
- *                will never have more than one worker for any given hash table.
- *                Thus, it is pointless to create more worker threads than you have
- *                hash tables in use.
+ *                will never have more than one worker for any given hash table,
+ *                unless the table was created with
+ *                ftlh_hash_table_create_partitioned(). Thus, it is pointless to
+ *                create more worker threads than you have hash tables (or table
+ *                partitions) in use.
  *
  * @return If successful, ftlh_start_advanced() will return 0. Otherwise, it will
  *         return a positive error code.
@@ -153,9 +187,11 @@ FTLH_PUBLIC_FUNC uint_fast8_t ftlh_start_advanced(uint64_t max_tables, uint32_t
  *                and you typically have lots of threads reading / writing to the
  *                hash table(s) heavily, you may need additional worker threads to
  *                handle the load. Regardless of how many workers you create, you
- *                will never have more than one worker for any given hash table.
- *                Thus, it is pointless to create more worker threads than you have
- *                hash tables in use.
+ *                will never have more than one worker for any given hash table,
+ *                unless the table was created with
+ *                ftlh_hash_table_create_partitioned(). Thus, it is pointless to
+ *                create more worker threads than you have hash tables (or table
+ *                partitions) in use.
  * @param attr This field is a pthread_attr_t attribute pointer which specifies the
  *             the pthread attributes for the worker threads. You must have called
  *             pthread_attr_init() on the object first. By default, the only
@@ -169,6 +205,30 @@ FTLH_PUBLIC_FUNC uint_fast8_t ftlh_start_advanced(uint64_t max_tables, uint32_t
  */
 FTLH_PUBLIC_FUNC uint_fast8_t ftlh_start_expert(uint64_t max_tables, uint32_t threads, const pthread_attr_t *attr);
 
+/**
+ * When a worker thread runs out of work, it parks until a request is queued for
+ * one of its tables, so idle workers use no CPU. Waking a parked thread costs a
+ * few microseconds. If your latency budget is tighter than that, you can let
+ * idle workers spin for a while before parking. The spin time adapts: it grows
+ * while work keeps arriving shortly after the worker goes idle, and shrinks back
+ * toward zero when it does not, so a quiet system stops burning CPU on its own.
+ *
+ * @param max_usec The longest time, in microseconds, an idle worker may spin
+ *                 before parking. The default of 0 disables spinning.
+ */
+FTLH_PUBLIC_FUNC void ftlh_set_worker_spin(uint_fast64_t max_usec);
+
+/**
+ * Every hash table is owned by one worker thread, but a worker which has nothing
+ * queued for its own tables will help a busy worker by servicing the busy
+ * worker's other tables. Only one thread applies a table's writes at any time,
+ * so writes to a table are still applied one at a time, in the order they were
+ * queued. Work stealing is enabled by default.
+ *
+ * @param enabled 0 to keep every worker on its own tables, 1 to allow stealing.
+ */
+FTLH_PUBLIC_FUNC void ftlh_set_work_stealing(uint_fast8_t enabled);
+
 /**
  * Immediately prior to exiting your program, you must call ftlh_stop(). 
  */
@@ -182,18 +242,32 @@ struct ftlh_key_s;
  */
 typedef struct ftlh_key_s * ftlh_key_t __attribute__ ((aligned(16)));
 
+/**
+ * The ftlh_key_view_t type is a key which borrows the caller's memory instead of
+ * owning a copy. Build one on the stack with ftlh_key_view() and pass it to the
+ * *_view functions; it never has to be freed. The memory it points at must stay
+ * unchanged until the call using the view returns.
+ */
+typedef struct ftlh_key_view_s {
+	const void *ptr;           /**< The key bytes */
+	size_t len;                /**< The number of key bytes */
+	ftlh_hash_t hash;          /**< hash_func() of the key bytes */
+	ftlh_hash_func_t hash_func; /**< The function which made hash */
+} ftlh_key_view_t;
+
 /**
  * This utility function concatinates a set of strings into a single string and
  * makes note of its length. It allocates a structure to hold the key information,
  * including the newly created string and its resulting length. The returned item
- * must be freed by a call to ftlh_key_free().
+ * must be freed by a call to ftlh_key_free(). The list of strings must be
+ * terminated by a NULL pointer.
  *
  * @return If an error occurs during the process (out of memory), the function will
  *         return NULL. Otherwise, it will return a fully constructed and valid
  *         ftlh_key_t which is guaranteed to accurately represent a concatenation of
  *         the input strings. 
  */
-FTLH_PUBLIC_FUNC ftlh_key_t ftlh_build_key_concat(const char *str1, ...) __attribute__ ((warn_unused_result));
+FTLH_PUBLIC_FUNC ftlh_key_t ftlh_build_key_concat(const char *str1, ...) __attribute__ ((warn_unused_result, sentinel));
 
 /**
  * This utility function creates a ftlh_key_t based on a call to printf. It expects
@@ -231,8 +305,9 @@ FTLH_PUBLIC_FUNC ftlh_key_t ftlh_build_key_binary(const void *loc, size_t len) _
  *    a size_t sized number of bytes. 
  * 2. The only thing that can follow a specification for the number of bytes to read
  *    is another memory location to read from.
+ * 3. The list must be terminated by a NULL memory location followed by a 0 length.
  *
- * If you follow these two rules, you should always end up passing an even number
+ * If you follow these three rules, you should always end up passing an even number
  * of arguments.
  *
  * @param loc The location in memory where we should begin reading bytes.
@@ -262,7 +337,8 @@ FTLH_PUBLIC_FUNC ftlh_key_t ftlh_build_key_binary_concat(const void *loc, size_t
 FTLH_PUBLIC_FUNC ftlh_key_t ftlh_key_clone(const ftlh_key_t key_src) __attribute__ ((warn_unused_result));
 
 /**
- * This utility function compares two ftlh_key_t objects for equality.
+ * This utility function compares two ftlh_key_t objects for equality. Keys
+ * with different lengths or cached hashes are unequal without comparing bytes.
  *
  * @param key1 A valid ftlh_key_t object.
  * @param key2 A valid ftlh_key_t object.
@@ -301,6 +377,35 @@ FTLH_PUBLIC_FUNC uint_fast8_t ftlh_key_eq(const ftlh_key_t key1, const ftlh_key_
  */
 FTLH_PUBLIC_FUNC void ftlh_key_free(ftlh_key_t *key);
 
+/**
+ * A call to ftlh_hash_key() will produce a hash value for the provided ftlh_key_t
+ * object. The hash is computed once when the key is built, with ftlh_hash_best(),
+ * and kept in the key, so this call is cheap. A key inserted into a table with
+ * another hash function is rehashed with that function once, when the table
+ * takes it.
+ *
+ * @param key A validly constructed ftlh_key_t object.
+ *
+ * @return Returns a hash value of type ftlh_hash_t. Values of type ftlh_hash_t do
+ *         not need to be freed. If the incoming ftlh_key_t is invalid, the
+ *         ftlh_hash_t returned will map to hash index 0. 
+ */
+FTLH_PUBLIC_FUNC ftlh_hash_t ftlh_hash_key(const ftlh_key_t key) __attribute__ ((warn_unused_result));
+
+/**
+ * This utility function builds a key view over len bytes at ptr, hashing them
+ * once with ftlh_hash_best(). No memory is allocated and nothing is copied. A
+ * view over the same bytes as an ftlh_key_t matches that key in every table. To
+ * use a view with a table which has its own hash function, build it with
+ * ftlh_hash_table_key_view() instead, or each call rehashes it.
+ *
+ * @param ptr The key bytes. May only be NULL if len is 0.
+ * @param len The number of key bytes.
+ *
+ * @return The view, to be passed by address to the *_view functions.
+ */
+FTLH_PUBLIC_FUNC ftlh_key_view_t ftlh_key_view(const void *ptr, size_t len) __attribute__ ((warn_unused_result));
+
 
 struct ftlh_hash_table_s;
 
@@ -333,6 +438,135 @@ typedef void (*ftlh_status_func_t) (ftlh_hash_table_t table, ftlh_key_t key, voi
  */
 FTLH_PUBLIC_FUNC ftlh_hash_table_t ftlh_hash_table_create(size_t estimated_items) __attribute__ ((warn_unused_result));
 
+/**
+ * The maximum value for the partition_bits argument of
+ * ftlh_hash_table_create_partitioned().
+ */
+#define FTLH_MAX_PARTITION_BITS 8
+
+/**
+ * A hash table only ever has one worker applying its writes, which limits write
+ * throughput on a single table to one core. If one table takes most of your
+ * writes, you can call ftlh_hash_table_create_partitioned() instead of
+ * ftlh_hash_table_create(). The table is split into 2^partition_bits partitions
+ * by the high bits of the key hash, and each partition is handed to a different
+ * worker. If there are more partitions than workers, some workers get more than
+ * one. The returned table is used exactly like any other table; callbacks also
+ * receive the returned table, never a partition.
+ *
+ * Writes to one key are still applied in the order they were made. Writes to
+ * keys in different partitions may be applied in parallel.
+ *
+ * @param estimated_items This value represents your best estimate for how many items
+ * you will store in the hash table, across all partitions.
+ * @param partition_bits log2 of the number of partitions, from 0 to
+ *                       FTLH_MAX_PARTITION_BITS. 0 creates a regular table.
+ *
+ * @return Assuming all goes well, the function will return the created hash table
+ *         object. If the creation fails, it will return NULL.
+ */
+FTLH_PUBLIC_FUNC ftlh_hash_table_t ftlh_hash_table_create_partitioned(size_t estimated_items, uint_fast8_t partition_bits) __attribute__ ((warn_unused_result));
+
+/**
+ * This function creates a hash table, partitioned or not, which hashes its keys
+ * with the given function instead of ftlh_hash_best(). Keys built for another
+ * function still work with it: each is rehashed once when the table stores it,
+ * and lookups with it hash its bytes again, so pick the function before building
+ * most of your keys if you can.
+ *
+ * @param estimated_items Your best estimate of how many items the table will hold.
+ * @param partition_bits As for ftlh_hash_table_create_partitioned(); 0 creates a
+ *                       regular table.
+ * @param hash_func A built-in such as ftlh_hash_city(), or your own function. NULL
+ *                  means ftlh_hash_best(), the same as ftlh_hash_table_create().
+ *
+ * @return The created hash table object, or NULL if the creation fails.
+ */
+FTLH_PUBLIC_FUNC ftlh_hash_table_t ftlh_hash_table_create_hashed(size_t estimated_items, uint_fast8_t partition_bits,
+																 ftlh_hash_func_t hash_func) __attribute__ ((warn_unused_result));
+
+/**
+ * This function returns the hash function a table uses, or NULL for a u64 table.
+ */
+FTLH_PUBLIC_FUNC ftlh_hash_func_t ftlh_hash_table_hash_func(ftlh_hash_table_t table) __attribute__ ((warn_unused_result));
+
+/**
+ * This function is the same as ftlh_key_view(), except it hashes the bytes with
+ * the table's hash function, so the view can be used with that table without
+ * being rehashed on every call.
+ */
+FTLH_PUBLIC_FUNC ftlh_key_view_t ftlh_hash_table_key_view(ftlh_hash_table_t table, const void *ptr, size_t len) __attribute__ ((warn_unused_result));
+
+/**
+ * This function creates a hash table keyed by plain 64-bit integers, such as
+ * IDs. There are no ftlh_key_t objects: keys are stored in the slot array right
+ * next to their values and hashed with a cheap integer mixer instead of
+ * ftlh_hash(), so a lookup usually touches a single cache line and never
+ * allocates. Every 64-bit value is a valid key, including 0 and ~0.
+ *
+ * Use the *_u64 functions with it; the ftlh_key_t and view functions fail on a
+ * u64 table, and the *_u64 functions fail on any other table. Destroying it and
+ * the ftlh_hash_table_items() family work as for any table.
+ *
+ * @param estimated_items Your best estimate of how many items the table will hold.
+ *
+ * @return The created hash table object, or NULL if the creation fails.
+ */
+FTLH_PUBLIC_FUNC ftlh_hash_table_t ftlh_hash_table_create_u64(size_t estimated_items) __attribute__ ((warn_unused_result));
+
+/**
+ * This function is ftlh_hash_table_create_u64() for a table split into
+ * partitions, as with ftlh_hash_table_create_partitioned().
+ */
+FTLH_PUBLIC_FUNC ftlh_hash_table_t ftlh_hash_table_create_u64_partitioned(size_t estimated_items, uint_fast8_t partition_bits) __attribute__ ((warn_unused_result));
+
+/**
+ * This function destroys a hash table. All keys owned by the table are freed. The
+ * values stored in the table are not touched; if they need to be freed, you must
+ * do so yourself before destroying the table. You must ensure no other thread is
+ * using the table when you destroy it.
+ *
+ * @param table A pointer to the hash table to destroy.
+ *
+ * @post After a call to ftlh_hash_table_destroy(), the passed in table will be
+ *       NULL.
+ */
+FTLH_PUBLIC_FUNC void ftlh_hash_table_destroy(ftlh_hash_table_t *table);
+
+/**
+ * This function returns the number of keys currently stored in the table. Like
+ * ftlh_queue_approx_items(), the value is only a snapshot and may already be
+ * stale by the time the function returns.
+ *
+ * @param table The hash table whose key count you want to know.
+ *
+ * @return The number of keys in the table, or 0 if passed a NULL table.
+ */
+FTLH_PUBLIC_FUNC uint_fast64_t ftlh_hash_table_items(ftlh_hash_table_t table) __attribute__ ((warn_unused_result));
+
+/**
+ * This function returns the number of slots currently allocated for the table.
+ * The slot array is kept at a power of two and grows automatically once the load
+ * factor passes 0.75.
+ *
+ * @param table The hash table whose capacity you want to know.
+ *
+ * @return The number of slots in the table, or 0 if passed a NULL table.
+ */
+FTLH_PUBLIC_FUNC uint_fast64_t ftlh_hash_table_capacity(ftlh_hash_table_t table) __attribute__ ((warn_unused_result));
+
+/**
+ * This function returns the measured load factor of the table: the fraction of
+ * slots which are occupied by live keys or by tombstones left behind by removed
+ * keys. Tombstones are counted because they lengthen probe sequences just like
+ * live keys do.
+ *
+ * @param table The hash table whose load factor you want to know.
+ *
+ * @return A value between 0 and 1, or 0 if passed a NULL table.
+ */
+FTLH_PUBLIC_FUNC double ftlh_hash_table_load_factor(ftlh_hash_table_t table) __attribute__ ((warn_unused_result));
+
 
 /**
  * You can call ftlh_insert() to insert a value into the hash table. The function
@@ -360,6 +594,8 @@ FTLH_PUBLIC_FUNC uint_fast8_t ftlh_insert(ftlh_hash_table_t table, ftlh_key_t ke
  * @param value The optional value to associate with the key. It can be NULL.
  * @param cb An optional callback function pointer. Pass NULL if you don't want a
  *           callback.
+ *
+ * @note If the insert fails, the key is freed once the callback (if any) returns.
  */
 FTLH_PUBLIC_FUNC void ftlh_insert_async(ftlh_hash_table_t table, ftlh_key_t key, void *value, ftlh_status_func_t cb);
 
@@ -368,7 +604,9 @@ FTLH_PUBLIC_FUNC void ftlh_insert_async(ftlh_hash_table_t table, ftlh_key_t key,
  * You can call ftlh_replace() to replace a value associated with a key. The
  * function will return only after the KVP has been successfully replaced in the
  * table or failed to be replaced. If the key does not exist, it will attempt to
- * insert the key with the provided value.
+ * insert the key with the provided value. Either way, the table takes ownership of
+ * the key you pass in; when a matching key was already stored, it is swapped out
+ * for yours and freed.
  *
  * @param table The hash table containing the KVP to replace.
  * @param key The key whose value you wish to replace.
@@ -381,6 +619,42 @@ FTLH_PUBLIC_FUNC void ftlh_insert_async(ftlh_hash_table_t table, ftlh_key_t key,
 FTLH_PUBLIC_FUNC void * ftlh_replace(ftlh_hash_table_t table, ftlh_key_t key, void *value);
 
 
+/**
+ * You can call ftlh_find() to look up the value associated with a key. Unlike the
+ * write operations, lookups never go through a worker thread. The calling thread
+ * probes the table directly without taking any locks, so lookups scale with the
+ * number of reading threads and never wait behind queued writes.
+ *
+ * @param table The hash table to search.
+ * @param key The key to look for. The caller keeps ownership of the key.
+ *
+ * @return If the key is found, it returns the associated value. Otherwise, it
+ *         returns NULL. If you store NULL values, use ftlh_find_hashed() to tell
+ *         the two cases apart.
+ */
+FTLH_PUBLIC_FUNC void * ftlh_find(ftlh_hash_table_t table, const ftlh_key_t key) __attribute__ ((warn_unused_result));
+
+/**
+ * This function is the same as ftlh_find(), except the caller supplies the hash of
+ * the key, and the result is split into a found flag and the value. If you look
+ * up the same key many times, computing ftlh_hash_key() once saves rehashing it
+ * on every call.
+ *
+ * @param table The hash table to search.
+ * @param key The key to look for. The caller keeps ownership of the key.
+ * @param hash The value returned by ftlh_hash_key() for key. If the table uses
+ *             another hash function than the key, it is ignored and the key is
+ *             hashed with the table's function.
+ * @param value If not NULL, receives the value associated with the key when the
+ *              key is found.
+ *
+ * @return If the key is found, it returns a value guaranteed to evaluate to TRUE in
+ *         a boolean expression. Otherwise, it returns a value guaranteed to
+ *         evaluate to FALSE.
+ */
+FTLH_PUBLIC_FUNC uint_fast8_t ftlh_find_hashed(ftlh_hash_table_t table, const ftlh_key_t key, ftlh_hash_t hash, void **value);
+
+
 /**
  * You can call ftlh_remove() to remove a key from the hash table. The function will
  * return only after succeeding or failing to remove the key. The only time a
@@ -388,6 +662,9 @@ FTLH_PUBLIC_FUNC void * ftlh_replace(ftlh_hash_table_t table, ftlh_key_t key, vo
  * of the remove operation is to make the key not exist in the table, this failure
  * case is silently ignored.
  *
+ * The key you pass in is only used to find the record; you still own it and must
+ * free it. The key stored in the table is freed by the table.
+ *
  * @param table The hash table containing the key to remove.
  * @param key The key to remove from the table.
  *
@@ -403,11 +680,89 @@ FTLH_PUBLIC_FUNC void * ftlh_remove(ftlh_hash_table_t table, ftlh_key_t key);
  * exist in the table. Because the intent of the remove operation is to make the
  * key not exist in the table, this failure case is silently ignored.
  *
+ * Because there is no way to learn when the removal finished, the table takes
+ * ownership of the key you pass in and frees it afterwards.
+ *
  * @param table The hash table containing the KVP to replace.
  * @param key The key whose value you wish to replace.
  */
 FTLH_PUBLIC_FUNC void ftlh_remove_async(ftlh_hash_table_t table, ftlh_key_t key);
 
+/**
+ * This function is the same as ftlh_insert(), except the key is a view. The
+ * table copies the key bytes into a key of its own only if the insert succeeds,
+ * so a failed insert of an existing key allocates nothing.
+ *
+ * @param table The hash table to insert into.
+ * @param view The key to insert. The caller keeps the memory it points at.
+ * @param value The value to associate with the key.
+ *
+ * @return TRUE if the key was inserted, FALSE if it already existed or memory
+ *         ran out.
+ */
+FTLH_PUBLIC_FUNC uint_fast8_t ftlh_insert_view(ftlh_hash_table_t table, const ftlh_key_view_t *view, void *value);
+
+/**
+ * This function is the same as ftlh_replace(), except the key is a view. If the
+ * key already exists, the table keeps its stored key and only swaps the value;
+ * the key bytes are copied only when the key is new.
+ *
+ * @return The old value if the key existed, the new value if it was inserted,
+ *         or NULL on failure.
+ */
+FTLH_PUBLIC_FUNC void * ftlh_replace_view(ftlh_hash_table_t table, const ftlh_key_view_t *view, void *value);
+
+/**
+ * This function is the same as ftlh_find(), except the key is a view, so a
+ * lookup needs no allocation at all.
+ */
+FTLH_PUBLIC_FUNC void * ftlh_find_view(ftlh_hash_table_t table, const ftlh_key_view_t *view) __attribute__ ((warn_unused_result));
+
+/**
+ * This function is the same as ftlh_find_hashed(), except the key is a view,
+ * which already carries its hash.
+ */
+FTLH_PUBLIC_FUNC uint_fast8_t ftlh_find_view_value(ftlh_hash_table_t table, const ftlh_key_view_t *view, void **value);
+
+/**
+ * This function is the same as ftlh_remove(), except the key is a view.
+ */
+FTLH_PUBLIC_FUNC void * ftlh_remove_view(ftlh_hash_table_t table, const ftlh_key_view_t *view);
+
+/**
+ * This function is the same as ftlh_insert(), for a table made by
+ * ftlh_hash_table_create_u64().
+ *
+ * @return TRUE if the key was inserted, FALSE if it already existed, memory ran
+ *         out, or the table is not a u64 table.
+ */
+FTLH_PUBLIC_FUNC uint_fast8_t ftlh_insert_u64(ftlh_hash_table_t table, uint64_t key, void *value);
+
+/**
+ * This function is the same as ftlh_replace(), for a u64 table.
+ *
+ * @return The old value if the key existed, the new value if it was inserted,
+ *         or NULL on failure.
+ */
+FTLH_PUBLIC_FUNC void * ftlh_replace_u64(ftlh_hash_table_t table, uint64_t key, void *value);
+
+/**
+ * This function is the same as ftlh_find(), for a u64 table. Like ftlh_find(),
+ * it never goes through a worker thread and never takes a lock.
+ */
+FTLH_PUBLIC_FUNC void * ftlh_find_u64(ftlh_hash_table_t table, uint64_t key) __attribute__ ((warn_unused_result));
+
+/**
+ * This function is the same as ftlh_find_hashed(), for a u64 table: it tells a
+ * missing key apart from a key stored with a NULL value.
+ */
+FTLH_PUBLIC_FUNC uint_fast8_t ftlh_find_u64_value(ftlh_hash_table_t table, uint64_t key, void **value);
+
+/**
+ * This function is the same as ftlh_remove(), for a u64 table.
+ */
+FTLH_PUBLIC_FUNC void * ftlh_remove_u64(ftlh_hash_table_t table, uint64_t key);
+
 
 /**
  * @}
@@ -456,6 +811,14 @@ struct ftlh_queue_s;
  */
 typedef struct ftlh_queue_s * ftlh_queue_t __attribute__ ((aligned(16)));
 
+/**
+ * This type represents a watermark callback for a queue. It is called with high
+ * set to 1 when the queue fills up to its high watermark, and with high set to 0
+ * when it has drained back down to its low watermark. See
+ * ftlh_queue_set_watermarks().
+ */
+typedef void (*ftlh_queue_watermark_func_t)(ftlh_queue_t queue, uint_fast8_t high, void *user_data);
+
 /**
  * This function creates a new queue of a specified size and returns it. It cannot
  * be resized. The queue can hold up to as many elements as you can get from a 64
@@ -467,6 +830,20 @@ typedef struct ftlh_queue_s * ftlh_queue_t __attribute__ ((aligned(16)));
  */
 FTLH_PUBLIC_FUNC ftlh_queue_t ftlh_queue_create(uint_fast64_t size);
 
+/**
+ * This function creates a queue just like ftlh_queue_create(), except that every
+ * node gets a cache line to itself. Neighbouring nodes are filled and emptied by
+ * different threads at nearly the same time, and in a regular queue four of them
+ * share a cache line, which then bounces between the cores involved. Padding the
+ * nodes stops that at the cost of four times the memory. It pays off when many
+ * producers and consumers on different cores use the same queue.
+ *
+ * @param size The number of items the queue can hold.
+ *
+ * @return Upon success, returns a newly allocated queue. Upon failure, returns NULL.
+ */
+FTLH_PUBLIC_FUNC ftlh_queue_t ftlh_queue_create_padded(uint_fast64_t size);
+
 
 /**
  * This function destroys a queue. You must ensure all threads are done using the
@@ -478,21 +855,99 @@ FTLH_PUBLIC_FUNC void ftlh_queue_destroy(ftlh_queue_t *queue);
 
 /**
  * This function adds an element onto the head of the queue. If the queue is full,
- * it will block until the item can be added.
+ * it will block until the item can be added. Any value may be queued, including
+ * NULL. Adding and removing items never makes a system call unless a producer
+ * has to wait for room in a full queue. Such a producer backs off as described
+ * for ftlh_backoff_t: it spins first, then yields, and only then sleeps.
  *
  * @param value The item to add to the queue.
  *
  * @return The function call cannot fail to add the item to the queue. When it
  *         succeeds, it will return an approximate count of how many items are ahead
- *         of it in the queue. Because of race conditions, the count may not be
- *         exact. However, it will typically be within a few items of the actual
- *         count and is more likely to be >= to the count than less than the count.
+ *         of it in the queue. Producers count against a copy of the consumer
+ *         position which they only refresh every so often, so the count is not
+ *         exact and errs high rather than low.
  *         This can be used to detect how full the queue is and take appropriate
  *         measures to ensure you don't end up getting stuck waiting to add an item
  *         to the queue.
  */
 FTLH_PUBLIC_FUNC uint_fast32_t ftlh_queue_enqueue(ftlh_queue_t queue, void *value);
 
+/**
+ * This function adds an element onto the head of the queue if there is room for
+ * it. Unlike ftlh_queue_enqueue(), it never waits: if the queue is full, it
+ * returns right away without adding the item.
+ *
+ * @param queue The queue to add the item to.
+ * @param value The item to add to the queue.
+ *
+ * @return 1 if the item was added, 0 if the queue was full.
+ */
+FTLH_PUBLIC_FUNC uint_fast8_t ftlh_queue_try_enqueue(ftlh_queue_t queue, void *value);
+
+/**
+ * This function adds an element onto the head of the queue, waiting for room in
+ * a full queue for at most the given time.
+ *
+ * @param queue The queue to add the item to.
+ * @param value The item to add to the queue.
+ * @param timeout_usec The longest time to wait, in microseconds. 0 means do not
+ *        wait at all, like ftlh_queue_try_enqueue().
+ *
+ * @return 1 if the item was added, 0 if the queue stayed full until the timeout.
+ */
+FTLH_PUBLIC_FUNC uint_fast8_t ftlh_queue_enqueue_timed(ftlh_queue_t queue, void *value, uint_fast64_t timeout_usec);
+
+/**
+ * This function sets a callback which tells producers when to shed load. It is
+ * called with high = 1 by the producer which takes the queue to high items or
+ * more. It is then called with high = 0 by the consumer which drains the queue to
+ * low items or fewer, and so on. The callback runs on the producer or consumer
+ * thread, so it should be quick. Item counts are approximate, so a call may come
+ * an item or two early or late, and calls from different threads may overlap.
+ *
+ * Set the watermarks before the queue is in use. Passing a NULL func removes them.
+ *
+ * @param queue The queue to watch.
+ * @param high The high watermark. It must be greater than low and no more than
+ *        the size of the queue.
+ * @param low The low watermark.
+ * @param func The callback, or NULL.
+ * @param user_data Passed to the callback as is.
+ *
+ * @return 0 on success. 1 if the watermarks are invalid, with errno set to EINVAL.
+ */
+FTLH_PUBLIC_FUNC uint_fast8_t ftlh_queue_set_watermarks(ftlh_queue_t queue, uint_fast64_t high, uint_fast64_t low,
+														ftlh_queue_watermark_func_t func, void *user_data);
+
+
+/**
+ * This function adds several elements onto the head of the queue, in order. It
+ * claims as many free nodes as it can with a single atomic operation, so moving
+ * a batch costs about as much as moving one item. If the queue fills up, it will
+ * block until every item has been added. Items from other producers may end up
+ * between parts of the batch if the queue was full in the meantime.
+ *
+ * @param queue The queue to add the items to.
+ * @param values The items to add.
+ * @param count The number of items in values.
+ *
+ * @return The approximate number of items in the queue, like ftlh_queue_enqueue().
+ */
+FTLH_PUBLIC_FUNC uint_fast64_t ftlh_queue_enqueue_bulk(ftlh_queue_t queue, void * const *values, uint_fast64_t count);
+
+/**
+ * This function dequeues up to max items from the tail of the queue with a single
+ * atomic operation. It never waits; if fewer items are ready, it takes those.
+ *
+ * @param queue The queue to dequeue the items from.
+ * @param values Where to store the dequeued items, in queue order. It must have
+ *               room for max items.
+ * @param max The most items to dequeue.
+ *
+ * @return The number of items stored in values, 0 if the queue was empty.
+ */
+FTLH_PUBLIC_FUNC uint_fast64_t ftlh_queue_dequeue_bulk(ftlh_queue_t queue, void **values, uint_fast64_t max);
 
 /**
  * This function attempts to dequeue an item from the tail of the queue.
@@ -501,10 +956,135 @@ FTLH_PUBLIC_FUNC uint_fast32_t ftlh_queue_enqueue(ftlh_queue_t queue, void *valu
  *
  * @return Upon completion it returns the item on the tail of the queue. If no item
  *         was available, or if another consumer dequeued the item first, it will
- *         return NULL.
+ *         return NULL. If you enqueue NULL values, use ftlh_queue_try_dequeue()
+ *         instead, since a dequeued NULL looks just like an empty queue here.
  */
 FTLH_PUBLIC_FUNC void *ftlh_queue_dequeue(ftlh_queue_t queue);
 
+/**
+ * This function attempts to dequeue an item from the tail of the queue, and tells
+ * an empty queue apart from a dequeued NULL value.
+ *
+ * @param queue The queue to dequeue the item from.
+ * @param value Where to store the dequeued item. May be NULL to discard it.
+ *
+ * @return Returns 1 if an item was dequeued, or 0 if the queue was empty.
+ */
+FTLH_PUBLIC_FUNC uint_fast8_t ftlh_queue_try_dequeue(ftlh_queue_t queue, void **value);
+
+/**
+ * This function removes an element from the tail of the queue, waiting for one to
+ * arrive if the queue is empty. A waiting consumer spins briefly and then sleeps
+ * until a producer wakes it. Producers only make the wake up call while a
+ * consumer is actually asleep, and taking an item from a non-empty queue never
+ * makes a system call.
+ *
+ * @param queue The queue to remove the item from.
+ * @param value Where to store the item. May be NULL to discard it.
+ * @param timeout_usec The longest time to wait, in microseconds. 0 means wait
+ *        until an item arrives.
+ *
+ * @return 1 if an item was removed, 0 if the queue stayed empty until the timeout.
+ */
+FTLH_PUBLIC_FUNC uint_fast8_t ftlh_queue_dequeue_wait(ftlh_queue_t queue, void **value, uint_fast64_t timeout_usec);
+
+/**
+ * The largest element size for ftlh_queue_create_payload().
+ */
+#define FTLH_QUEUE_MAX_PAYLOAD 4096
+
+/**
+ * This type identifies a node handed out by ftlh_queue_reserve() or
+ * ftlh_queue_try_acquire(), so it can be given back with ftlh_queue_commit() or
+ * ftlh_queue_release().
+ */
+typedef uint64_t ftlh_queue_ticket_t;
+
+/**
+ * This function creates a queue which carries fixed-size elements by value
+ * instead of pointers. Each node holds the element bytes next to its sequence
+ * number, padded to whole cache lines, so a message needs no allocation. Use the
+ * *_copy functions, or ftlh_queue_reserve() / ftlh_queue_commit() and
+ * ftlh_queue_try_acquire() / ftlh_queue_release() to work on the nodes in place.
+ *
+ * @param size The number of elements the queue can hold.
+ * @param elem_size The size of each element in bytes, up to
+ *        FTLH_QUEUE_MAX_PAYLOAD.
+ *
+ * @return Upon success, returns a newly allocated queue. Upon failure, returns
+ *         NULL, with errno set to EINVAL if elem_size is out of range.
+ */
+FTLH_PUBLIC_FUNC ftlh_queue_t ftlh_queue_create_payload(uint_fast64_t size, uint_fast64_t elem_size);
+
+/**
+ * This function returns the element size of a queue created with
+ * ftlh_queue_create_payload(), or 0 for any other queue.
+ */
+FTLH_PUBLIC_FUNC uint_fast64_t ftlh_queue_elem_size(ftlh_queue_t queue) __attribute__ ((warn_unused_result));
+
+/**
+ * This function copies an element into the queue, waiting for room if the queue
+ * is full, like ftlh_queue_enqueue().
+ *
+ * @param queue A queue created with ftlh_queue_create_payload().
+ * @param elem The element to copy in; ftlh_queue_elem_size() bytes are read.
+ */
+FTLH_PUBLIC_FUNC void ftlh_queue_enqueue_copy(ftlh_queue_t queue, const void *elem);
+
+/**
+ * This function copies an element into the queue if there is room for it.
+ *
+ * @return 1 if the element was added, 0 if the queue was full.
+ */
+FTLH_PUBLIC_FUNC uint_fast8_t ftlh_queue_try_enqueue_copy(ftlh_queue_t queue, const void *elem);
+
+/**
+ * This function copies the oldest element out of the queue and removes it.
+ *
+ * @param queue A queue created with ftlh_queue_create_payload().
+ * @param elem Where to copy the element; ftlh_queue_elem_size() bytes are written.
+ *
+ * @return 1 if an element was removed, 0 if the queue was empty.
+ */
+FTLH_PUBLIC_FUNC uint_fast8_t ftlh_queue_try_dequeue_copy(ftlh_queue_t queue, void *elem);
+
+/**
+ * This function claims the next node of the queue, waiting for room if the queue
+ * is full, and returns its element bytes for the caller to fill in place.
+ * Consumers do not see the element until ftlh_queue_commit() is called with the
+ * ticket. Nodes are taken in order, so commit promptly: later elements are held
+ * up until this one is committed.
+ *
+ * @param queue A queue created with ftlh_queue_create_payload().
+ * @param ticket Set to the ticket to pass to ftlh_queue_commit().
+ *
+ * @return The element bytes, aligned to 8 bytes.
+ */
+FTLH_PUBLIC_FUNC void *ftlh_queue_reserve(ftlh_queue_t queue, ftlh_queue_ticket_t *ticket) __attribute__ ((warn_unused_result));
+
+/**
+ * This function publishes an element filled in after ftlh_queue_reserve().
+ */
+FTLH_PUBLIC_FUNC void ftlh_queue_commit(ftlh_queue_t queue, ftlh_queue_ticket_t ticket);
+
+/**
+ * This function claims the oldest element of the queue so it can be read in
+ * place. The node is not reused until ftlh_queue_release() is called with the
+ * ticket, and producers wrap around to it in order, so release promptly.
+ *
+ * @param queue A queue created with ftlh_queue_create_payload().
+ * @param ticket Set to the ticket to pass to ftlh_queue_release().
+ *
+ * @return The element bytes, or NULL if the queue was empty.
+ */
+FTLH_PUBLIC_FUNC void *ftlh_queue_try_acquire(ftlh_queue_t queue, ftlh_queue_ticket_t *ticket) __attribute__ ((warn_unused_result));
+
+/**
+ * This function gives a node read after ftlh_queue_try_acquire() back to the
+ * producers.
+ */
+FTLH_PUBLIC_FUNC void ftlh_queue_release(ftlh_queue_t queue, ftlh_queue_ticket_t ticket);
+
 
 /**
  * This function queries the queue for the original specified size and returns it.
@@ -532,6 +1112,315 @@ FTLH_PUBLIC_FUNC uint_fast64_t ftlh_queue_size(ftlh_queue_t queue) __attribute__
  */
 FTLH_PUBLIC_FUNC uint_fast64_t ftlh_queue_approx_items(ftlh_queue_t queue) __attribute__ ((warn_unused_result));
 
+/**
+ * @}
+ */
+
+/**
+ * @defgroup spsc Single-producer, Single-consumer, Wait-free Queue
+ * @ingroup spsc
+ * @{
+ */
+
+/**
+ * A queue for exactly one producer thread and one consumer thread. With only one
+ * thread on each side, no atomic read-modify-write is needed: each side owns
+ * its position and publishes it with a release store. Each side also keeps a
+ * cached copy of the other side's position and only re-reads the real one when
+ * the cache says the queue is full (or empty). Most operations therefore touch
+ * no cache line the other thread writes.
+ *
+ * Using it from more than one producer or more than one consumer at a time will
+ * corrupt it. Use ftlh_queue_t for that.
+ */
+struct ftlh_spsc_queue_s;
+
+/**
+ * This type represents a single-producer, single-consumer queue object.
+ */
+typedef struct ftlh_spsc_queue_s * ftlh_spsc_queue_t;
+
+/**
+ * This function creates a new single-producer, single-consumer queue. The size is
+ * rounded up to a power of two, and to at least 64.
+ *
+ * @param size The number of items the queue must be able to hold.
+ *
+ * @return Upon success, returns a newly allocated queue. Upon failure, returns NULL.
+ */
+FTLH_PUBLIC_FUNC ftlh_spsc_queue_t ftlh_spsc_queue_create(uint_fast64_t size);
+
+/**
+ * This function destroys a single-producer, single-consumer queue. Neither side
+ * may be using it any more.
+ *
+ * @param queue A pointer to the queue object to destroy.
+ */
+FTLH_PUBLIC_FUNC void ftlh_spsc_queue_destroy(ftlh_spsc_queue_t *queue);
+
+/**
+ * This function adds an item to the queue if there is room for it. Only the
+ * producer thread may call it. Any value may be queued, including NULL.
+ *
+ * @param queue The queue to add the item to.
+ * @param value The item to add.
+ *
+ * @return 1 if the item was added, 0 if the queue was full.
+ */
+FTLH_PUBLIC_FUNC uint_fast8_t ftlh_spsc_queue_try_enqueue(ftlh_spsc_queue_t queue, void *value);
+
+/**
+ * This function adds an item to the queue, backing off (see ftlh_backoff_t) while
+ * the queue is full. Only the producer thread may call it.
+ *
+ * @param queue The queue to add the item to.
+ * @param value The item to add.
+ */
+FTLH_PUBLIC_FUNC void ftlh_spsc_queue_enqueue(ftlh_spsc_queue_t queue, void *value);
+
+/**
+ * This function removes the oldest item from the queue. Only the consumer thread
+ * may call it.
+ *
+ * @param queue The queue to remove the item from.
+ * @param value Where to store the item. May be NULL to discard it.
+ *
+ * @return 1 if an item was removed, 0 if the queue was empty.
+ */
+FTLH_PUBLIC_FUNC uint_fast8_t ftlh_spsc_queue_try_dequeue(ftlh_spsc_queue_t queue, void **value);
+
+/**
+ * This function returns the number of items the queue can hold.
+ *
+ * @param queue The queue whose size you want to know.
+ *
+ * @return The size of the queue, or 0 if you pass it a NULL pointer.
+ */
+FTLH_PUBLIC_FUNC uint_fast64_t ftlh_spsc_queue_size(ftlh_spsc_queue_t queue) __attribute__ ((warn_unused_result));
+
+/**
+ * This function returns the number of items in the queue. It is exact when called
+ * from the producer or the consumer, but may be stale by the time it returns.
+ *
+ * @param queue The queue whose item count you want to know.
+ *
+ * @return The number of items in the queue, or 0 if you pass it a NULL pointer.
+ */
+FTLH_PUBLIC_FUNC uint_fast64_t ftlh_spsc_queue_approx_items(ftlh_spsc_queue_t queue) __attribute__ ((warn_unused_result));
+
+/**
+ * @}
+ */
+
+/**
+ * @defgroup unbounded Unbounded Multi-producer, Multi-consumer, Lock-free Queue
+ * @ingroup unbounded
+ * @{
+ */
+
+/**
+ * A queue which grows as needed, so producers never wait for room. It is a
+ * chain of fixed-size segments. When producers fill the last segment they link
+ * a new one onto it, and when consumers drain a segment it is recycled through a
+ * small pool. Memory therefore tracks the backlog: a burst is absorbed without
+ * stalling anyone, and afterwards the queue shrinks back to a few segments.
+ *
+ * Drained segments are only reused once no thread can still be looking at them,
+ * using the same epoch based reclamation as the hash tables.
+ */
+struct ftlh_unbounded_queue_s;
+
+/**
+ * This type represents an unbounded queue object.
+ */
+typedef struct ftlh_unbounded_queue_s * ftlh_unbounded_queue_t;
+
+/**
+ * This function creates a new unbounded queue.
+ *
+ * @param segment_size The number of items per segment, at least 64. Larger
+ *        segments mean fewer allocations during a burst but more memory at rest.
+ *
+ * @return Upon success, returns a newly allocated queue. Upon failure, returns NULL.
+ */
+FTLH_PUBLIC_FUNC ftlh_unbounded_queue_t ftlh_unbounded_queue_create(uint_fast64_t segment_size);
+
+/**
+ * This function destroys an unbounded queue and any items still in it. No other
+ * thread may be using it any more.
+ *
+ * @param queue A pointer to the queue object to destroy.
+ */
+FTLH_PUBLIC_FUNC void ftlh_unbounded_queue_destroy(ftlh_unbounded_queue_t *queue);
+
+/**
+ * This function adds an item to the queue. It never waits for room. Any value
+ * may be queued, including NULL.
+ *
+ * @param queue The queue to add the item to.
+ * @param value The item to add.
+ *
+ * @return 1 if the item was added, 0 if a new segment was needed and could not
+ *         be allocated.
+ */
+FTLH_PUBLIC_FUNC uint_fast8_t ftlh_unbounded_queue_enqueue(ftlh_unbounded_queue_t queue, void *value);
+
+/**
+ * This function removes the oldest item from the queue, if there is one.
+ *
+ * @param queue The queue to remove the item from.
+ * @param value Where to store the item. May be NULL to discard it.
+ *
+ * @return 1 if an item was removed, 0 if the queue was empty.
+ */
+FTLH_PUBLIC_FUNC uint_fast8_t ftlh_unbounded_queue_try_dequeue(ftlh_unbounded_queue_t queue, void **value);
+
+/**
+ * This function returns the approximate number of items in the queue.
+ *
+ * @param queue The queue whose item count you want to know.
+ *
+ * @return The approximate number of items, or 0 if you pass it a NULL pointer.
+ */
+FTLH_PUBLIC_FUNC uint_fast64_t ftlh_unbounded_queue_approx_items(ftlh_unbounded_queue_t queue) __attribute__ ((warn_unused_result));
+
+/**
+ * This function returns the number of segments the queue currently has
+ * allocated, whether in use, waiting to be reclaimed or pooled. It tells you how
+ * much memory the queue is holding on to.
+ *
+ * @param queue The queue to look at.
+ *
+ * @return The number of segments, or 0 if you pass it a NULL pointer.
+ */
+FTLH_PUBLIC_FUNC uint_fast64_t ftlh_unbounded_queue_segments(ftlh_unbounded_queue_t queue) __attribute__ ((warn_unused_result));
+
+/**
+ * @}
+ */
+
+/**
+ * @defgroup ring Broadcast Ring with Independent Consumer Cursors
+ * @ingroup ring
+ * @{
+ */
+
+/**
+ * A ring which hands every item to every consumer, in the style of the LMAX
+ * Disruptor. Each consumer has its own cursor and reads the items in order
+ * without removing them. Producers wait for the slowest consumer before they
+ * reuse a node. Consumers can be chained: a consumer created with dependencies
+ * only sees an item once each of them has read it, so stages can run as a
+ * pipeline (or a diamond) over one copy of the stream.
+ *
+ * Any number of threads may publish. Each consumer must only be read from by one
+ * thread at a time.
+ */
+struct ftlh_ring_s;
+struct ftlh_ring_consumer_s;
+
+/**
+ * This type represents a broadcast ring object.
+ */
+typedef struct ftlh_ring_s * ftlh_ring_t;
+
+/**
+ * This type represents one consumer (one cursor) of a broadcast ring.
+ */
+typedef struct ftlh_ring_consumer_s * ftlh_ring_consumer_t;
+
+/**
+ * This function creates a new broadcast ring. The size is rounded up to a power
+ * of two, and to at least 64.
+ *
+ * @param size The number of items the ring can hold ahead of its slowest consumer.
+ *
+ * @return Upon success, returns a newly allocated ring. Upon failure, returns NULL.
+ */
+FTLH_PUBLIC_FUNC ftlh_ring_t ftlh_ring_create(uint_fast64_t size);
+
+/**
+ * This function destroys a broadcast ring and all of its consumers. No other
+ * thread may be using it any more.
+ *
+ * @param ring A pointer to the ring object to destroy.
+ */
+FTLH_PUBLIC_FUNC void ftlh_ring_destroy(ftlh_ring_t *ring);
+
+/**
+ * This function adds a consumer to the ring. Add every consumer before anything
+ * is published; a consumer only sees items published after it was added.
+ *
+ * @param ring The ring to consume from.
+ * @param deps Consumers of the same ring which must have read an item before this
+ *        one may. May be NULL if dep_count is 0.
+ * @param dep_count The number of consumers in deps.
+ *
+ * @return The new consumer, or NULL if the ring already has
+ *         FTLH_RING_MAX_CONSUMERS consumers, a dependency belongs to another
+ *         ring, or memory ran out.
+ */
+FTLH_PUBLIC_FUNC ftlh_ring_consumer_t ftlh_ring_add_consumer(ftlh_ring_t ring, ftlh_ring_consumer_t *deps, uint_fast32_t dep_count);
+
+/**
+ * This function publishes an item to every consumer, waiting (see
+ * ftlh_backoff_t) while the slowest consumer is a full ring behind.
+ *
+ * @param ring The ring to publish to.
+ * @param value The item. Any value may be published, including NULL.
+ */
+FTLH_PUBLIC_FUNC void ftlh_ring_publish(ftlh_ring_t ring, void *value);
+
+/**
+ * This function publishes an item to every consumer if there is room for it.
+ *
+ * @return 1 if the item was published, 0 if the slowest consumer is a full ring
+ *         behind.
+ */
+FTLH_PUBLIC_FUNC uint_fast8_t ftlh_ring_try_publish(ftlh_ring_t ring, void *value);
+
+/**
+ * This function reads the consumer's next item and moves its cursor past it,
+ * so dependent consumers may read it right away.
+ *
+ * @param consumer The consumer to read for.
+ * @param value Where to store the item. May be NULL to skip it.
+ *
+ * @return 1 if an item was read, 0 if there is none yet, or if the consumer's
+ *         dependencies have not read it yet.
+ */
+FTLH_PUBLIC_FUNC uint_fast8_t ftlh_ring_try_read(ftlh_ring_consumer_t consumer, void **value);
+
+/**
+ * This function reads up to max of the consumer's next items at once and moves
+ * its cursor past them with a single store, so dependent consumers and
+ * producers see the whole batch at once.
+ *
+ * @return The number of items read, 0 if none were available.
+ */
+FTLH_PUBLIC_FUNC uint_fast64_t ftlh_ring_read_batch(ftlh_ring_consumer_t consumer, void **values, uint_fast64_t max);
+
+/**
+ * This function reads up to max of the consumer's next items without moving its
+ * cursor. Use it when dependent consumers must not see an item until this one
+ * has finished with it, and call ftlh_ring_advance() once done. Peeking again
+ * before advancing returns the same items.
+ *
+ * @return The number of items read, 0 if none were available.
+ */
+FTLH_PUBLIC_FUNC uint_fast64_t ftlh_ring_peek_batch(ftlh_ring_consumer_t consumer, void **values, uint_fast64_t max);
+
+/**
+ * This function moves the consumer's cursor past count items returned by
+ * ftlh_ring_peek_batch(), handing them to dependent consumers and letting
+ * producers reuse their nodes.
+ *
+ * @param consumer The consumer which peeked the items.
+ * @param count How many of the peeked items are done. Must not be more than the
+ *        last peek returned.
+ */
+FTLH_PUBLIC_FUNC void ftlh_ring_advance(ftlh_ring_consumer_t consumer, uint_fast64_t count);
+
 /**
  * @}
  */
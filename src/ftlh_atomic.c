@@ -26,6 +26,37 @@
 #include <libkern/OSAtomic.h>
 #endif
 
+#if defined(__x86_64__)
+#include <cpuid.h>
+#endif
+
+#include <sched.h>
+
+#ifdef __linux__
+#include <errno.h>
+#include <limits.h>
+#include <linux/futex.h>
+#include <linux/membarrier.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <unistd.h>
+#endif
+
+/* Striped locks for 128-bit operations on CPUs without a double-width CAS */
+#define FTLH_ATOMIC128_LOCKS 64
+
+struct ftlh_atomic128_lock_s {
+	ftlh_atomic32_t lock;
+} __attribute__ ((aligned(64)));
+
+static struct ftlh_atomic128_lock_s ftlh_atomic128_locks[FTLH_ATOMIC128_LOCKS];
+
+/* -1 until the CPU was checked, then 1 if cmpxchg16b can be used. Tests may set
+ * it to 0 first to exercise the locked path. */
+int ftlh_atomic128_cx16 = -1;
+
+ftlh_atomic32_t ftlh_atomic_fence_asym = 0;
+
 uint32_t ftlh_atomic32_fetch_and_add(ftlh_atomic32_t *loc, uint32_t value)
 {
 	uint32_t ret_val = 0;
@@ -388,7 +419,7 @@ uint32_t ftlh_atomic32_get(ftlh_atomic32_t *loc)
 		ret_val = *loc;
 	} while (!OSAtomicCompareAndSwap32Barrier((int32_t)ret_val, (int32_t)ret_val, (volatile int32_t *)loc));
 #else
-	ret_val = __sync_fetch_and_or(loc, 0);
+	ret_val = ftlh_atomic32_load_seq_cst(loc);
 #endif
 	return ret_val;
 }
@@ -406,9 +437,7 @@ uint32_t ftlh_atomic32_set(ftlh_atomic32_t *loc, uint32_t value)
 		ret_val = *loc;
 	} while (!OSAtomicCompareAndSwap32Barrier((int32_t)ret_val, (int32_t)value, (volatile int32_t *)loc));
 #else
-	do {
-		ret_val = *loc;
-	} while (!__sync_bool_compare_and_swap(loc, ret_val, value));
+	ret_val = ftlh_atomic32_exchange_seq_cst(loc, value);
 #endif
 	return ret_val;
 }
@@ -453,7 +482,7 @@ uint64_t ftlh_atomic64_get(ftlh_atomic64_t *loc)
 		ret_val = *loc;
 	} while (!OSAtomicCompareAndSwap64Barrier((int64_t)ret_val, (int64_t)ret_val, (volatile int64_t *)loc));
 #else
-	ret_val = __sync_fetch_and_or(loc, 0);
+	ret_val = ftlh_atomic64_load_seq_cst(loc);
 #endif
 	return ret_val;
 }
@@ -471,9 +500,7 @@ uint64_t ftlh_atomic64_set(ftlh_atomic64_t *loc, uint64_t value)
 		ret_val = *loc;
 	} while (!OSAtomicCompareAndSwap64Barrier((int64_t)ret_val, (int64_t)value, (volatile int64_t *)loc));
 #else
-	do {
-		ret_val = *loc;
-	} while (!__sync_bool_compare_and_swap(loc, ret_val, value));
+	ret_val = ftlh_atomic64_exchange_seq_cst(loc, value);
 #endif
 	return ret_val;
 }
@@ -548,7 +575,7 @@ void *ftlh_atomic_ptr_get(ftlh_atomicptr_t *loc)
 		ret_val = (void *)*loc;    /* Assumes the location is 32-bit aligned on 32-bit systems and 64-bit aligned on 64-bit systems */
 	} while (!OSAtomicCompareAndSwapPtrBarrier(ret_val, ret_val, loc));
 #else
-	ret_val = __sync_val_compare_and_swap(loc, 0, 0);
+	ret_val = ftlh_atomic_ptr_load_seq_cst(loc);
 #endif
 	return ret_val;
 }
@@ -566,9 +593,7 @@ void * ftlh_atomic_ptr_set(ftlh_atomicptr_t *loc, void * value)
 		ret_val = (void *)*loc;    /* Assumes the location is 32-bit aligned on 32-bit systems and 64-bit aligned on 64-bit systems */
 	} while (!OSAtomicCompareAndSwapPtrBarrier(ret_val, value, loc));
 #else
-	do {
-		ret_val = ftlh_atomic_ptr_get(loc);
-	} while (__sync_val_compare_and_swap(loc, ret_val, value) != ret_val);
+	ret_val = ftlh_atomic_ptr_exchange_seq_cst(loc, value);
 #endif
 	return ret_val;
 }
@@ -642,6 +667,242 @@ uint32_t ftlh_atomic64_inc_low32(ftlh_atomic64_t *loc)
 	return ret_val;
 }
 
+uint_fast8_t ftlh_atomic128_lock_free(void)
+{
+#if defined(__x86_64__)
+	unsigned int eax = 0, ebx = 0, ecx = 0, edx = 0;
+
+	if (ftlh_atomic128_cx16 < 0) {
+		ftlh_atomic128_cx16 = (__get_cpuid(1, &eax, &ebx, &ecx, &edx) && (ecx & bit_CMPXCHG16B)) ? 1 : 0;
+	}
+#else
+	ftlh_atomic128_cx16 = 0;
+#endif
+	return (uint_fast8_t)ftlh_atomic128_cx16;
+}
+
+static struct ftlh_atomic128_lock_s *ftlh_atomic128_lock(ftlh_atomic128_t *loc)
+{
+	struct ftlh_atomic128_lock_s *stripe = &ftlh_atomic128_locks[((uintptr_t)loc >> 4) % FTLH_ATOMIC128_LOCKS];
+
+	while (!ftlh_atomic32_bool_cas(&stripe->lock, 0, 1)) {
+		while (ftlh_atomic32_load_relaxed(&stripe->lock)) {
+#if defined(__x86_64__) || defined(__i386__)
+			__builtin_ia32_pause();
+#endif
+		}
+	}
+	return stripe;
+}
+
+static void ftlh_atomic128_unlock(struct ftlh_atomic128_lock_s *stripe)
+{
+	ftlh_atomic32_store_release(&stripe->lock, 0);
+}
+
+uint_fast8_t ftlh_atomic128_cas(ftlh_atomic128_t *loc, ftlh_atomic128_t *expected, ftlh_atomic128_t desired)
+{
+	struct ftlh_atomic128_lock_s *stripe = NULL;
+	uint_fast8_t ret_val = 0;
+
+#if defined(__x86_64__)
+	if (ftlh_atomic128_lock_free()) {
+		uint8_t ok = 0;
+		__asm__ __volatile__ ("lock cmpxchg16b %1\n\tsete %0"
+							  : "=q" (ok), "+m" (*loc), "+a" (expected->lo), "+d" (expected->hi)
+							  : "b" (desired.lo), "c" (desired.hi)
+							  : "memory", "cc");
+		return ok;
+	}
+#endif
+
+	stripe = ftlh_atomic128_lock(loc);
+	if (loc->lo == expected->lo && loc->hi == expected->hi) {
+		*loc = desired;
+		ret_val = 1;
+	} else {
+		*expected = *loc;
+	}
+	ftlh_atomic128_unlock(stripe);
+
+	return ret_val;
+}
+
+ftlh_atomic128_t ftlh_atomic128_get(ftlh_atomic128_t *loc)
+{
+	ftlh_atomic128_t value = { 0, 0 };
+
+	/* A CAS which fails (or swaps a value for itself) reads both halves at once */
+	ftlh_atomic128_cas(loc, &value, value);
+	return value;
+}
+
+void ftlh_atomic128_set(ftlh_atomic128_t *loc, ftlh_atomic128_t value)
+{
+	ftlh_atomic128_t old_value = ftlh_atomic128_get(loc);
+
+	while (!ftlh_atomic128_cas(loc, &old_value, value));
+}
+
+uint_fast8_t ftlh_tagged_ptr_cas(ftlh_tagged_ptr_t *loc, ftlh_tagged_ptr_t expected, void *new_ptr)
+{
+	return ftlh_atomic128_cas(loc, &expected, ftlh_tagged_ptr_make(new_ptr, ftlh_tagged_ptr_tag(expected) + 1));
+}
+
+uint_fast8_t ftlh_atomic32_wait(ftlh_atomic32_t *loc, uint32_t expected, uint_fast64_t timeout_usec)
+{
+#ifdef __linux__
+	struct timespec ts, *tsp = NULL;
+
+	if (timeout_usec) {
+		ts.tv_sec = timeout_usec / 1000000;
+		ts.tv_nsec = (timeout_usec % 1000000) * 1000;
+		tsp = &ts;
+	}
+	if (syscall(SYS_futex, loc, FUTEX_WAIT_PRIVATE, expected, tsp, NULL, 0) == -1 && errno == ETIMEDOUT) {
+		return 0;
+	}
+	return 1;
+#else
+	if (ftlh_atomic32_get(loc) == expected) {
+		ftlh_yield(timeout_usec && timeout_usec < 100 ? timeout_usec : 100);
+	}
+	return 1;
+#endif
+}
+
+void ftlh_atomic32_notify_one(ftlh_atomic32_t *loc)
+{
+#ifdef __linux__
+	syscall(SYS_futex, loc, FUTEX_WAKE_PRIVATE, 1, NULL, NULL, 0);
+#else
+	(void)loc;
+#endif
+}
+
+void ftlh_atomic32_notify_all(ftlh_atomic32_t *loc)
+{
+#ifdef __linux__
+	syscall(SYS_futex, loc, FUTEX_WAKE_PRIVATE, INT_MAX, NULL, NULL, 0);
+#else
+	(void)loc;
+#endif
+}
+
+static ftlh_atomic32_t ftlh_backoff_spin_rounds = FTLH_BACKOFF_SPIN_ROUNDS;
+static ftlh_atomic32_t ftlh_backoff_yield_rounds = FTLH_BACKOFF_YIELD_ROUNDS;
+static ftlh_atomic32_t ftlh_backoff_park_usec = FTLH_BACKOFF_PARK_USEC;
+
+void ftlh_backoff_set_defaults(uint32_t spin_rounds, uint32_t yield_rounds, uint32_t park_usec)
+{
+	ftlh_atomic32_set(&ftlh_backoff_spin_rounds, spin_rounds);
+	ftlh_atomic32_set(&ftlh_backoff_yield_rounds, yield_rounds);
+	ftlh_atomic32_set(&ftlh_backoff_park_usec, park_usec ? park_usec : 1);
+}
+
+void ftlh_backoff_init(ftlh_backoff_t *backoff)
+{
+	ftlh_backoff_init_custom(backoff, ftlh_atomic32_load_relaxed(&ftlh_backoff_spin_rounds),
+							 ftlh_atomic32_load_relaxed(&ftlh_backoff_yield_rounds),
+							 ftlh_atomic32_load_relaxed(&ftlh_backoff_park_usec));
+}
+
+void ftlh_backoff_init_custom(ftlh_backoff_t *backoff, uint32_t spin_rounds, uint32_t yield_rounds, uint32_t park_usec)
+{
+	/* 2^31 pauses is already far longer than any sensible park */
+	backoff->spin_rounds = (spin_rounds > 31 ? 31 : spin_rounds);
+	backoff->yield_rounds = yield_rounds;
+	backoff->park_usec = (park_usec ? park_usec : 1);
+	backoff->round = 0;
+}
+
+void ftlh_backoff_wait(ftlh_backoff_t *backoff, ftlh_atomic32_t *loc, uint32_t expected)
+{
+	ftlh_atomic32_t dummy = 0;
+	uint32_t round = backoff->round;
+	uint64_t n = 0, park = 0;
+
+	if (backoff->round < UINT32_MAX) {
+		++backoff->round;
+	}
+
+	if (round < backoff->spin_rounds) {
+		for (n = (uint64_t)1 << round; n; --n) {
+#if defined(__x86_64__) || defined(__i386__)
+			__builtin_ia32_pause();
+#else
+			__asm__ __volatile__ ("" ::: "memory");
+#endif
+		}
+		return;
+	}
+	round -= backoff->spin_rounds;
+
+	if (round < backoff->yield_rounds) {
+#ifdef WIN32
+		SwitchToThread();
+#else
+		sched_yield();
+#endif
+		return;
+	}
+	round -= backoff->yield_rounds;
+
+	park = (round < 32 ? (uint64_t)1 << round : backoff->park_usec);
+	if (park > backoff->park_usec) {
+		park = backoff->park_usec;
+	}
+
+	/* Nobody ever notifies the dummy, so waiting on it is a plain sleep */
+	if (!loc) {
+		loc = &dummy;
+		expected = 0;
+	}
+	ftlh_atomic32_wait(loc, expected, park);
+}
+
+void ftlh_atomic_fence(void)
+{
+#ifdef WIN32
+	MemoryBarrier();
+#elif DARWIN
+	OSMemoryBarrier();
+#else
+	__sync_synchronize();
+#endif
+}
+
+uint_fast8_t ftlh_atomic_fence_heavy_init(void)
+{
+	uint32_t state = ftlh_atomic32_load_acquire(&ftlh_atomic_fence_asym);
+#if defined(__linux__) && defined(SYS_membarrier)
+	long cmds = 0;
+#endif
+
+	if (!state) {
+		state = 1;
+#if defined(__linux__) && defined(SYS_membarrier)
+		/* Racing threads all register; the kernel does not mind */
+		cmds = syscall(SYS_membarrier, MEMBARRIER_CMD_QUERY, 0);
+		if (cmds > 0 && (cmds & MEMBARRIER_CMD_PRIVATE_EXPEDITED) &&
+			!syscall(SYS_membarrier, MEMBARRIER_CMD_REGISTER_PRIVATE_EXPEDITED, 0)) {
+			state = 2;
+		}
+#endif
+		ftlh_atomic32_store_release(&ftlh_atomic_fence_asym, state);
+	}
+	return (state == 2);
+}
+
+void ftlh_atomic_fence_heavy(void)
+{
+#if defined(__linux__) && defined(SYS_membarrier)
+	if (ftlh_atomic_fence_heavy_init() && !syscall(SYS_membarrier, MEMBARRIER_CMD_PRIVATE_EXPEDITED, 0)) {
+		return;
+	}
+#endif
+	ftlh_atomic_fence();
+}
 
 
 /* For Emacs:
@@ -75,6 +75,271 @@ FTLH_PUBLIC_FUNC void *ftlh_atomic_ptr_cas(ftlh_atomicptr_t *loc, void *old_valu
 FTLH_PUBLIC_FUNC uint32_t ftlh_atomic64_inc_high32(ftlh_atomic64_t *loc);
 FTLH_PUBLIC_FUNC uint32_t ftlh_atomic64_inc_low32(ftlh_atomic64_t *loc);
 
+FTLH_PUBLIC_FUNC void ftlh_atomic_fence(void);
+
+/*
+ * Asymmetric barrier pair for a hot path and a rarely taken one which must
+ * agree on a store-then-load order. The hot path uses
+ * ftlh_atomic_fence_light(), which is only a compiler barrier when it can be.
+ * The rare path uses ftlh_atomic_fence_heavy(): on Linux a membarrier()
+ * which runs a full barrier on every thread of the process. Where that is not
+ * available, both are full barriers.
+ *
+ * ftlh_atomic_fence_heavy_init() registers the process for membarrier();
+ * call it before the hot path first runs, or the light fence stays a full
+ * one until the first heavy fence. Returns 1 if the light fence is free.
+ */
+FTLH_PUBLIC_FUNC uint_fast8_t ftlh_atomic_fence_heavy_init(void);
+FTLH_PUBLIC_FUNC void ftlh_atomic_fence_heavy(void);
+
+/* 2 once ftlh_atomic_fence_light() may be a compiler barrier, 1 if it may not,
+ * 0 until ftlh_atomic_fence_heavy_init() has run */
+extern ftlh_atomic32_t ftlh_atomic_fence_asym;
+
+/*
+ * Blocks while *loc == expected, for at most timeout_usec (0 = no limit).
+ * Returns 0 on timeout, else 1. Wakeups may be spurious, so callers must
+ * re-check their condition. On Linux this parks the thread on a futex.
+ * Elsewhere it falls back to a short sleep.
+ */
+FTLH_PUBLIC_FUNC uint_fast8_t ftlh_atomic32_wait(ftlh_atomic32_t *loc, uint32_t expected, uint_fast64_t timeout_usec);
+/* Wakes one / every thread blocked in ftlh_atomic32_wait() on loc. Call after changing *loc. */
+FTLH_PUBLIC_FUNC void ftlh_atomic32_notify_one(ftlh_atomic32_t *loc);
+FTLH_PUBLIC_FUNC void ftlh_atomic32_notify_all(ftlh_atomic32_t *loc);
+
+/*
+ * Backoff for retry loops. Each call to ftlh_backoff_wait() waits a bit
+ * longer than the last:
+ *   - spin_rounds rounds of 1, 2, 4, ... CPU pause instructions;
+ *   - then yield_rounds rounds of sched_yield();
+ *   - then parks for 1, 2, 4, ... usec, capped at park_usec.
+ * The park is on loc (see ftlh_atomic32_wait()), so a notify on loc ends it
+ * early. Pass a NULL loc to just sleep. A short wait never makes a syscall.
+ */
+typedef struct ftlh_backoff_s {
+	uint32_t spin_rounds;
+	uint32_t yield_rounds;
+	uint32_t park_usec;
+	uint32_t round;            /* Waits so far */
+} ftlh_backoff_t;
+
+/* sched_yield() is off by default: with more threads than CPUs, yielding
+ * producers mostly hand the CPU to each other instead of to the thread they
+ * are waiting for. Short parks do not have that problem. */
+#define FTLH_BACKOFF_SPIN_ROUNDS 6
+#define FTLH_BACKOFF_YIELD_ROUNDS 0
+#define FTLH_BACKOFF_PARK_USEC 32
+
+/* Uses the library wide thresholds, see ftlh_backoff_set_defaults() */
+FTLH_PUBLIC_FUNC void ftlh_backoff_init(ftlh_backoff_t *backoff);
+FTLH_PUBLIC_FUNC void ftlh_backoff_init_custom(ftlh_backoff_t *backoff, uint32_t spin_rounds, uint32_t yield_rounds, uint32_t park_usec);
+/* Changes the thresholds used by ftlh_backoff_init() and every retry loop in the library */
+FTLH_PUBLIC_FUNC void ftlh_backoff_set_defaults(uint32_t spin_rounds, uint32_t yield_rounds, uint32_t park_usec);
+FTLH_PUBLIC_FUNC void ftlh_backoff_wait(ftlh_backoff_t *backoff, ftlh_atomic32_t *loc, uint32_t expected);
+
+static inline __attribute__ ((always_inline, unused)) void ftlh_backoff_reset(ftlh_backoff_t *backoff)
+{
+	backoff->round = 0;
+}
+
+
+/*
+ * Double-width operations. A 128-bit value is updated as one unit: with
+ * cmpxchg16b where the CPU has it, otherwise under one of a set of striped
+ * spinlocks. Every 128-bit location must only ever be accessed through these
+ * functions, so both paths see each other's updates.
+ */
+typedef struct ftlh_atomic128_s {
+	uint64_t lo;
+	uint64_t hi;
+} __attribute__ ((aligned(16))) ftlh_atomic128_t;
+
+/* Returns 1 if the 128-bit operations are lock free on this CPU */
+FTLH_PUBLIC_FUNC uint_fast8_t ftlh_atomic128_lock_free(void);
+FTLH_PUBLIC_FUNC ftlh_atomic128_t ftlh_atomic128_get(ftlh_atomic128_t *loc);
+FTLH_PUBLIC_FUNC void ftlh_atomic128_set(ftlh_atomic128_t *loc, ftlh_atomic128_t value);
+/* On failure, expected is updated to the current value */
+FTLH_PUBLIC_FUNC uint_fast8_t ftlh_atomic128_cas(ftlh_atomic128_t *loc, ftlh_atomic128_t *expected, ftlh_atomic128_t desired);
+
+/*
+ * A pointer paired with a version tag which changes on every successful swap, so
+ * a CAS fails if the pointer was changed and changed back in the meantime (the
+ * ABA problem). This is what makes it safe to reuse memory in lock-free lists.
+ */
+typedef ftlh_atomic128_t ftlh_tagged_ptr_t;
+
+static inline __attribute__ ((always_inline, unused)) ftlh_tagged_ptr_t ftlh_tagged_ptr_make(void *ptr, uint64_t tag)
+{
+	ftlh_tagged_ptr_t value = { (uint64_t)(uintptr_t)ptr, tag };
+	return value;
+}
+
+static inline __attribute__ ((always_inline, unused)) void *ftlh_tagged_ptr_ptr(ftlh_tagged_ptr_t value)
+{
+	return (void *)(uintptr_t)value.lo;
+}
+
+static inline __attribute__ ((always_inline, unused)) uint64_t ftlh_tagged_ptr_tag(ftlh_tagged_ptr_t value)
+{
+	return value.hi;
+}
+
+/* Swaps in new_ptr with the next tag if loc still holds expected */
+FTLH_PUBLIC_FUNC uint_fast8_t ftlh_tagged_ptr_cas(ftlh_tagged_ptr_t *loc, ftlh_tagged_ptr_t expected, void *new_ptr);
+
+
+/*
+ * Inline operations with an explicit memory order. The functions above are full
+ * barriers implemented out of line; these compile down to the instruction the
+ * order needs, so a relaxed or acquire load is a plain load again and a release
+ * store is a plain store on x86.
+ *
+ * For every ftlh_atomic32_, ftlh_atomic64_ and ftlh_atomic_ptr_ prefix there is:
+ *
+ *   load_{relaxed,acquire,seq_cst}(loc)
+ *   store_{relaxed,release,seq_cst}(loc, value)
+ *   exchange_{relaxed,acquire,release,seq_cst}(loc, value)    returns the old value
+ *   cas_{relaxed,acquire,release,seq_cst}(loc, expected, desired)    returns 1 on success
+ *
+ * and for the integer types also fetch_add_ and fetch_sub_ in the four RMW orders.
+ * On compilers without the __atomic builtins they fall back to the full barrier
+ * functions above.
+ */
+#if defined(__GNUC__) && !defined(WIN32) && !defined(DARWIN)
+
+#define FTLH_ATOMIC_INLINE static inline __attribute__ ((always_inline, unused))
+
+#define FTLH_ATOMIC_DEFINE_LOAD(prefix, loc_t, val_t, order, mo)		\
+	FTLH_ATOMIC_INLINE val_t prefix##_load_##order(loc_t *loc)			\
+	{ return __atomic_load_n(loc, mo); }
+
+#define FTLH_ATOMIC_DEFINE_STORE(prefix, loc_t, val_t, order, mo)		\
+	FTLH_ATOMIC_INLINE void prefix##_store_##order(loc_t *loc, val_t value) \
+	{ __atomic_store_n(loc, value, mo); }
+
+/* A failed CAS only reads, so it may not use a release order */
+#define FTLH_ATOMIC_DEFINE_RMW(prefix, loc_t, val_t, order, mo, fail_mo) \
+	FTLH_ATOMIC_INLINE val_t prefix##_exchange_##order(loc_t *loc, val_t value) \
+	{ return __atomic_exchange_n(loc, value, mo); }						\
+	FTLH_ATOMIC_INLINE uint_fast8_t prefix##_cas_##order(loc_t *loc, val_t expected, val_t desired) \
+	{ return __atomic_compare_exchange_n(loc, &expected, desired, 0, mo, fail_mo); }
+
+#define FTLH_ATOMIC_DEFINE_ARITH(prefix, loc_t, val_t, order, mo)		\
+	FTLH_ATOMIC_INLINE val_t prefix##_fetch_add_##order(loc_t *loc, val_t value) \
+	{ return __atomic_fetch_add(loc, value, mo); }						\
+	FTLH_ATOMIC_INLINE val_t prefix##_fetch_sub_##order(loc_t *loc, val_t value) \
+	{ return __atomic_fetch_sub(loc, value, mo); }
+
+#define FTLH_ATOMIC_DEFINE_ALL(prefix, loc_t, val_t)					\
+	FTLH_ATOMIC_DEFINE_LOAD(prefix, loc_t, val_t, relaxed, __ATOMIC_RELAXED) \
+	FTLH_ATOMIC_DEFINE_LOAD(prefix, loc_t, val_t, acquire, __ATOMIC_ACQUIRE) \
+	FTLH_ATOMIC_DEFINE_LOAD(prefix, loc_t, val_t, seq_cst, __ATOMIC_SEQ_CST) \
+	FTLH_ATOMIC_DEFINE_STORE(prefix, loc_t, val_t, relaxed, __ATOMIC_RELAXED) \
+	FTLH_ATOMIC_DEFINE_STORE(prefix, loc_t, val_t, release, __ATOMIC_RELEASE) \
+	FTLH_ATOMIC_DEFINE_STORE(prefix, loc_t, val_t, seq_cst, __ATOMIC_SEQ_CST) \
+	FTLH_ATOMIC_DEFINE_RMW(prefix, loc_t, val_t, relaxed, __ATOMIC_RELAXED, __ATOMIC_RELAXED) \
+	FTLH_ATOMIC_DEFINE_RMW(prefix, loc_t, val_t, acquire, __ATOMIC_ACQUIRE, __ATOMIC_ACQUIRE) \
+	FTLH_ATOMIC_DEFINE_RMW(prefix, loc_t, val_t, release, __ATOMIC_RELEASE, __ATOMIC_RELAXED) \
+	FTLH_ATOMIC_DEFINE_RMW(prefix, loc_t, val_t, seq_cst, __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST)
+
+#define FTLH_ATOMIC_DEFINE_ALL_ARITH(prefix, loc_t, val_t)				\
+	FTLH_ATOMIC_DEFINE_ARITH(prefix, loc_t, val_t, relaxed, __ATOMIC_RELAXED) \
+	FTLH_ATOMIC_DEFINE_ARITH(prefix, loc_t, val_t, acquire, __ATOMIC_ACQUIRE) \
+	FTLH_ATOMIC_DEFINE_ARITH(prefix, loc_t, val_t, release, __ATOMIC_RELEASE) \
+	FTLH_ATOMIC_DEFINE_ARITH(prefix, loc_t, val_t, seq_cst, __ATOMIC_SEQ_CST)
+
+FTLH_ATOMIC_DEFINE_ALL(ftlh_atomic32, ftlh_atomic32_t, uint32_t)
+FTLH_ATOMIC_DEFINE_ALL(ftlh_atomic64, ftlh_atomic64_t, uint64_t)
+FTLH_ATOMIC_DEFINE_ALL(ftlh_atomic_ptr, ftlh_atomicptr_t, void *)
+FTLH_ATOMIC_DEFINE_ALL_ARITH(ftlh_atomic32, ftlh_atomic32_t, uint32_t)
+FTLH_ATOMIC_DEFINE_ALL_ARITH(ftlh_atomic64, ftlh_atomic64_t, uint64_t)
+
+/* Orders the memory operations around it without touching memory itself */
+#define ftlh_atomic_fence_acquire() __atomic_thread_fence(__ATOMIC_ACQUIRE)
+#define ftlh_atomic_fence_release() __atomic_thread_fence(__ATOMIC_RELEASE)
+#define ftlh_atomic_fence_seq_cst() __atomic_thread_fence(__ATOMIC_SEQ_CST)
+
+#define ftlh_atomic_fence_light()										\
+	do {																\
+		if (__builtin_expect(__atomic_load_n(&ftlh_atomic_fence_asym, __ATOMIC_RELAXED) == 2, 1)) { \
+			__atomic_signal_fence(__ATOMIC_SEQ_CST);					\
+		} else {														\
+			__atomic_thread_fence(__ATOMIC_SEQ_CST);					\
+		}																\
+	} while (0)
+
+#else /* Every order becomes a full barrier */
+
+#define ftlh_atomic32_load_relaxed(loc) ftlh_atomic32_get(loc)
+#define ftlh_atomic32_load_acquire(loc) ftlh_atomic32_get(loc)
+#define ftlh_atomic32_load_seq_cst(loc) ftlh_atomic32_get(loc)
+#define ftlh_atomic64_load_relaxed(loc) ftlh_atomic64_get(loc)
+#define ftlh_atomic64_load_acquire(loc) ftlh_atomic64_get(loc)
+#define ftlh_atomic64_load_seq_cst(loc) ftlh_atomic64_get(loc)
+#define ftlh_atomic_ptr_load_relaxed(loc) ftlh_atomic_ptr_get(loc)
+#define ftlh_atomic_ptr_load_acquire(loc) ftlh_atomic_ptr_get(loc)
+#define ftlh_atomic_ptr_load_seq_cst(loc) ftlh_atomic_ptr_get(loc)
+
+#define ftlh_atomic32_store_relaxed(loc, v) ((void)ftlh_atomic32_set(loc, v))
+#define ftlh_atomic32_store_release(loc, v) ((void)ftlh_atomic32_set(loc, v))
+#define ftlh_atomic32_store_seq_cst(loc, v) ((void)ftlh_atomic32_set(loc, v))
+#define ftlh_atomic64_store_relaxed(loc, v) ((void)ftlh_atomic64_set(loc, v))
+#define ftlh_atomic64_store_release(loc, v) ((void)ftlh_atomic64_set(loc, v))
+#define ftlh_atomic64_store_seq_cst(loc, v) ((void)ftlh_atomic64_set(loc, v))
+#define ftlh_atomic_ptr_store_relaxed(loc, v) ((void)ftlh_atomic_ptr_set(loc, v))
+#define ftlh_atomic_ptr_store_release(loc, v) ((void)ftlh_atomic_ptr_set(loc, v))
+#define ftlh_atomic_ptr_store_seq_cst(loc, v) ((void)ftlh_atomic_ptr_set(loc, v))
+
+#define ftlh_atomic32_exchange_relaxed(loc, v) ftlh_atomic32_set(loc, v)
+#define ftlh_atomic32_exchange_acquire(loc, v) ftlh_atomic32_set(loc, v)
+#define ftlh_atomic32_exchange_release(loc, v) ftlh_atomic32_set(loc, v)
+#define ftlh_atomic32_exchange_seq_cst(loc, v) ftlh_atomic32_set(loc, v)
+#define ftlh_atomic64_exchange_relaxed(loc, v) ftlh_atomic64_set(loc, v)
+#define ftlh_atomic64_exchange_acquire(loc, v) ftlh_atomic64_set(loc, v)
+#define ftlh_atomic64_exchange_release(loc, v) ftlh_atomic64_set(loc, v)
+#define ftlh_atomic64_exchange_seq_cst(loc, v) ftlh_atomic64_set(loc, v)
+#define ftlh_atomic_ptr_exchange_relaxed(loc, v) ftlh_atomic_ptr_set(loc, v)
+#define ftlh_atomic_ptr_exchange_acquire(loc, v) ftlh_atomic_ptr_set(loc, v)
+#define ftlh_atomic_ptr_exchange_release(loc, v) ftlh_atomic_ptr_set(loc, v)
+#define ftlh_atomic_ptr_exchange_seq_cst(loc, v) ftlh_atomic_ptr_set(loc, v)
+
+#define ftlh_atomic32_cas_relaxed(loc, e, d) ftlh_atomic32_bool_cas(loc, e, d)
+#define ftlh_atomic32_cas_acquire(loc, e, d) ftlh_atomic32_bool_cas(loc, e, d)
+#define ftlh_atomic32_cas_release(loc, e, d) ftlh_atomic32_bool_cas(loc, e, d)
+#define ftlh_atomic32_cas_seq_cst(loc, e, d) ftlh_atomic32_bool_cas(loc, e, d)
+#define ftlh_atomic64_cas_relaxed(loc, e, d) ftlh_atomic64_bool_cas(loc, e, d)
+#define ftlh_atomic64_cas_acquire(loc, e, d) ftlh_atomic64_bool_cas(loc, e, d)
+#define ftlh_atomic64_cas_release(loc, e, d) ftlh_atomic64_bool_cas(loc, e, d)
+#define ftlh_atomic64_cas_seq_cst(loc, e, d) ftlh_atomic64_bool_cas(loc, e, d)
+#define ftlh_atomic_ptr_cas_relaxed(loc, e, d) (ftlh_atomic_ptr_cas(loc, e, d) == (e))
+#define ftlh_atomic_ptr_cas_acquire(loc, e, d) (ftlh_atomic_ptr_cas(loc, e, d) == (e))
+#define ftlh_atomic_ptr_cas_release(loc, e, d) (ftlh_atomic_ptr_cas(loc, e, d) == (e))
+#define ftlh_atomic_ptr_cas_seq_cst(loc, e, d) (ftlh_atomic_ptr_cas(loc, e, d) == (e))
+
+#define ftlh_atomic32_fetch_add_relaxed(loc, v) ftlh_atomic32_fetch_and_add(loc, v)
+#define ftlh_atomic32_fetch_add_acquire(loc, v) ftlh_atomic32_fetch_and_add(loc, v)
+#define ftlh_atomic32_fetch_add_release(loc, v) ftlh_atomic32_fetch_and_add(loc, v)
+#define ftlh_atomic32_fetch_add_seq_cst(loc, v) ftlh_atomic32_fetch_and_add(loc, v)
+#define ftlh_atomic32_fetch_sub_relaxed(loc, v) ftlh_atomic32_fetch_and_sub(loc, v)
+#define ftlh_atomic32_fetch_sub_acquire(loc, v) ftlh_atomic32_fetch_and_sub(loc, v)
+#define ftlh_atomic32_fetch_sub_release(loc, v) ftlh_atomic32_fetch_and_sub(loc, v)
+#define ftlh_atomic32_fetch_sub_seq_cst(loc, v) ftlh_atomic32_fetch_and_sub(loc, v)
+#define ftlh_atomic64_fetch_add_relaxed(loc, v) ftlh_atomic64_fetch_and_add(loc, v)
+#define ftlh_atomic64_fetch_add_acquire(loc, v) ftlh_atomic64_fetch_and_add(loc, v)
+#define ftlh_atomic64_fetch_add_release(loc, v) ftlh_atomic64_fetch_and_add(loc, v)
+#define ftlh_atomic64_fetch_add_seq_cst(loc, v) ftlh_atomic64_fetch_and_add(loc, v)
+#define ftlh_atomic64_fetch_sub_relaxed(loc, v) ftlh_atomic64_fetch_and_sub(loc, v)
+#define ftlh_atomic64_fetch_sub_acquire(loc, v) ftlh_atomic64_fetch_and_sub(loc, v)
+#define ftlh_atomic64_fetch_sub_release(loc, v) ftlh_atomic64_fetch_and_sub(loc, v)
+#define ftlh_atomic64_fetch_sub_seq_cst(loc, v) ftlh_atomic64_fetch_and_sub(loc, v)
+
+#define ftlh_atomic_fence_acquire() ftlh_atomic_fence()
+#define ftlh_atomic_fence_release() ftlh_atomic_fence()
+#define ftlh_atomic_fence_seq_cst() ftlh_atomic_fence()
+#define ftlh_atomic_fence_light() ftlh_atomic_fence()
+
+#endif
+
 
 /** @} */
 #endif
@@ -0,0 +1,230 @@
+/*
+ * The Initial Developer of the Original Code is
+ * Eliot Gable <egable@gmail.com>
+ * Portions created by the Initial Developer are Copyright (C)
+ * the Initial Developer. All Rights Reserved.
+ *
+ * Contributor(s):
+ *
+ * Eliot Gable <egable@gmail.com>
+ *
+ * ftlh_hash.c -- Built-in Key Hash Functions
+ *
+ *
+ */
+
+#include <ftlh.h>
+#include <string.h>
+
+#if defined(__x86_64__)
+#include <cpuid.h>
+#include <nmmintrin.h>
+#endif
+
+/* 2 if the CPU has the SSE4.2 crc32 instruction, 1 if not, 0 until checked */
+static ftlh_atomic32_t ftlh_hash_sse42 = 0;
+
+/* The function ftlh_hash_best() settled on, NULL until first asked */
+static ftlh_atomicptr_t ftlh_hash_best_func = NULL;
+
+
+static inline __attribute__ ((always_inline)) uint64_t ftlh_hash_read64(const uint8_t *p)
+{
+	uint64_t v = 0;
+
+	memcpy(&v, p, sizeof(v));
+	return v;
+}
+
+static inline __attribute__ ((always_inline)) uint64_t ftlh_hash_read32(const uint8_t *p)
+{
+	uint32_t v = 0;
+
+	memcpy(&v, p, sizeof(v));
+	return v;
+}
+
+/* MurmurHash3's 64-bit finalizer */
+static inline __attribute__ ((always_inline)) uint64_t ftlh_hash_fmix64(uint64_t h)
+{
+	h ^= h >> 33;
+	h *= UINT64_C(0xff51afd7ed558ccd);
+	h ^= h >> 33;
+	h *= UINT64_C(0xc4ceb53fe1a85363);
+	h ^= h >> 33;
+	return h;
+}
+
+static inline __attribute__ ((always_inline)) uint_fast8_t ftlh_hash_have_sse42(void)
+{
+	uint32_t state = ftlh_atomic32_load_relaxed(&ftlh_hash_sse42);
+#if defined(__x86_64__)
+	unsigned int eax = 0, ebx = 0, ecx = 0, edx = 0;
+#endif
+
+	if (!state) {
+		state = 1;
+#if defined(__x86_64__)
+		if (__get_cpuid(1, &eax, &ebx, &ecx, &edx) && (ecx & bit_SSE4_2)) {
+			state = 2;
+		}
+#endif
+		ftlh_atomic32_store_relaxed(&ftlh_hash_sse42, state);
+	}
+	return (state == 2);
+}
+
+ftlh_hash_t ftlh_hash_city(const void *loc, size_t len)
+{
+	return CityHash64((const char *)loc, len);
+}
+
+/**************************************************
+ * wyhash
+ *************************************************/
+
+#define FTLH_WY_P0 UINT64_C(0xa0761d6478bd642f)
+#define FTLH_WY_P1 UINT64_C(0xe7037ed1a0b428db)
+#define FTLH_WY_P2 UINT64_C(0x8ebc6af09c88c6e3)
+#define FTLH_WY_P3 UINT64_C(0x589965cc75374cc3)
+
+/* 64x64 -> 128 bit multiply, folded back to 64 bits */
+static inline __attribute__ ((always_inline)) uint64_t ftlh_wy_mix(uint64_t a, uint64_t b)
+{
+	__uint128_t r = (__uint128_t)a * b;
+
+	return (uint64_t)r ^ (uint64_t)(r >> 64);
+}
+
+ftlh_hash_t ftlh_hash_wy(const void *loc, size_t len)
+{
+	const uint8_t *p = (const uint8_t *)loc;
+	uint64_t seed = ftlh_wy_mix(FTLH_WY_P0, FTLH_WY_P1), see1 = 0, see2 = 0, a = 0, b = 0;
+	size_t i = len;
+	__uint128_t r = 0;
+
+	if (len <= 16) {
+		if (len >= 4) {
+			a = (ftlh_hash_read32(p) << 32) | ftlh_hash_read32(p + ((len >> 3) << 2));
+			b = (ftlh_hash_read32(p + len - 4) << 32) | ftlh_hash_read32(p + len - 4 - ((len >> 3) << 2));
+		} else if (len > 0) {
+			a = ((uint64_t)p[0] << 16) | ((uint64_t)p[len >> 1] << 8) | p[len - 1];
+		}
+	} else {
+		if (i > 48) {
+			see1 = seed;
+			see2 = seed;
+			do {
+				seed = ftlh_wy_mix(ftlh_hash_read64(p) ^ FTLH_WY_P1, ftlh_hash_read64(p + 8) ^ seed);
+				see1 = ftlh_wy_mix(ftlh_hash_read64(p + 16) ^ FTLH_WY_P2, ftlh_hash_read64(p + 24) ^ see1);
+				see2 = ftlh_wy_mix(ftlh_hash_read64(p + 32) ^ FTLH_WY_P3, ftlh_hash_read64(p + 40) ^ see2);
+				p += 48;
+				i -= 48;
+			} while (i > 48);
+			seed ^= see1 ^ see2;
+		}
+		while (i > 16) {
+			seed = ftlh_wy_mix(ftlh_hash_read64(p) ^ FTLH_WY_P1, ftlh_hash_read64(p + 8) ^ seed);
+			i -= 16;
+			p += 16;
+		}
+		a = ftlh_hash_read64(p + i - 16);
+		b = ftlh_hash_read64(p + i - 8);
+	}
+
+	a ^= FTLH_WY_P1;
+	b ^= seed;
+	r = (__uint128_t)a * b;
+	a = (uint64_t)r;
+	b = (uint64_t)(r >> 64);
+
+	return ftlh_wy_mix(a ^ FTLH_WY_P0 ^ len, b ^ FTLH_WY_P1);
+}
+
+/**************************************************
+ * CRC32C
+ *************************************************/
+
+#define FTLH_CRC32C_POLY 0x82f63b78
+
+/* Bit at a time; only used when the CPU has no crc32 instruction */
+static uint32_t ftlh_crc32c_soft(uint32_t crc, const uint8_t *p, size_t len)
+{
+	uint_fast8_t bit = 0;
+
+	while (len--) {
+		crc ^= *p++;
+		for (bit = 0; bit < 8; ++bit) {
+			crc = (crc >> 1) ^ (FTLH_CRC32C_POLY & (0 - (crc & 1)));
+		}
+	}
+	return crc;
+}
+
+#if defined(__x86_64__)
+static __attribute__ ((target("sse4.2"))) uint32_t ftlh_crc32c_sse42(uint32_t crc, const uint8_t *p, size_t len)
+{
+	uint64_t crc64 = crc;
+
+	for (; len >= 8; len -= 8, p += 8) {
+		crc64 = _mm_crc32_u64(crc64, ftlh_hash_read64(p));
+	}
+	crc = (uint32_t)crc64;
+	if (len >= 4) {
+		crc = _mm_crc32_u32(crc, (uint32_t)ftlh_hash_read32(p));
+		len -= 4;
+		p += 4;
+	}
+	while (len--) {
+		crc = _mm_crc32_u8(crc, *p++);
+	}
+	return crc;
+}
+#endif
+
+ftlh_hash_t ftlh_hash_crc32c(const void *loc, size_t len)
+{
+	uint32_t crc = 0;
+
+#if defined(__x86_64__)
+	if (ftlh_hash_have_sse42()) {
+		crc = ~ftlh_crc32c_sse42(~(uint32_t)0, (const uint8_t *)loc, len);
+	} else
+#endif
+	{
+		crc = ~ftlh_crc32c_soft(~(uint32_t)0, (const uint8_t *)loc, len);
+	}
+
+	/* A CRC is only 32 bits and linear; the finalizer spreads it, and the length,
+	 * over all 64 bits so the partition bits at the top are as good as the slot
+	 * bits at the bottom */
+	return ftlh_hash_fmix64(((uint64_t)len << 32) | crc);
+}
+
+ftlh_hash_func_t ftlh_hash_best(void)
+{
+	ftlh_hash_func_t func = ftlh_atomic_ptr_load_acquire(&ftlh_hash_best_func);
+
+	if (func) {
+		return func;
+	}
+
+	/* Every thread which races here picks the same function */
+	func = (ftlh_hash_have_sse42() ? ftlh_hash_crc32c : ftlh_hash_wy);
+	ftlh_atomic_ptr_store_release(&ftlh_hash_best_func, func);
+
+	return func;
+}
+
+
+
+/* For Emacs:
+ * Local Variables:
+ * mode:c
+ * indent-tabs-mode:t
+ * tab-width:4
+ * c-basic-offset:4
+ * End:
+ * For VIM:
+ * vim:set softtabstop=4 shiftwidth=4 tabstop=4 noet:
+ */
@@ -1,4 +1,3 @@
-
 #ifndef FTLH_PRIVATE_H
 #define FTLH_PRIVATE_H
 
@@ -7,30 +6,320 @@
 
 #define ftlh_safe_free(ptr) do { if(ptr) { free(ptr); ptr = NULL; } } while(0)
 
+#define FTLH_CACHE_LINE 64
+
+/* Slot arrays never drop below this many slots */
+#define FTLH_MIN_SLOTS 16
+
+/* Grow (or purge tombstones) once used slots exceed NUM/DEN of capacity */
+#define FTLH_MAX_LOAD_NUM 3
+#define FTLH_MAX_LOAD_DEN 4
+
+/* Depth of the per-table request queue feeding the worker */
+#define FTLH_REQUEST_QUEUE_SIZE 1024
+
+/* Tell the CPU we are busy waiting */
+#if defined(__x86_64__) || defined(__i386__)
+#define ftlh_cpu_relax() __builtin_ia32_pause()
+#else
+#define ftlh_cpu_relax() __asm__ __volatile__ ("" ::: "memory")
+#endif
+
+/* Most requests a worker applies to one table before moving on to the next */
+#define FTLH_SERVICE_BATCH 256
+
+/* Queue depth at which a table's backlog is worth waking an idle peer for */
+#define FTLH_STEAL_DEPTH 64
+
+/* How long an idle worker parks when retired memory is waiting to be freed */
+#define FTLH_RECLAIM_PARK_USEC 10000
+
+/* Marks a slot whose key was removed. Probes must continue past it. */
+#define FTLH_SLOT_TOMBSTONE ((void *)(uintptr_t)1)
+
+/* A key is one allocation with its bytes stored right after the header. Keys of
+ * up to FTLH_KEY_INLINE_MAX bytes are given exactly one aligned cache line, so a
+ * comparison touches a single line; longer keys are sized to fit. */
 struct ftlh_key_s {
 	size_t len;
-	char *str;
+	ftlh_hash_t hash;          /* hash_func() of str, computed once by the builder */
+	ftlh_hash_func_t hash_func; /* Which function made hash; a table with another
+	                            * one rehashes the key once when it takes it */
 	ftlh_hash_table_t owner;
+	char str[];                /* len bytes plus a trailing NUL */
 };
 
+/* Longest key which fits in one cache line together with its header and NUL */
+#define FTLH_KEY_INLINE_MAX (FTLH_CACHE_LINE - offsetof(struct ftlh_key_s, str) - 1)
+
+/* Each node carries a sequence number which says whose turn it is. A node at
+ * index i starts at seq i. The producer for position pos may fill it once seq
+ * == pos and then sets seq to pos + 1; the consumer for pos may empty it once
+ * seq == pos + 1 and then sets seq to pos + size, handing it to the producer
+ * one lap later.
+ */
 struct ftlh_queue_node_s {
+	ftlh_atomic64_t seq;
 	ftlh_atomicptr_t data;
 } __attribute__ ((aligned));
 
+/* Producers and consumers each hammer their own position, so each position gets
+ * a cache line to itself. The fields every operation reads but nobody writes
+ * after creation share the first line.
+ */
 struct ftlh_queue_s {
 	struct ftlh_queue_node_s *nodes; /* The nodes for the queue, aligned */
-
-	ftlh_atomic64_t prod_pos;
-	ftlh_atomic64_t cons_pos;
 	ftlh_atomic64_t size;      /* Size of the queue in nodes */
-	ftlh_atomic64_t items;     /* Number of items in the queue, approximately. */
-} __attribute__ ((aligned));
+	uint64_t mask;             /* size - 1 if size is a power of two, else 0 */
+	uint64_t node_shift;       /* log2 of the bytes between nodes */
+	ftlh_queue_watermark_func_t watermark_func; /* NULL when no watermarks are set */
+	void *watermark_data;
+	uint64_t high_mark;        /* Items at which watermark_func(queue, 1) runs */
+	uint64_t low_mark;         /* Items at which watermark_func(queue, 0) runs */
+	uint64_t elem_size;        /* Payload bytes per node, 0 for pointer queues */
+
+	ftlh_atomic64_t prod_pos __attribute__ ((aligned(FTLH_CACHE_LINE)));  /* Next position to fill; only ever increases */
+	ftlh_atomic64_t prod_cached_cons; /* A recent cons_pos, for enqueue's return value */
+	ftlh_atomic64_t cons_pos __attribute__ ((aligned(FTLH_CACHE_LINE)));  /* Next position to empty; only ever increases */
+
+	/* Consumers parked in ftlh_queue_dequeue_wait() count themselves in waiters
+	 * and sleep on signal. Producers only touch signal while waiters is set. */
+	ftlh_atomic32_t waiters __attribute__ ((aligned(FTLH_CACHE_LINE)));
+	ftlh_atomic32_t signal;
+	ftlh_atomic32_t above_high; /* Set from the high watermark until the low one */
+} __attribute__ ((aligned(FTLH_CACHE_LINE)));
+
+/* Producers re-read cons_pos into prod_cached_cons once per this many positions */
+#define FTLH_QUEUE_COUNT_REFRESH 64
+
+/* log2 of sizeof(struct ftlh_queue_node_s) and of FTLH_CACHE_LINE */
+#define FTLH_QUEUE_NODE_SHIFT 4
+#define FTLH_QUEUE_PADDED_NODE_SHIFT 6
+
+/* Positions only ever increase; the node for pos is nodes[pos & mask]. Each side
+ * owns the line with its position and its cached copy of the other side's. */
+struct ftlh_spsc_queue_s {
+	ftlh_atomicptr_t *nodes;
+	uint64_t size;             /* Always a power of two */
+	uint64_t mask;             /* size - 1 */
+
+	ftlh_atomic64_t prod_pos __attribute__ ((aligned(FTLH_CACHE_LINE)));  /* Next position to fill */
+	uint64_t prod_cached_cons; /* Last cons_pos the producer read */
+
+	ftlh_atomic64_t cons_pos __attribute__ ((aligned(FTLH_CACHE_LINE)));  /* Next position to empty */
+	uint64_t cons_cached_prod; /* Last prod_pos the consumer read */
+} __attribute__ ((aligned(FTLH_CACHE_LINE)));
+
+/* A consumer of a broadcast ring. Only its own thread moves the cursor. It may
+ * read position pos once the node is published and every dependency's cursor is
+ * past pos, i.e. every stage it depends on is done with the item. */
+struct ftlh_ring_consumer_s {
+	ftlh_atomic64_t cursor __attribute__ ((aligned(FTLH_CACHE_LINE))); /* Next position to read */
+	uint64_t dep_cached;       /* Lowest dependency cursor seen last time */
+	uint64_t dep_count;
+	struct ftlh_ring_consumer_s **deps;
+	struct ftlh_ring_s *ring;
+} __attribute__ ((aligned(FTLH_CACHE_LINE)));
+
+/* Most consumers one broadcast ring can have */
+#define FTLH_RING_MAX_CONSUMERS 32
+
+/* A broadcast ring. It reuses the ftlh_queue node layout: node pos & mask holds
+ * the item for pos once its seq reads pos + 1. Producers claim positions like
+ * ftlh_queue does, but a node is only free again once every consumer's cursor
+ * has moved past it. */
+struct ftlh_ring_s {
+	struct ftlh_queue_node_s *nodes;
+	uint64_t size;             /* Always a power of two */
+	uint64_t mask;             /* size - 1 */
+	uint64_t consumer_count;
+	struct ftlh_ring_consumer_s *consumers[FTLH_RING_MAX_CONSUMERS];
+
+	ftlh_atomic64_t prod_pos __attribute__ ((aligned(FTLH_CACHE_LINE))); /* Next position to claim */
+	ftlh_atomic64_t gate_cached; /* Slowest consumer cursor seen by a producer */
+} __attribute__ ((aligned(FTLH_CACHE_LINE)));
+
+/* States of ftlh_segment_node_s.state */
+#define FTLH_SEG_NODE_EMPTY 0
+#define FTLH_SEG_NODE_FULL  1
+#define FTLH_SEG_NODE_TAKEN 2  /* Emptied, or given up on by a consumer who got there first */
+
+struct ftlh_segment_node_s {
+	ftlh_atomicptr_t data;
+	ftlh_atomic64_t state;
+};
+
+/* One segment of an unbounded queue. Every node is used once: producers and
+ * consumers each fetch-and-add their index, and once the producer index runs
+ * past the end the segment is closed and the next one takes over. A consumer
+ * which reaches a node before its producer marks it taken, and the producer
+ * retries further on. Drained segments are retired through the epoch code and
+ * then go back to the owner's pool.
+ */
+struct ftlh_queue_segment_s {
+	ftlh_atomic64_t enq_idx __attribute__ ((aligned(FTLH_CACHE_LINE)));
+	ftlh_atomic64_t deq_idx __attribute__ ((aligned(FTLH_CACHE_LINE)));
+	ftlh_atomicptr_t next __attribute__ ((aligned(FTLH_CACHE_LINE)));
+	ftlh_atomicptr_t pool_next; /* Next free segment while in the pool */
+	struct ftlh_unbounded_queue_s *owner;
+	struct ftlh_segment_node_s nodes[] __attribute__ ((aligned(FTLH_CACHE_LINE)));
+};
+
+/* Drained segments kept for reuse per queue; any beyond this are freed */
+#define FTLH_SEGMENT_POOL_MAX 4
+
+struct ftlh_unbounded_queue_s {
+	uint64_t segment_size;     /* Nodes per segment */
+	ftlh_atomicptr_t head __attribute__ ((aligned(FTLH_CACHE_LINE)));  /* Segment consumers take from */
+	ftlh_atomicptr_t tail __attribute__ ((aligned(FTLH_CACHE_LINE)));  /* Segment producers fill */
+	ftlh_atomic64_t items __attribute__ ((aligned(FTLH_CACHE_LINE)));  /* Approximate */
+	ftlh_tagged_ptr_t pool;    /* Treiber stack of free segments */
+	ftlh_atomic64_t pool_count;
+	ftlh_atomic64_t segments;  /* Segments allocated and not yet freed */
+
+	/* One for the owner plus one per retired segment still waiting to come
+	 * back, so a destroy never frees the pool under a late recycle */
+	ftlh_atomic64_t refs;
+} __attribute__ ((aligned(FTLH_CACHE_LINE)));
+
+/* One open-addressing slot. Two slots share a cache line. The key pointer is the
+ * slot state: NULL means empty, FTLH_SLOT_TOMBSTONE means removed, anything else
+ * is a live key. The hash and value are always written before the key is
+ * published, so anyone who sees a live key also sees its hash and value.
+ */
+struct ftlh_slot_s {
+	ftlh_atomic64_t hash;
+	ftlh_atomicptr_t key;
+	ftlh_atomicptr_t value;
+} __attribute__ ((aligned(32)));
+
+struct ftlh_slot_array_s {
+	uint64_t capacity;         /* Number of slots, always a power of two */
+	uint64_t mask;             /* capacity - 1 */
+	struct ftlh_slot_s slots[] __attribute__ ((aligned(FTLH_CACHE_LINE)));
+};
+
+/* Slot keys which mark empty and removed slots in a u64 table. The real keys 0
+ * and ~0 live in ftlh_hash_table_s.u64_special instead. Removed slots are never
+ * refilled, only dropped by a rebuild, so a slot which held a key never holds
+ * another one and readers need no ABA protection. */
+#define FTLH_U64_EMPTY     ((uint64_t)0)
+#define FTLH_U64_TOMBSTONE (~(uint64_t)0)
+
+/* A u64 table slot: the key itself is the slot state, and four slots share a
+ * cache line. The value is always written before the key is published. */
+struct ftlh_u64_slot_s {
+	ftlh_atomic64_t key;
+	ftlh_atomicptr_t value;
+} __attribute__ ((aligned(16)));
+
+/* Same header as struct ftlh_slot_array_s, so the capacity and resize logic can
+ * look at either */
+struct ftlh_u64_slot_array_s {
+	uint64_t capacity;
+	uint64_t mask;
+	struct ftlh_u64_slot_s slots[] __attribute__ ((aligned(FTLH_CACHE_LINE)));
+};
+
+/* Holder for a key a u64 slot cannot hold; present is 0 or 1 */
+struct ftlh_u64_special_s {
+	ftlh_atomic64_t present;
+	ftlh_atomicptr_t value;
+};
+
+struct ftlh_hash_table_s {
+	ftlh_atomicptr_t slots;    /* struct ftlh_slot_array_s * (or ftlh_u64_slot_array_s *), swapped on resize */
+	ftlh_queue_t requests;     /* Write requests waiting for the worker */
+	struct ftlh_thread_status_s *worker; /* Worker which owns the table */
+	uint64_t id;               /* Index in ftlh_globals.tables */
+	ftlh_atomic32_t servicing; /* Set while a worker is applying requests */
+	ftlh_atomic64_t items;     /* Live keys */
+	ftlh_atomic64_t used;      /* Live keys plus tombstones */
+	ftlh_hash_func_t hash_func; /* Hashes every key in the table; NULL for u64 tables */
+
+	/* A partitioned table has no slots, queue or worker of its own. It routes
+	 * each key to parts[hash >> (64 - part_bits)]; each part points back to it. */
+	uint_fast8_t part_bits;
+	struct ftlh_hash_table_s **parts;
+	struct ftlh_hash_table_s *parent;
+
+	/* Set for tables made by ftlh_hash_table_create_u64*(), which take plain
+	 * 64-bit keys: keys 0 and ~0 are u64_special[0] and [1] */
+	uint_fast8_t u64;
+	struct ftlh_u64_special_s u64_special[2];
+} __attribute__ ((aligned(FTLH_CACHE_LINE)));
+
+enum ftlh_op_e {
+	FTLH_OP_INSERT = 1,
+	FTLH_OP_REPLACE,
+	FTLH_OP_REMOVE,
+	FTLH_OP_DESTROY
+};
+
+/* Copy-on-write list of the tables a worker owns. Replaced wholesale on table
+ * create / destroy; the old list is retired through the epoch code. */
+struct ftlh_table_list_s {
+	uint64_t count;
+	struct ftlh_hash_table_s *tables[];
+};
+
+/* States of ftlh_request_s.done */
+#define FTLH_REQ_PENDING 0
+#define FTLH_REQ_WAITING 1  /* The caller is parked on done */
+#define FTLH_REQ_DONE    2
+
+/* A write operation handed to a worker. Synchronous callers keep the request on
+ * their stack and wait for done to become FTLH_REQ_DONE. Asynchronous requests
+ * come from the request pool and go back to it once the callback has run.
+ */
+struct ftlh_request_s {
+	uint_fast8_t op;
+	uint_fast8_t async;
+	uint_fast8_t status;
+	ftlh_key_t key;
+	const ftlh_key_view_t *view; /* Set instead of key by the synchronous *_view calls */
+	uint64_t u64_key;          /* The key of a request to a u64 table */
+	void *value;
+	void *result;
+	ftlh_status_func_t cb;
+	ftlh_atomic32_t done;
+	ftlh_atomicptr_t next;     /* Next free request while in the pool */
+};
+
+/* Most free requests kept in the pool; any beyond this go back to the heap */
+#define FTLH_REQUEST_POOL_MAX 4096
+
+/* Per-thread epoch record for lock-free readers. A reader publishes the global
+ * epoch it started in; 0 means the thread is not inside a read section. Records
+ * are never freed; a thread that exits hands its record to the next new thread.
+ */
+struct ftlh_epoch_rec_s {
+	ftlh_atomic64_t epoch;
+	ftlh_atomic64_t in_use;
+	struct ftlh_epoch_rec_s *next;
+} __attribute__ ((aligned(FTLH_CACHE_LINE)));
+
+/* Memory which was unlinked while readers might still see it. It is freed once
+ * every reader has moved past the epoch it was retired in.
+ */
+struct ftlh_retired_s {
+	void *ptr;
+	void (*free_func)(void *);
+	uint64_t epoch;
+	struct ftlh_retired_s *next;
+};
 
 struct ftlh_thread_status_s {
 	pthread_t thread;
 	ftlh_atomic64_t id;
 	ftlh_atomic64_t running;
-};
+	ftlh_atomicptr_t tables;   /* struct ftlh_table_list_s *, NULL when empty */
+
+	/* Producers bump wake and futex wake it, but only while sleeping is set */
+	ftlh_atomic32_t wake __attribute__ ((aligned(FTLH_CACHE_LINE)));
+	ftlh_atomic32_t sleeping;
+	uint64_t spin_usec;        /* Current adaptive spin budget */
+} __attribute__ ((aligned(FTLH_CACHE_LINE)));
 
 struct ftlh_globals_s {
 	ftlh_atomicptr_t *tables;
@@ -38,9 +327,28 @@ struct ftlh_globals_s {
 	struct ftlh_thread_status_s *threads;
 	ftlh_atomicptr_t running;
 	uint_fast32_t thread_count;
+	ftlh_atomic64_t worker_spin_usec; /* Upper bound of the adaptive spin, 0 = off */
+	ftlh_atomic32_t no_stealing;      /* Set to keep workers on their own tables */
+	ftlh_atomic32_t started;          /* Workers which have started running */
+
+	ftlh_atomic64_t epoch;         /* Global reclamation epoch, starts at 1 */
+	ftlh_atomicptr_t epoch_recs;   /* struct ftlh_epoch_rec_s list */
+	ftlh_atomicptr_t retired;      /* struct ftlh_retired_s list */
+
+	/* Treiber stack of free async requests. Poppers run inside an epoch and
+	 * requests over the cap are retired, not freed, so a popper may always read
+	 * next; the tag catches ABA. */
+	ftlh_tagged_ptr_t request_pool;
+	ftlh_atomic64_t request_pool_count; /* Requests in the pool, approximately */
 };
 
 extern struct ftlh_globals_s ftlh_globals;
 
+/* See ftlh_atomic.c; tests clear it to force the locked 128-bit path */
+extern int ftlh_atomic128_cx16;
+
+/* Tests set it to make ftlh_epoch_retire() act as if malloc() failed */
+extern ftlh_atomic32_t ftlh_epoch_fail_alloc;
+
 
 #endif // FTLH_PRIVATE_H
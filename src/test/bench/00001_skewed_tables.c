@@ -0,0 +1,152 @@
+#define _GNU_SOURCE
+#include "ftlh.h"
+#include <stdlib.h>
+#include <stdio.h>
+#include <pthread.h>
+#include <sys/time.h>
+
+#define _UNUSED __attribute__ ((unused))
+#define PASS 0
+#define FAIL 100
+#define SKIP 77
+#define HARD_FAIL 99
+
+#include "ftlh_private.h"
+
+/* Every table owned by worker 0 gets all of the traffic while the other workers
+ * own only idle tables. Without work stealing worker 0 applies everything. */
+#define WORKERS 4
+#define TABLES_PER_WORKER 4
+#define TABLES (WORKERS * TABLES_PER_WORKER)
+#define OPS_PER_TABLE 100000
+
+struct producer_s {
+	pthread_t thread;
+	struct ftlh_hash_table_s *table;
+	ftlh_key_t *keys;
+};
+
+ftlh_atomic64_t completed = 0;
+
+static void insert_done(ftlh_hash_table_t table _UNUSED, ftlh_key_t key _UNUSED, void *value _UNUSED,
+						uint_fast8_t status _UNUSED)
+{
+	ftlh_atomic64_inc(&completed);
+}
+
+static void *producer(void *arg)
+{
+	struct producer_s *prod = (struct producer_s *)arg;
+	uint64_t n = 0;
+
+	for (n = 0; n < OPS_PER_TABLE; ++n) {
+		ftlh_insert_async(prod->table, prod->keys[n], (void *)(uintptr_t)(n + 1), insert_done);
+	}
+
+	return NULL;
+}
+
+static uint64_t now_usec(void)
+{
+	struct timeval tv;
+	gettimeofday(&tv, NULL);
+	return (uint64_t)tv.tv_sec * 1000000 + tv.tv_usec;
+}
+
+static int run(uint_fast8_t stealing, double *ops_per_sec)
+{
+	struct ftlh_hash_table_s *tables[TABLES];
+	struct producer_s prods[TABLES_PER_WORKER];
+	uint64_t hot = 0, n = 0, k = 0, start = 0, elapsed = 0;
+
+	ftlh_set_work_stealing(stealing);
+	ftlh_atomic64_set(&completed, 0);
+
+	for (n = 0; n < TABLES; ++n) {
+		tables[n] = ftlh_hash_table_create(OPS_PER_TABLE);
+		if (!tables[n]) {
+			printf("Failed to create hash table.\n");
+			return FAIL;
+		}
+		if (tables[n]->worker == &ftlh_globals.threads[0]) {
+			prods[hot].table = tables[n];
+			prods[hot].keys = malloc(sizeof(ftlh_key_t) * OPS_PER_TABLE);
+			if (!prods[hot].keys) {
+				return HARD_FAIL;
+			}
+			for (k = 0; k < OPS_PER_TABLE; ++k) {
+				prods[hot].keys[k] = ftlh_build_key_printf("key-%lu-%lu", n, k);
+			}
+			++hot;
+		}
+	}
+	if (hot != TABLES_PER_WORKER) {
+		printf("Worker 0 owns %lu tables instead of %d.\n", hot, TABLES_PER_WORKER);
+		return 101;
+	}
+
+	start = now_usec();
+	for (n = 0; n < hot; ++n) {
+		pthread_create(&prods[n].thread, NULL, producer, &prods[n]);
+	}
+	for (n = 0; n < hot; ++n) {
+		pthread_join(prods[n].thread, NULL);
+	}
+	while (ftlh_atomic64_get(&completed) != hot * OPS_PER_TABLE) {
+		ftlh_yield(100);
+	}
+	elapsed = now_usec() - start;
+
+	for (n = 0; n < hot; ++n) {
+		if (ftlh_hash_table_items(prods[n].table) != OPS_PER_TABLE) {
+			printf("Table is missing items.\n");
+			return 102;
+		}
+		free(prods[n].keys);
+	}
+	for (n = 0; n < TABLES; ++n) {
+		ftlh_hash_table_destroy(&tables[n]);
+	}
+
+	*ops_per_sec = (double)(hot * OPS_PER_TABLE) * 1000000.0 / (double)(elapsed ? elapsed : 1);
+	return PASS;
+}
+
+int main()
+{
+	double without = 0, with = 0;
+	int status = PASS;
+
+	printf("Starting FTLH library with %d workers...\n", WORKERS);
+	ftlh_start_advanced(1024, WORKERS);
+
+	printf("Skewed load, work stealing disabled...\n");
+	if ((status = run(0, &without)) != PASS) {
+		return status;
+	}
+	printf("  %.0f inserts/sec\n", without);
+
+	printf("Skewed load, work stealing enabled...\n");
+	if ((status = run(1, &with)) != PASS) {
+		return status;
+	}
+	printf("  %.0f inserts/sec\n", with);
+
+	printf("Speedup: %.2fx\n", with / without);
+
+	printf("Stopping FTLH...\n");
+	ftlh_stop();
+
+	return PASS;
+}
+
+/* For Emacs:
+ * Local Variables:
+ * mode:c
+ * indent-tabs-mode:t
+ * tab-width:4
+ * c-basic-offset:4
+ * End:
+ * For VIM:
+ * vim:set softtabstop=4 shiftwidth=4 tabstop=4 noet:
+ */
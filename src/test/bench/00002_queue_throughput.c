@@ -0,0 +1,180 @@
+#define _GNU_SOURCE
+#include "ftlh.h"
+#include <stdlib.h>
+#include <stdio.h>
+#include <pthread.h>
+#include <sys/time.h>
+
+#define _UNUSED __attribute__ ((unused))
+#define PASS 0
+#define FAIL 100
+#define SKIP 77
+#define HARD_FAIL 99
+
+#include "ftlh_private.h"
+
+/* Compares ftlh_queue against the previous ring, which marked full nodes by a
+ * non-NULL pointer, walked the ring downward and yielded whenever a producer
+ * caught a node that was not cleared yet. Half the threads produce, half
+ * consume, for a fixed time per run. The old ring can lose items under
+ * contention, so the runs are timed instead of counting items through. */
+#define RUN_USEC 200000
+#define QUEUE_SIZE 1024
+
+struct legacy_queue_s {
+	ftlh_atomicptr_t *nodes;
+	ftlh_atomic64_t prod_pos;
+	ftlh_atomic64_t cons_pos;
+	uint64_t size;
+};
+
+struct legacy_queue_s legacy;
+ftlh_queue_t queue = NULL;
+uint_fast8_t use_legacy = 0;
+ftlh_atomic64_t dequeued = 0;
+
+ftlh_atomic64_t stop_producers = 0, stop_consumers = 0;
+
+static void legacy_enqueue(struct legacy_queue_s *q, void *value)
+{
+	uint64_t orig_prod_pos = 0, prod_pos = 0, cons_pos = 0;
+
+ again:
+	do {
+		prod_pos = ftlh_atomic64_get(&q->prod_pos);
+		if (ftlh_atomic_ptr_get(&q->nodes[prod_pos])) {
+			/* A lost item can leave a node full for good; don't wait forever */
+			if (ftlh_atomic64_get(&stop_producers)) {
+				return;
+			}
+			ftlh_yield(10);
+			goto again;
+		}
+		cons_pos = ftlh_atomic64_get(&q->cons_pos);
+		if (prod_pos == cons_pos + 2 || (prod_pos == 0 && cons_pos == q->size - 2) ||
+			(prod_pos == 1 && cons_pos == q->size - 1))
+		{
+			if (ftlh_atomic64_get(&stop_producers)) {
+				return;
+			}
+			ftlh_yield(10);
+			goto again;
+		}
+		orig_prod_pos = prod_pos;
+		prod_pos = (prod_pos ? prod_pos - 1 : q->size - 1);
+	} while (!ftlh_atomic64_bool_cas(&q->prod_pos, orig_prod_pos, prod_pos));
+
+	ftlh_atomic_ptr_set(&q->nodes[orig_prod_pos], value);
+}
+
+static void *legacy_dequeue(struct legacy_queue_s *q)
+{
+	uint64_t cons_pos = 0, orig_cons_pos = 0;
+	void *value = NULL;
+
+	do {
+		cons_pos = ftlh_atomic64_get(&q->cons_pos);
+		value = ftlh_atomic_ptr_get(&q->nodes[cons_pos]);
+		if (!value) {
+			return NULL;
+		}
+		orig_cons_pos = cons_pos;
+		cons_pos = (cons_pos ? cons_pos - 1 : q->size - 1);
+	} while (!ftlh_atomic64_bool_cas(&q->cons_pos, orig_cons_pos, cons_pos));
+
+	ftlh_atomic_ptr_set(&q->nodes[orig_cons_pos], NULL);
+	return value;
+}
+
+static void *producer(void *arg _UNUSED)
+{
+	uintptr_t count = 0;
+
+	while (!ftlh_atomic64_get(&stop_producers)) {
+		if (use_legacy) {
+			legacy_enqueue(&legacy, (void *)(count + 1));
+		} else {
+			ftlh_queue_enqueue(queue, (void *)(count + 1));
+		}
+		++count;
+	}
+	return NULL;
+}
+
+static void *consumer(void *arg _UNUSED)
+{
+	uint64_t count = 0;
+
+	while (!ftlh_atomic64_get(&stop_consumers)) {
+		if (use_legacy ? legacy_dequeue(&legacy) != NULL : ftlh_queue_try_dequeue(queue, NULL)) {
+			++count;
+		}
+	}
+	ftlh_atomic64_add_and_fetch(&dequeued, count);
+
+	return NULL;
+}
+
+static double run(uint_fast8_t legacy_mode, uint_fast32_t threads)
+{
+	pthread_t prods[8], conss[8];
+	uint_fast32_t n = 0;
+
+	use_legacy = legacy_mode;
+	ftlh_atomic64_set(&stop_producers, 0);
+	ftlh_atomic64_set(&stop_consumers, 0);
+	ftlh_atomic64_set(&dequeued, 0);
+
+	legacy.nodes = calloc(QUEUE_SIZE, sizeof(ftlh_atomicptr_t));
+	legacy.prod_pos = legacy.cons_pos = 0;
+	legacy.size = QUEUE_SIZE;
+	queue = ftlh_queue_create(QUEUE_SIZE);
+
+	for (n = 0; n < threads / 2; ++n) {
+		pthread_create(&conss[n], NULL, consumer, NULL);
+		pthread_create(&prods[n], NULL, producer, NULL);
+	}
+	ftlh_yield(RUN_USEC);
+
+	/* Producers first: they may be waiting for the consumers to make room */
+	ftlh_atomic64_set(&stop_producers, 1);
+	for (n = 0; n < threads / 2; ++n) {
+		pthread_join(prods[n], NULL);
+	}
+	ftlh_atomic64_set(&stop_consumers, 1);
+	for (n = 0; n < threads / 2; ++n) {
+		pthread_join(conss[n], NULL);
+	}
+
+	free((void *)legacy.nodes);
+	ftlh_queue_destroy(&queue);
+
+	return (double)ftlh_atomic64_get(&dequeued) * 1000000.0 / RUN_USEC;
+}
+
+int main()
+{
+	uint_fast32_t threads = 0;
+	double old_rate = 0, new_rate = 0;
+
+	printf("%8s %16s %16s %8s\n", "threads", "legacy ops/sec", "ftlh ops/sec", "speedup");
+	for (threads = 2; threads <= 16; threads <<= 1) {
+		old_rate = run(1, threads);
+		new_rate = run(0, threads);
+		printf("%8lu %16.0f %16.0f %7.2fx\n", threads, old_rate, new_rate, new_rate / (old_rate ? old_rate : 1));
+		fflush(stdout);
+	}
+
+	return PASS;
+}
+
+/* For Emacs:
+ * Local Variables:
+ * mode:c
+ * indent-tabs-mode:t
+ * tab-width:4
+ * c-basic-offset:4
+ * End:
+ * For VIM:
+ * vim:set softtabstop=4 shiftwidth=4 tabstop=4 noet:
+ */
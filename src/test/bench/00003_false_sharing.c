@@ -0,0 +1,176 @@
+#define _GNU_SOURCE
+#include "ftlh.h"
+#include <stdlib.h>
+#include <stdio.h>
+#include <pthread.h>
+#include <unistd.h>
+
+#define _UNUSED __attribute__ ((unused))
+#define PASS 0
+#define FAIL 100
+#define SKIP 77
+#define HARD_FAIL 99
+
+#include "ftlh_private.h"
+
+/* Shows what false sharing costs and what the queue layout does about it.
+ * The first part has threads bump private counters that share one cache line,
+ * then counters on lines of their own. The second part runs the same producer /
+ * consumer load through a regular and a padded queue. The differences only show
+ * up with the threads on separate cores, so run it on a machine with 8 or more.
+ */
+#define MAX_THREADS 16
+#define RUN_USEC 200000
+#define QUEUE_SIZE 1024
+
+struct packed_counters_s {
+	ftlh_atomic64_t count[MAX_THREADS];
+} __attribute__ ((aligned(FTLH_CACHE_LINE)));
+
+struct padded_counter_s {
+	ftlh_atomic64_t count;
+} __attribute__ ((aligned(FTLH_CACHE_LINE)));
+
+struct packed_counters_s packed;
+struct padded_counter_s padded[MAX_THREADS];
+ftlh_queue_t queue = NULL;
+ftlh_atomic64_t stop = 0, stop_consumers = 0, dequeued = 0;
+
+static void *packed_counter(void *arg)
+{
+	ftlh_atomic64_t *count = &packed.count[(uintptr_t)arg];
+
+	while (!ftlh_atomic64_get(&stop)) {
+		ftlh_atomic64_inc(count);
+	}
+	return NULL;
+}
+
+static void *padded_counter(void *arg)
+{
+	ftlh_atomic64_t *count = &padded[(uintptr_t)arg].count;
+
+	while (!ftlh_atomic64_get(&stop)) {
+		ftlh_atomic64_inc(count);
+	}
+	return NULL;
+}
+
+static void *producer(void *arg _UNUSED)
+{
+	uintptr_t count = 0;
+
+	while (!ftlh_atomic64_get(&stop)) {
+		ftlh_queue_enqueue(queue, (void *)++count);
+	}
+	return NULL;
+}
+
+static void *consumer(void *arg _UNUSED)
+{
+	uint64_t count = 0;
+
+	while (!ftlh_atomic64_get(&stop_consumers)) {
+		count += ftlh_queue_try_dequeue(queue, NULL);
+	}
+	ftlh_atomic64_add_and_fetch(&dequeued, count);
+	return NULL;
+}
+
+static double count_run(void *(*func)(void *), ftlh_atomic64_t *(*counter)(uintptr_t), uintptr_t threads)
+{
+	pthread_t tids[MAX_THREADS];
+	uint64_t total = 0;
+	uintptr_t n = 0;
+
+	ftlh_atomic64_set(&stop, 0);
+	for (n = 0; n < threads; ++n) {
+		ftlh_atomic64_set(counter(n), 0);
+		pthread_create(&tids[n], NULL, func, (void *)n);
+	}
+	ftlh_yield(RUN_USEC);
+	ftlh_atomic64_set(&stop, 1);
+	for (n = 0; n < threads; ++n) {
+		pthread_join(tids[n], NULL);
+		total += ftlh_atomic64_get(counter(n));
+	}
+
+	return (double)total * 1000000.0 / RUN_USEC;
+}
+
+static ftlh_atomic64_t *packed_slot(uintptr_t n)
+{
+	return &packed.count[n];
+}
+
+static ftlh_atomic64_t *padded_slot(uintptr_t n)
+{
+	return &padded[n].count;
+}
+
+static double queue_run(ftlh_queue_t (*create)(uint_fast64_t), uintptr_t threads)
+{
+	pthread_t prods[MAX_THREADS / 2], conss[MAX_THREADS / 2];
+	uintptr_t n = 0;
+
+	queue = create(QUEUE_SIZE);
+	ftlh_atomic64_set(&stop, 0);
+	ftlh_atomic64_set(&stop_consumers, 0);
+	ftlh_atomic64_set(&dequeued, 0);
+
+	for (n = 0; n < threads / 2; ++n) {
+		pthread_create(&conss[n], NULL, consumer, NULL);
+		pthread_create(&prods[n], NULL, producer, NULL);
+	}
+	ftlh_yield(RUN_USEC);
+
+	/* Producers first: they may be waiting for the consumers to make room */
+	ftlh_atomic64_set(&stop, 1);
+	for (n = 0; n < threads / 2; ++n) {
+		pthread_join(prods[n], NULL);
+	}
+	ftlh_atomic64_set(&stop_consumers, 1);
+	for (n = 0; n < threads / 2; ++n) {
+		pthread_join(conss[n], NULL);
+	}
+	ftlh_queue_destroy(&queue);
+
+	return (double)ftlh_atomic64_get(&dequeued) * 1000000.0 / RUN_USEC;
+}
+
+int main()
+{
+	uintptr_t threads = 0;
+	double shared = 0, separate = 0;
+
+	printf("Running on %ld CPUs\n\n", sysconf(_SC_NPROCESSORS_ONLN));
+
+	printf("%8s %18s %18s %8s\n", "threads", "shared line inc/s", "own line inc/s", "ratio");
+	for (threads = 1; threads <= MAX_THREADS; threads <<= 1) {
+		shared = count_run(packed_counter, packed_slot, threads);
+		separate = count_run(padded_counter, padded_slot, threads);
+		printf("%8lu %18.0f %18.0f %7.2fx\n", threads, shared, separate, separate / (shared ? shared : 1));
+		fflush(stdout);
+	}
+
+	printf("\n%8s %18s %18s %8s\n", "threads", "queue ops/s", "padded ops/s", "ratio");
+	for (threads = 2; threads <= MAX_THREADS; threads <<= 1) {
+		shared = queue_run(ftlh_queue_create, threads);
+		separate = queue_run(ftlh_queue_create_padded, threads);
+		printf("%8lu %18.0f %18.0f %7.2fx\n", threads, shared, separate, separate / (shared ? shared : 1));
+		fflush(stdout);
+	}
+
+	return PASS;
+}
+
+/* For Emacs:
+ * Local Variables:
+ * mode:c
+ * indent-tabs-mode:t
+ * tab-width:4
+ * c-basic-offset:4
+ * End:
+ * For VIM:
+ * vim:set softtabstop=4 shiftwidth=4 tabstop=4 noet:
+ */
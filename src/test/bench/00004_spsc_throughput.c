@@ -0,0 +1,118 @@
+#define _GNU_SOURCE
+#include "ftlh.h"
+#include <stdlib.h>
+#include <stdio.h>
+#include <pthread.h>
+
+#define _UNUSED __attribute__ ((unused))
+#define PASS 0
+#define FAIL 100
+#define SKIP 77
+#define HARD_FAIL 99
+
+#include "ftlh_private.h"
+
+/* Compares ftlh_queue against ftlh_spsc_queue with one producer and one
+ * consumer, both through the non-blocking calls. The SPSC queue should win by
+ * skipping every atomic read-modify-write; the gap is widest with the two
+ * threads on separate cores.
+ */
+#define RUN_USEC 500000
+#define QUEUE_SIZE 1024
+
+ftlh_queue_t queue = NULL;
+ftlh_spsc_queue_t spsc = NULL;
+ftlh_atomic64_t stop = 0, dequeued = 0;
+
+static void *mpmc_producer(void *arg _UNUSED)
+{
+	uintptr_t count = 0;
+
+	while (!ftlh_atomic64_get(&stop)) {
+		count += ftlh_queue_try_enqueue(queue, (void *)count);
+	}
+	return NULL;
+}
+
+static void *mpmc_consumer(void *arg _UNUSED)
+{
+	uint64_t count = 0;
+
+	while (!ftlh_atomic64_get(&stop)) {
+		count += ftlh_queue_try_dequeue(queue, NULL);
+	}
+	ftlh_atomic64_set(&dequeued, count);
+	return NULL;
+}
+
+static void *spsc_producer(void *arg _UNUSED)
+{
+	uintptr_t count = 0;
+
+	while (!ftlh_atomic64_get(&stop)) {
+		count += ftlh_spsc_queue_try_enqueue(spsc, (void *)count);
+	}
+	return NULL;
+}
+
+static void *spsc_consumer(void *arg _UNUSED)
+{
+	uint64_t count = 0;
+
+	while (!ftlh_atomic64_get(&stop)) {
+		count += ftlh_spsc_queue_try_dequeue(spsc, NULL);
+	}
+	ftlh_atomic64_set(&dequeued, count);
+	return NULL;
+}
+
+static double run(void *(*producer)(void *), void *(*consumer)(void *))
+{
+	pthread_t prod, cons;
+
+	ftlh_atomic64_set(&stop, 0);
+	ftlh_atomic64_set(&dequeued, 0);
+
+	pthread_create(&cons, NULL, consumer, NULL);
+	pthread_create(&prod, NULL, producer, NULL);
+	ftlh_yield(RUN_USEC);
+	ftlh_atomic64_set(&stop, 1);
+	pthread_join(prod, NULL);
+	pthread_join(cons, NULL);
+
+	return (double)ftlh_atomic64_get(&dequeued) * 1000000.0 / RUN_USEC;
+}
+
+int main()
+{
+	double mpmc_rate = 0, spsc_rate = 0;
+
+	queue = ftlh_queue_create(QUEUE_SIZE);
+	spsc = ftlh_spsc_queue_create(QUEUE_SIZE);
+	if (!queue || !spsc) {
+		printf("Failed to create queues.\n");
+		return HARD_FAIL;
+	}
+
+	mpmc_rate = run(mpmc_producer, mpmc_consumer);
+	spsc_rate = run(spsc_producer, spsc_consumer);
+
+	printf("%16s %16s %8s\n", "ftlh_queue/sec", "spsc_queue/sec", "speedup");
+	printf("%16.0f %16.0f %7.2fx\n", mpmc_rate, spsc_rate, spsc_rate / (mpmc_rate ? mpmc_rate : 1));
+
+	ftlh_queue_destroy(&queue);
+	ftlh_spsc_queue_destroy(&spsc);
+
+	return PASS;
+}
+
+/* For Emacs:
+ * Local Variables:
+ * mode:c
+ * indent-tabs-mode:t
+ * tab-width:4
+ * c-basic-offset:4
+ * End:
+ * For VIM:
+ * vim:set softtabstop=4 shiftwidth=4 tabstop=4 noet:
+ */
@@ -0,0 +1,131 @@
+
+#define _GNU_SOURCE
+#include "ftlh.h"
+#include <stdlib.h>
+#include <stdio.h>
+
+#define _UNUSED __attribute__ ((unused))
+#define PASS 0
+#define FAIL 100
+#define SKIP 77
+#define HARD_FAIL 99
+
+#include "ftlh_private.h"
+#include <string.h>
+#include <stddef.h>
+
+int main()
+{
+	ftlh_key_t key1 = NULL, key2 = NULL, key3 = NULL;
+	uint32_t a = 0x01020304;
+	uint16_t b = 0x0506;
+
+	printf("Building key from concatenated strings...\n");
+	key1 = ftlh_build_key_concat("http://", "example.com", "/index.html", NULL);
+	if (!key1 || key1->len != 29 || memcmp(key1->str, "http://example.com/index.html", 29) != 0) {
+		printf("Concatenated key is incorrect.\n");
+		return FAIL;
+	}
+
+	printf("Building the same key with printf...\n");
+	key2 = ftlh_build_key_printf("http://%s/%s.html", "example.com", "index");
+	if (!key2 || !ftlh_key_eq(key1, key2)) {
+		printf("Printf key does not equal concatenated key.\n");
+		return 101;
+	}
+
+	printf("Checking hashes of equal keys...\n");
+	if (ftlh_hash_neq(ftlh_hash_key(key1), ftlh_hash_key(key2))) {
+		printf("Equal keys hashed differently.\n");
+		return 102;
+	}
+	ftlh_key_free(&key2);
+
+	printf("Cloning key...\n");
+	key2 = ftlh_key_clone(key1);
+	if (!key2 || key2 == key1 || ftlh_key_neq(key1, key2)) {
+		printf("Cloned key does not equal source key.\n");
+		return 103;
+	}
+
+	printf("Checking the cached hashes...\n");
+	if (ftlh_hash_neq(key1->hash, ftlh_hash_best()(key1->str, key1->len)) || ftlh_hash_neq(key2->hash, key1->hash) ||
+		ftlh_hash_neq(ftlh_hash_key(key2), key2->hash)) {
+		printf("Cached hash does not match the key bytes.\n");
+		return 108;
+	}
+	key3 = ftlh_build_key_concat("http://", "example.com", "/index.htm!", NULL);
+	if (!key3 || key3->len != key1->len || ftlh_hash_neq(key3->hash, ftlh_hash_best()(key3->str, key3->len)) ||
+		ftlh_key_eq(key1, key3)) {
+		printf("Keys of the same length with different bytes compared equal.\n");
+		return 109;
+	}
+	ftlh_key_free(&key3);
+
+	printf("Building binary keys...\n");
+	ftlh_key_free(&key1);
+	ftlh_key_free(&key2);
+	key1 = ftlh_build_key_binary_concat(&a, sizeof(a), &b, sizeof(b), NULL, 0);
+	key2 = ftlh_build_key_binary(&a, sizeof(a));
+	if (!key1 || !key2 || key1->len != sizeof(a) + sizeof(b) || ftlh_key_eq(key1, key2)) {
+		printf("Binary keys are incorrect.\n");
+		return 104;
+	}
+	if (memcmp(key1->str, &a, sizeof(a)) != 0 || memcmp(key1->str + sizeof(a), &b, sizeof(b)) != 0 ||
+		ftlh_hash_neq(key1->hash, ftlh_hash_best()(key1->str, key1->len))) {
+		printf("Binary concatenated key contents are incorrect.\n");
+		return 105;
+	}
+
+	printf("Checking that an empty key is valid...\n");
+	key3 = ftlh_build_key_binary(NULL, 0);
+	if (!key3 || key3->len != 0) {
+		printf("Empty key is invalid.\n");
+		return 106;
+	}
+
+	printf("Checking that short keys fill exactly one cache line...\n");
+	if ((uintptr_t)key1 % FTLH_CACHE_LINE != 0 || key1->str != (char *)key1 + offsetof(struct ftlh_key_s, str)) {
+		printf("Short key is not inline in an aligned cache line.\n");
+		return 110;
+	}
+	ftlh_key_free(&key3);
+	key3 = ftlh_build_key_printf("%0*d", (int)FTLH_KEY_INLINE_MAX, 7);
+	if (!key3 || key3->len != FTLH_KEY_INLINE_MAX || (uintptr_t)key3 % FTLH_CACHE_LINE != 0 ||
+		key3->str[FTLH_KEY_INLINE_MAX - 1] != '7' || key3->str[FTLH_KEY_INLINE_MAX] != '\0') {
+		printf("Longest inline key is incorrect.\n");
+		return 111;
+	}
+
+	printf("Checking that a long key is one contiguous allocation...\n");
+	ftlh_key_free(&key2);
+	key2 = ftlh_build_key_printf("%0*d", 1000, 42);
+	if (!key2 || key2->len != 1000 || key2->str != (char *)key2 + offsetof(struct ftlh_key_s, str) ||
+		memcmp(key2->str + 998, "42", 3) != 0 || ftlh_hash_neq(key2->hash, ftlh_hash_best()(key2->str, key2->len))) {
+		printf("Long key is incorrect.\n");
+		return 112;
+	}
+
+	printf("Freeing keys...\n");
+	ftlh_key_free(&key1);
+	ftlh_key_free(&key2);
+	ftlh_key_free(&key3);
+	if (key1 || key2 || key3) {
+		printf("Freed keys were not cleared.\n");
+		return 107;
+	}
+
+	printf("Success.\n");
+	return PASS;
+}
+
+/* For Emacs:
+ * Local Variables:
+ * mode:c
+ * indent-tabs-mode:t
+ * tab-width:4
+ * c-basic-offset:4
+ * End:
+ * For VIM:
+ * vim:set softtabstop=4 shiftwidth=4 tabstop=4 noet:
+ */
@@ -0,0 +1,91 @@
+
+#define _GNU_SOURCE
+#include "ftlh.h"
+#include <stdlib.h>
+#include <stdio.h>
+
+#define _UNUSED __attribute__ ((unused))
+#define PASS 0
+#define FAIL 100
+#define SKIP 77
+#define HARD_FAIL 99
+
+#include "ftlh_private.h"
+
+#define OP_COUNT 2000
+
+double timed_inserts(ftlh_hash_table_t table, uint64_t base)
+{
+	struct timeval start, end;
+	ftlh_key_t key = NULL;
+	uint64_t n = 0;
+
+	ftlh_current_time(&start);
+	for (n = base; n < base + OP_COUNT; ++n) {
+		key = ftlh_build_key_binary(&n, sizeof(n));
+		ftlh_insert(table, key, NULL);
+	}
+	ftlh_current_time(&end);
+
+	return (double)ftlh_time_diff_usec(&end, &start) / (double)OP_COUNT;
+}
+
+int main()
+{
+	ftlh_hash_table_t table = NULL;
+	double usec = 0;
+
+	printf("Starting FTLH library...\n");
+	ftlh_start();
+
+	printf("Creating hash table...\n");
+	table = ftlh_hash_table_create(OP_COUNT * 2);
+	if (!table) {
+		printf("Failed to create hash table.\n");
+		return FAIL;
+	}
+
+	printf("Checking that idle workers park...\n");
+	ftlh_yield(20000);
+	if (!ftlh_atomic32_get(&table->worker->sleeping)) {
+		printf("Idle worker is not parked.\n");
+		return 101;
+	}
+
+	printf("Timing synchronous inserts against a parked worker...\n");
+	usec = timed_inserts(table, 0);
+	printf("Average insert latency: %lf usec\n", usec);
+	if (usec > 1000) {
+		printf("Inserts are waiting on a poll interval.\n");
+		return 102;
+	}
+
+	printf("Timing synchronous inserts with worker spinning enabled...\n");
+	ftlh_set_worker_spin(100);
+	usec = timed_inserts(table, OP_COUNT);
+	printf("Average insert latency: %lf usec\n", usec);
+	if (usec > 1000 || ftlh_hash_table_items(table) != OP_COUNT * 2) {
+		printf("Spinning workers lost or delayed requests.\n");
+		return 103;
+	}
+
+	printf("Destroying hash table...\n");
+	ftlh_hash_table_destroy(&table);
+
+	printf("Stopping FTLH...\n");
+	ftlh_stop();
+
+	printf("Success.\n");
+	return PASS;
+}
+
+/* For Emacs:
+ * Local Variables:
+ * mode:c
+ * indent-tabs-mode:t
+ * tab-width:4
+ * c-basic-offset:4
+ * End:
+ * For VIM:
+ * vim:set softtabstop=4 shiftwidth=4 tabstop=4 noet:
+ */
@@ -0,0 +1,153 @@
+#define _GNU_SOURCE
+#include "ftlh.h"
+#include <stdlib.h>
+#include <stdio.h>
+#include <pthread.h>
+
+#define _UNUSED __attribute__ ((unused))
+#define PASS 0
+#define FAIL 100
+#define SKIP 77
+#define HARD_FAIL 99
+
+#include "ftlh_private.h"
+
+#define THREADS 4
+#define ROUNDS 20000
+#define ASYNC_OPS 1000
+
+static ftlh_atomic128_t counter;
+
+/* Bumps both halves together; a torn CAS would let them drift apart */
+void *bump(void *arg _UNUSED)
+{
+	ftlh_atomic128_t old_value, new_value;
+	uint64_t n = 0;
+
+	for (n = 0; n < ROUNDS; ++n) {
+		old_value = ftlh_atomic128_get(&counter);
+		do {
+			new_value.lo = old_value.lo + 1;
+			new_value.hi = old_value.hi + 1;
+		} while (!ftlh_atomic128_cas(&counter, &old_value, new_value));
+	}
+	return NULL;
+}
+
+int check_cas(void)
+{
+	ftlh_atomic128_t loc = { 1, 2 };
+	ftlh_atomic128_t expected = { 1, 3 };
+	ftlh_atomic128_t desired = { 5, 6 };
+	ftlh_tagged_ptr_t tagged = ftlh_tagged_ptr_make(&loc, 7);
+	pthread_t threads[THREADS];
+	int th = 0;
+
+	if (ftlh_atomic128_cas(&loc, &expected, desired)) {
+		printf("CAS succeeded with a stale high half.\n");
+		return 1;
+	}
+	if (expected.lo != 1 || expected.hi != 2) {
+		printf("Failed CAS did not return the current value.\n");
+		return 2;
+	}
+	if (!ftlh_atomic128_cas(&loc, &expected, desired) || loc.lo != 5 || loc.hi != 6) {
+		printf("CAS failed with the current value.\n");
+		return 3;
+	}
+
+	if (!ftlh_tagged_ptr_cas(&tagged, ftlh_tagged_ptr_make(&loc, 7), &expected)) {
+		printf("Tagged CAS failed.\n");
+		return 4;
+	}
+	if (ftlh_tagged_ptr_ptr(tagged) != &expected || ftlh_tagged_ptr_tag(tagged) != 8) {
+		printf("Tagged CAS did not advance the tag.\n");
+		return 5;
+	}
+	if (ftlh_tagged_ptr_cas(&tagged, ftlh_tagged_ptr_make(&expected, 7), &loc)) {
+		printf("Tagged CAS ignored a stale tag.\n");
+		return 6;
+	}
+
+	ftlh_atomic128_set(&counter, ftlh_tagged_ptr_make(NULL, 0));
+	for (th = 0; th < THREADS; ++th) {
+		pthread_create(&threads[th], NULL, bump, NULL);
+	}
+	for (th = 0; th < THREADS; ++th) {
+		pthread_join(threads[th], NULL);
+	}
+	if (counter.lo != THREADS * ROUNDS || counter.hi != THREADS * ROUNDS) {
+		printf("Lost updates: %lu / %lu\n", (unsigned long)counter.lo, (unsigned long)counter.hi);
+		return 7;
+	}
+
+	return 0;
+}
+
+int main()
+{
+	ftlh_hash_table_t table = NULL;
+	ftlh_key_t key = NULL;
+	uint64_t n = 0;
+	int ret = 0;
+
+	printf("Checking 128-bit CAS (lock free: %d)...\n", (int)ftlh_atomic128_lock_free());
+	if ((ret = check_cas())) {
+		return FAIL + ret;
+	}
+
+	printf("Checking 128-bit CAS with striped locks...\n");
+	ftlh_atomic128_cx16 = 0;
+	if (ftlh_atomic128_lock_free()) {
+		printf("Locked path was not selected.\n");
+		return HARD_FAIL;
+	}
+	if ((ret = check_cas())) {
+		return FAIL + 10 + ret;
+	}
+
+	printf("Starting FTLH library...\n");
+	ftlh_start();
+	table = ftlh_hash_table_create(ASYNC_OPS * 2);
+	if (!table) {
+		printf("Failed to create hash table.\n");
+		return HARD_FAIL;
+	}
+
+	printf("Checking that async requests are recycled...\n");
+	for (n = 0; n < ASYNC_OPS; ++n) {
+		key = ftlh_build_key_binary(&n, sizeof(n));
+		ftlh_insert_async(table, key, NULL, NULL);
+	}
+	/* Synchronous requests are queued behind the async ones */
+	key = ftlh_build_key_binary(&n, sizeof(n));
+	ftlh_insert(table, key, NULL);
+	if (ftlh_hash_table_items(table) != ASYNC_OPS + 1) {
+		printf("Expected %d items, found %lu\n", ASYNC_OPS + 1, (unsigned long)ftlh_hash_table_items(table));
+		return FAIL + 20;
+	}
+	if (!ftlh_atomic64_get(&ftlh_globals.request_pool_count)) {
+		printf("Finished async requests were not pooled.\n");
+		return FAIL + 21;
+	}
+
+	ftlh_hash_table_destroy(&table);
+	ftlh_stop();
+	if (ftlh_atomic64_get(&ftlh_globals.request_pool_count)) {
+		printf("Request pool was not drained.\n");
+		return FAIL + 22;
+	}
+
+	return PASS;
+}
+
+/* For Emacs:
+ * Local Variables:
+ * mode:c
+ * indent-tabs-mode:t
+ * tab-width:4
+ * c-basic-offset:4
+ * End:
+ * For VIM:
+ * vim:set softtabstop=4 shiftwidth=4 tabstop=4 noet:
+ */
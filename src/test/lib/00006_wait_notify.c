@@ -0,0 +1,97 @@
+#define _GNU_SOURCE
+#include "ftlh.h"
+#include <stdlib.h>
+#include <stdio.h>
+#include <pthread.h>
+
+#define _UNUSED __attribute__ ((unused))
+#define PASS 0
+#define FAIL 100
+#define SKIP 77
+#define HARD_FAIL 99
+
+#include "ftlh_private.h"
+
+#define WAITERS 3
+
+static ftlh_atomic32_t flag;
+static ftlh_atomic32_t woken;
+
+void *waiter(void *arg _UNUSED)
+{
+	while (!ftlh_atomic32_get(&flag)) {
+		ftlh_atomic32_wait(&flag, 0, 0);
+	}
+	ftlh_atomic32_inc(&woken);
+	return NULL;
+}
+
+int main()
+{
+	pthread_t threads[WAITERS];
+	struct timeval start, end;
+	uint64_t elapsed = 0;
+	int th = 0;
+
+	printf("Checking that a wait times out...\n");
+	ftlh_current_time(&start);
+	if (ftlh_atomic32_wait(&flag, 0, 20000)) {
+		printf("Wait did not report the timeout.\n");
+		return FAIL + 1;
+	}
+	ftlh_current_time(&end);
+	elapsed = ftlh_time_diff_usec(&end, &start);
+	if (elapsed < 15000) {
+		printf("Wait returned after %lu usec.\n", (unsigned long)elapsed);
+		return FAIL + 2;
+	}
+
+	printf("Checking that a stale expected value returns at once...\n");
+	ftlh_current_time(&start);
+	ftlh_atomic32_wait(&flag, 1, 1000000);
+	ftlh_current_time(&end);
+	if (ftlh_time_diff_usec(&end, &start) > 500000) {
+		printf("Wait blocked although the value differed.\n");
+		return FAIL + 3;
+	}
+
+	printf("Checking that notify_all wakes every waiter...\n");
+	for (th = 0; th < WAITERS; ++th) {
+		pthread_create(&threads[th], NULL, waiter, NULL);
+	}
+	ftlh_yield(20000);
+	if (ftlh_atomic32_get(&woken)) {
+		printf("A waiter returned before it was notified.\n");
+		return FAIL + 4;
+	}
+	ftlh_atomic32_set(&flag, 1);
+	ftlh_atomic32_notify_all(&flag);
+	for (th = 0; th < WAITERS; ++th) {
+		pthread_join(threads[th], NULL);
+	}
+	if (ftlh_atomic32_get(&woken) != WAITERS) {
+		printf("Only %u waiters woke up.\n", (unsigned)ftlh_atomic32_get(&woken));
+		return FAIL + 5;
+	}
+
+	printf("Checking that ftlh_start_expert waits for its workers...\n");
+	ftlh_start_advanced(16, 4);
+	if (ftlh_atomic32_get(&ftlh_globals.started) != 4) {
+		printf("Only %u workers had started.\n", (unsigned)ftlh_atomic32_get(&ftlh_globals.started));
+		return FAIL + 6;
+	}
+	ftlh_stop();
+
+	return PASS;
+}
+
+/* For Emacs:
+ * Local Variables:
+ * mode:c
+ * indent-tabs-mode:t
+ * tab-width:4
+ * c-basic-offset:4
+ * End:
+ * For VIM:
+ * vim:set softtabstop=4 shiftwidth=4 tabstop=4 noet:
+ */
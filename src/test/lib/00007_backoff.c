@@ -0,0 +1,102 @@
+#define _GNU_SOURCE
+#include "ftlh.h"
+#include <stdlib.h>
+#include <stdio.h>
+#include <pthread.h>
+
+#define _UNUSED __attribute__ ((unused))
+#define PASS 0
+#define FAIL 100
+#define SKIP 77
+#define HARD_FAIL 99
+
+#include "ftlh_private.h"
+
+static ftlh_atomic32_t flag;
+
+void *notifier(void *arg _UNUSED)
+{
+	ftlh_yield(20000);
+	ftlh_atomic32_set(&flag, 1);
+	ftlh_atomic32_notify_all(&flag);
+	return NULL;
+}
+
+uint64_t timed_wait(ftlh_backoff_t *backoff, ftlh_atomic32_t *loc, uint32_t expected)
+{
+	struct timeval start, end;
+
+	ftlh_current_time(&start);
+	ftlh_backoff_wait(backoff, loc, expected);
+	ftlh_current_time(&end);
+
+	return ftlh_time_diff_usec(&end, &start);
+}
+
+int main()
+{
+	ftlh_backoff_t backoff;
+	pthread_t thread;
+	uint64_t usec = 0;
+	int n = 0;
+
+	printf("Checking that the backoff escalates...\n");
+	ftlh_backoff_init_custom(&backoff, 3, 2, 20000);
+	for (n = 0; n < 5; ++n) {
+		timed_wait(&backoff, NULL, 0);
+	}
+	if (backoff.round != 5) {
+		printf("Backoff is at round %u after 5 waits.\n", backoff.round);
+		return FAIL + 1;
+	}
+
+	/* Parks double from 1 usec up to the cap */
+	for (n = 0; n < 14; ++n) {
+		timed_wait(&backoff, NULL, 0);
+	}
+	usec = timed_wait(&backoff, NULL, 0);
+	if (usec < 15000) {
+		printf("Capped park only took %lu usec.\n", (unsigned long)usec);
+		return FAIL + 2;
+	}
+
+	printf("Checking that reset starts over with spinning...\n");
+	ftlh_backoff_reset(&backoff);
+	if (timed_wait(&backoff, NULL, 0) > 10000) {
+		printf("First wait after a reset was slow.\n");
+		return FAIL + 3;
+	}
+
+	printf("Checking that a notify ends a park early...\n");
+	ftlh_backoff_init_custom(&backoff, 0, 0, 5000000);
+	backoff.round = 40;
+	pthread_create(&thread, NULL, notifier, NULL);
+	usec = timed_wait(&backoff, &flag, 0);
+	pthread_join(thread, NULL);
+	if (usec > 2000000) {
+		printf("Park ignored the notify: %lu usec\n", (unsigned long)usec);
+		return FAIL + 4;
+	}
+
+	printf("Checking that the defaults can be changed...\n");
+	ftlh_backoff_set_defaults(1, 0, 7);
+	ftlh_backoff_init(&backoff);
+	if (backoff.spin_rounds != 1 || backoff.yield_rounds != 0 || backoff.park_usec != 7) {
+		printf("Defaults were not applied.\n");
+		return FAIL + 5;
+	}
+	ftlh_backoff_set_defaults(FTLH_BACKOFF_SPIN_ROUNDS, FTLH_BACKOFF_YIELD_ROUNDS, FTLH_BACKOFF_PARK_USEC);
+
+	return PASS;
+}
+
+/* For Emacs:
+ * Local Variables:
+ * mode:c
+ * indent-tabs-mode:t
+ * tab-width:4
+ * c-basic-offset:4
+ * End:
+ * For VIM:
+ * vim:set softtabstop=4 shiftwidth=4 tabstop=4 noet:
+ */
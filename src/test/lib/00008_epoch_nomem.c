@@ -0,0 +1,129 @@
+#define _GNU_SOURCE
+#include "ftlh.h"
+#include <stdlib.h>
+#include <stdio.h>
+#include <pthread.h>
+
+#define _UNUSED __attribute__ ((unused))
+#define PASS 0
+#define FAIL 100
+#define SKIP 77
+#define HARD_FAIL 99
+
+#include "ftlh_private.h"
+
+#define ITEM_COUNT 2000
+#define QUEUE_ITEMS 20000
+#define SEGMENT_SIZE 32
+#define PRODUCERS 2
+
+static ftlh_unbounded_queue_t queue = NULL;
+
+void *producer(void *arg _UNUSED)
+{
+	uint64_t n = 0;
+
+	for (n = 1; n <= QUEUE_ITEMS; ++n) {
+		if (!ftlh_unbounded_queue_enqueue(queue, (void *)(uintptr_t)n)) {
+			return (void *)1;
+		}
+	}
+	return NULL;
+}
+
+int main()
+{
+	ftlh_hash_table_t table = NULL;
+	ftlh_key_t key = NULL;
+	pthread_t threads[PRODUCERS];
+	void *value = NULL, *ret = NULL;
+	uint64_t n = 0, taken = 0;
+	int th = 0;
+
+	/* Every retire now takes the out of memory path. Workers retire from inside
+	 * their read section, so before the fix this hung on the first one. */
+	ftlh_atomic32_set(&ftlh_epoch_fail_alloc, 1);
+
+	printf("Starting FTLH library...\n");
+	ftlh_start();
+
+	printf("Creating a small hash table...\n");
+	table = ftlh_hash_table_create(16);
+	if (!table) {
+		printf("Failed to create hash table.\n");
+		return HARD_FAIL;
+	}
+
+	printf("Inserting %d keys, so the table grows...\n", ITEM_COUNT);
+	for (n = 0; n < ITEM_COUNT; ++n) {
+		key = ftlh_build_key_binary(&n, sizeof(n));
+		if (!ftlh_insert(table, key, (void *)(uintptr_t)(n + 1))) {
+			printf("Failed to insert key %lu\n", (unsigned long)n);
+			return FAIL + 1;
+		}
+	}
+
+	printf("Replacing every key...\n");
+	for (n = 0; n < ITEM_COUNT; ++n) {
+		key = ftlh_build_key_binary(&n, sizeof(n));
+		if (ftlh_replace(table, key, (void *)(uintptr_t)(n + 2)) != (void *)(uintptr_t)(n + 1)) {
+			printf("Failed to replace key %lu\n", (unsigned long)n);
+			return FAIL + 2;
+		}
+	}
+
+	printf("Checking and removing every key...\n");
+	for (n = 0; n < ITEM_COUNT; ++n) {
+		key = ftlh_build_key_binary(&n, sizeof(n));
+		if (ftlh_find(table, key) != (void *)(uintptr_t)(n + 2) || ftlh_remove(table, key) != (void *)(uintptr_t)(n + 2)) {
+			printf("Key %lu has the wrong value\n", (unsigned long)n);
+			return FAIL + 3;
+		}
+		ftlh_key_free(&key);
+	}
+	if (ftlh_hash_table_items(table)) {
+		printf("Table still holds %lu items\n", (unsigned long)ftlh_hash_table_items(table));
+		return FAIL + 4;
+	}
+
+	ftlh_hash_table_destroy(&table);
+
+	printf("Passing items through an unbounded queue...\n");
+	queue = ftlh_unbounded_queue_create(SEGMENT_SIZE);
+	if (!queue) {
+		printf("Failed to create queue.\n");
+		return HARD_FAIL;
+	}
+	for (th = 0; th < PRODUCERS; ++th) {
+		pthread_create(&threads[th], NULL, producer, NULL);
+	}
+	while (taken < QUEUE_ITEMS * PRODUCERS) {
+		if (ftlh_unbounded_queue_try_dequeue(queue, &value)) {
+			++taken;
+		}
+	}
+	for (th = 0; th < PRODUCERS; ++th) {
+		pthread_join(threads[th], &ret);
+		if (ret) {
+			printf("Producer failed to enqueue.\n");
+			return FAIL + 5;
+		}
+	}
+	ftlh_unbounded_queue_destroy(&queue);
+
+	ftlh_stop();
+	ftlh_atomic32_set(&ftlh_epoch_fail_alloc, 0);
+
+	return PASS;
+}
+
+/* For Emacs:
+ * Local Variables:
+ * mode:c
+ * indent-tabs-mode:t
+ * tab-width:4
+ * c-basic-offset:4
+ * End:
+ * For VIM:
+ * vim:set softtabstop=4 shiftwidth=4 tabstop=4 noet:
+ */
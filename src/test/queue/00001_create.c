@@ -39,8 +39,8 @@ int main()
 	}
 
 	printf("Checking that queue items is zero...\n");
-	if (ftlh_atomic64_get(&queue->items) != 0) {
-		printf("Queue items is not zero: %lu\n", ftlh_atomic64_get(&queue->items));
+	if (ftlh_queue_approx_items(queue) != 0) {
+		printf("Queue items is not zero: %lu\n", ftlh_queue_approx_items(queue));
 		return 103;
 	}
 
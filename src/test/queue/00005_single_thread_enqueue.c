@@ -49,7 +49,7 @@ int main()
 	cons_pos = ftlh_atomic64_get(&queue->cons_pos);
 	printf("prod_pos = %lu\n", prod_pos);
 	printf("cons_pos = %lu\n", cons_pos);
-	if (prod_pos != (ftlh_atomic64_get(&queue->size) - 1)) {
+	if (prod_pos != 1) {
 		printf("Producer position is incorrect.\n");
 		return 103;
 	}
@@ -51,7 +51,7 @@ int main()
 	cons_pos = ftlh_atomic64_get(&queue->cons_pos);
 	printf("prod_pos = %lu\n", prod_pos);
 	printf("cons_pos = %lu\n", cons_pos);
-	if (prod_pos != (ftlh_atomic64_get(&queue->size) - 1)) {
+	if (prod_pos != 1) {
 		printf("Producer position is incorrect.\n");
 		return 103;
 	}
@@ -85,11 +85,11 @@ int main()
 	cons_pos = ftlh_atomic64_get(&queue->cons_pos);
 	printf("prod_pos = %lu\n", prod_pos);
 	printf("cons_pos = %lu\n", cons_pos);
-	if (prod_pos != (ftlh_atomic64_get(&queue->size) - 1)) {
+	if (prod_pos != 1) {
 		printf("Producer position is incorrect.\n");
 		return 103;
 	}
-	if (cons_pos != prod_pos) {
+	if (cons_pos != 1) {
 		printf("Consumer position is incorrect.\n");
 		return 104;
 	}
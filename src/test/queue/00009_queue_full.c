@@ -42,11 +42,14 @@ void *producer_thread(void *start_val)
 void *consumer_thread(void *ignored __attribute__((unused)))
 {
 	void *value = NULL;
+	uint_fast8_t done = 0;
 	pthread_mutex_lock(&start_mutex);
 	pthread_mutex_unlock(&start_mutex);
 
 	printf("Consumer thread beginning loop...\n");
 	do {
+		/* Only an empty queue seen after both producers finished means we are done */
+		done = ftlh_atomic64_get(&prod1_done) && ftlh_atomic64_get(&prod2_done);
 		value = ftlh_queue_dequeue(queue);
 		if (value == NULL) continue;
 		if ((uintptr_t)value % 2 == 0) {
@@ -54,7 +57,7 @@ void *consumer_thread(void *ignored __attribute__((unused)))
 		} else {
 			ftlh_atomic64_inc(&odd_count);
 		}
-	} while (!ftlh_atomic64_get(&prod1_done) || !ftlh_atomic64_get(&prod2_done) || value != NULL);
+	} while (!done || value != NULL);
 		   
 	printf("Consumer finished dequeing items.\n");
 
@@ -0,0 +1,82 @@
+#define _GNU_SOURCE
+#include "ftlh.h"
+#include <stdlib.h>
+#include <stdio.h>
+
+#define _UNUSED __attribute__ ((unused))
+#define PASS 0
+#define FAIL 100
+#define SKIP 77
+#define HARD_FAIL 99
+
+#include "ftlh_private.h"
+
+int main()
+{
+	ftlh_queue_t queue = NULL;
+	void *value = (void *)1;
+	uintptr_t n = 0, lap = 0;
+
+	/* Not a power of two, so positions wrap by modulo */
+	printf("Creating queue...\n");
+	queue = ftlh_queue_create(100);
+	if (!queue) {
+		printf("Failed to create queue.\n");
+		return FAIL;
+	}
+
+	printf("Checking that an empty queue is reported as empty...\n");
+	if (ftlh_queue_try_dequeue(queue, &value) || value != (void *)1) {
+		printf("Dequeued from an empty queue.\n");
+		return 101;
+	}
+
+	printf("Enqueueing and dequeueing NULL...\n");
+	ftlh_queue_enqueue(queue, NULL);
+	if (!ftlh_queue_try_dequeue(queue, &value) || value != NULL) {
+		printf("Queued NULL was not dequeued.\n");
+		return 102;
+	}
+	if (ftlh_queue_try_dequeue(queue, &value)) {
+		printf("Queue is not empty after dequeueing NULL.\n");
+		return 103;
+	}
+
+	printf("Filling and draining the queue for several laps...\n");
+	for (lap = 0; lap < 5; ++lap) {
+		for (n = 0; n < ftlh_queue_size(queue); ++n) {
+			ftlh_queue_enqueue(queue, (void *)(lap * 1000 + n));
+		}
+		if (ftlh_queue_approx_items(queue) != ftlh_queue_size(queue)) {
+			printf("Full queue holds %lu items.\n", ftlh_queue_approx_items(queue));
+			return 104;
+		}
+		for (n = 0; n < ftlh_queue_size(queue); ++n) {
+			if (!ftlh_queue_try_dequeue(queue, &value) || value != (void *)(lap * 1000 + n)) {
+				printf("Lap %lu item %lu came out as %p.\n", lap, n, value);
+				return 105;
+			}
+		}
+		if (ftlh_queue_try_dequeue(queue, NULL)) {
+			printf("Queue is not empty after draining it.\n");
+			return 106;
+		}
+	}
+
+	/* If this doesn't segfault, then it passes. */
+	printf("Destroying queue...\n");
+	ftlh_queue_destroy(&queue);
+
+	return PASS;
+}
+
+/* For Emacs:
+ * Local Variables:
+ * mode:c
+ * indent-tabs-mode:t
+ * tab-width:4
+ * c-basic-offset:4
+ * End:
+ * For VIM:
+ * vim:set softtabstop=4 shiftwidth=4 tabstop=4 noet:
+ */
@@ -0,0 +1,92 @@
+#define _GNU_SOURCE
+#include "ftlh.h"
+#include <stdlib.h>
+#include <stdio.h>
+#include <stddef.h>
+
+#define _UNUSED __attribute__ ((unused))
+#define PASS 0
+#define FAIL 100
+#define SKIP 77
+#define HARD_FAIL 99
+
+#include "ftlh_private.h"
+
+#define LINE_OF(field) (offsetof(struct ftlh_queue_s, field) / FTLH_CACHE_LINE)
+
+int main()
+{
+	ftlh_queue_t queue = NULL;
+	struct ftlh_queue_node_s *node = NULL;
+	void *value = NULL;
+	uintptr_t n = 0;
+
+	printf("Checking node size...\n");
+	if (sizeof(struct ftlh_queue_node_s) != (1 << FTLH_QUEUE_NODE_SHIFT)) {
+		printf("Node size %lu does not match FTLH_QUEUE_NODE_SHIFT.\n", sizeof(struct ftlh_queue_node_s));
+		return 101;
+	}
+
+	printf("Checking that hot fields have their own cache lines...\n");
+	if (LINE_OF(nodes) != LINE_OF(size) || LINE_OF(nodes) != LINE_OF(mask) ||
+		LINE_OF(prod_pos) == LINE_OF(nodes) || LINE_OF(cons_pos) == LINE_OF(prod_pos) ||
+		LINE_OF(waiters) == LINE_OF(cons_pos) || LINE_OF(waiters) == LINE_OF(prod_pos))
+	{
+		printf("Queue fields share cache lines.\n");
+		return 102;
+	}
+
+	printf("Creating padded queue...\n");
+	queue = ftlh_queue_create_padded(100);
+	if (!queue) {
+		printf("Failed to create queue.\n");
+		return FAIL;
+	}
+	if (((uintptr_t)queue & (FTLH_CACHE_LINE - 1)) != 0 || ((uintptr_t)queue->nodes & (FTLH_CACHE_LINE - 1)) != 0) {
+		printf("Padded queue is not cache line aligned.\n");
+		return 103;
+	}
+
+	printf("Filling the padded queue, draining it and filling it again...\n");
+	for (n = 0; n < ftlh_queue_size(queue); ++n) {
+		ftlh_queue_enqueue(queue, (void *)n);
+	}
+	for (n = 0; n < ftlh_queue_size(queue); ++n) {
+		if (!ftlh_queue_try_dequeue(queue, &value) || value != (void *)n) {
+			printf("Item %lu came out as %p.\n", n, value);
+			return 104;
+		}
+	}
+	for (n = ftlh_queue_size(queue); n < 2 * ftlh_queue_size(queue); ++n) {
+		ftlh_queue_enqueue(queue, (void *)n);
+	}
+	if (ftlh_queue_approx_items(queue) != ftlh_queue_size(queue)) {
+		printf("Padded queue holds %lu items.\n", ftlh_queue_approx_items(queue));
+		return 105;
+	}
+
+	printf("Checking that every node has its own cache line...\n");
+	/* Node 1 now holds position 101 from the second lap */
+	node = (struct ftlh_queue_node_s *)((char *)queue->nodes + FTLH_CACHE_LINE);
+	if ((uintptr_t)ftlh_atomic_ptr_get(&node->data) != 101 || ftlh_atomic64_get(&node->seq) != 102) {
+		printf("Node 1 is not one cache line after node 0.\n");
+		return 106;
+	}
+
+	/* If this doesn't segfault, then it passes. */
+	printf("Destroying queue...\n");
+	ftlh_queue_destroy(&queue);
+
+	return PASS;
+}
+
+/* For Emacs:
+ * Local Variables:
+ * mode:c
+ * indent-tabs-mode:t
+ * tab-width:4
+ * c-basic-offset:4
+ * End:
+ * For VIM:
+ * vim:set softtabstop=4 shiftwidth=4 tabstop=4 noet:
+ */
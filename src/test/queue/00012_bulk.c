@@ -0,0 +1,153 @@
+#define _GNU_SOURCE
+#include "ftlh.h"
+#include <stdlib.h>
+#include <stdio.h>
+#include <pthread.h>
+
+#define _UNUSED __attribute__ ((unused))
+#define PASS 0
+#define FAIL 100
+#define SKIP 77
+#define HARD_FAIL 99
+
+#include "ftlh_private.h"
+
+#define ITEMS 100000
+#define BATCH 16
+
+ftlh_queue_t queue = NULL;
+ftlh_atomic64_t producers_done = 0, received = 0, out_of_order = 0;
+
+/* Values are (producer << 32) | sequence, starting at sequence 1 */
+void *producer_thread(void *arg)
+{
+	void *batch[BATCH];
+	uintptr_t id = (uintptr_t)arg, seq = 1, n = 0;
+
+	while (seq <= ITEMS) {
+		for (n = 0; n < BATCH && seq <= ITEMS; ++n, ++seq) {
+			batch[n] = (void *)((id << 32) | seq);
+		}
+		ftlh_queue_enqueue_bulk(queue, batch, n);
+	}
+	ftlh_atomic64_inc(&producers_done);
+	return NULL;
+}
+
+void *consumer_thread(void *arg _UNUSED)
+{
+	void *batch[BATCH * 2];
+	uintptr_t last[2] = {0, 0};
+	uint_fast64_t count = 0, n = 0;
+	uint_fast8_t done = 0;
+
+	do {
+		done = (ftlh_atomic64_get(&producers_done) == 2);
+		count = ftlh_queue_dequeue_bulk(queue, batch, BATCH * 2);
+		for (n = 0; n < count; ++n) {
+			uintptr_t id = (uintptr_t)batch[n] >> 32, seq = (uintptr_t)batch[n] & 0xFFFFFFFF;
+			/* Each consumer sees every producer's items in the order queued */
+			if (seq <= last[id]) {
+				ftlh_atomic64_inc(&out_of_order);
+			}
+			last[id] = seq;
+		}
+		ftlh_atomic64_add_and_fetch(&received, count);
+	} while (!done || count);
+
+	return NULL;
+}
+
+int main()
+{
+	pthread_t prods[2], conss[2];
+	void *values[100];
+	uintptr_t n = 0;
+
+	printf("Creating queue...\n");
+	queue = ftlh_queue_create(100);
+	if (!queue) {
+		printf("Failed to create queue.\n");
+		return FAIL;
+	}
+
+	printf("Dequeueing in bulk from an empty queue...\n");
+	if (ftlh_queue_dequeue_bulk(queue, values, 100) != 0) {
+		printf("Dequeued items from an empty queue.\n");
+		return 101;
+	}
+
+	printf("Mixing bulk and single enqueues...\n");
+	for (n = 0; n < 60; ++n) {
+		values[n] = (void *)(n + 1);
+	}
+	ftlh_queue_enqueue_bulk(queue, values, 30);
+	ftlh_queue_enqueue(queue, NULL);
+	if (ftlh_queue_enqueue_bulk(queue, values + 30, 30) != 61) {
+		printf("Queue does not hold 61 items.\n");
+		return 102;
+	}
+
+	printf("Dequeueing in bulk...\n");
+	if (ftlh_queue_dequeue_bulk(queue, values, 20) != 20) {
+		printf("Bulk dequeue did not take 20 items.\n");
+		return 103;
+	}
+	for (n = 0; n < 20; ++n) {
+		if (values[n] != (void *)(n + 1)) {
+			printf("Item %lu came out as %p.\n", n, values[n]);
+			return 104;
+		}
+	}
+	if (ftlh_queue_dequeue_bulk(queue, values, 100) != 41 || values[10] != NULL ||
+		values[11] != (void *)31 || values[40] != (void *)60)
+	{
+		printf("Bulk dequeue of the rest went wrong.\n");
+		return 105;
+	}
+	if (ftlh_queue_approx_items(queue) != 0) {
+		printf("Drained queue holds %lu items.\n", ftlh_queue_approx_items(queue));
+		return 106;
+	}
+
+	printf("Testing two bulk producers with two bulk consumers...\n");
+	for (n = 0; n < 2; ++n) {
+		pthread_create(&conss[n], NULL, consumer_thread, NULL);
+	}
+	for (n = 0; n < 2; ++n) {
+		pthread_create(&prods[n], NULL, producer_thread, (void *)n);
+	}
+	for (n = 0; n < 2; ++n) {
+		pthread_join(prods[n], NULL);
+	}
+	for (n = 0; n < 2; ++n) {
+		pthread_join(conss[n], NULL);
+	}
+
+	printf("Items received: %lu\n", ftlh_atomic64_get(&received));
+	if (ftlh_atomic64_get(&received) != 2 * ITEMS) {
+		printf("Items were lost.\n");
+		return 107;
+	}
+	if (ftlh_atomic64_get(&out_of_order)) {
+		printf("%lu items came out of order.\n", ftlh_atomic64_get(&out_of_order));
+		return 108;
+	}
+
+	/* If this doesn't segfault, then it passes. */
+	printf("Destroying queue...\n");
+	ftlh_queue_destroy(&queue);
+
+	return PASS;
+}
+
+/* For Emacs:
+ * Local Variables:
+ * mode:c
+ * indent-tabs-mode:t
+ * tab-width:4
+ * c-basic-offset:4
+ * End:
+ * For VIM:
+ * vim:set softtabstop=4 shiftwidth=4 tabstop=4 noet:
+ */
@@ -0,0 +1,137 @@
+#define _GNU_SOURCE
+#include "ftlh.h"
+#include <stdlib.h>
+#include <stdio.h>
+#include <errno.h>
+
+#define _UNUSED __attribute__ ((unused))
+#define PASS 0
+#define FAIL 100
+#define SKIP 77
+#define HARD_FAIL 99
+
+#include "ftlh_private.h"
+
+#define QUEUE_SIZE 64
+#define HIGH 48
+#define LOW 16
+
+int highs = 0, lows = 0;
+
+void watermark(ftlh_queue_t queue _UNUSED, uint_fast8_t high, void *user_data)
+{
+	if (user_data != &highs) {
+		return;
+	}
+	if (high) {
+		++highs;
+	} else {
+		++lows;
+	}
+}
+
+int main()
+{
+	ftlh_queue_t queue = NULL;
+	struct timeval start, end;
+	uint64_t usec = 0;
+	uintptr_t n = 0;
+	void *value = NULL;
+
+	queue = ftlh_queue_create(QUEUE_SIZE);
+	if (!queue) {
+		printf("Failed to create queue.\n");
+		return HARD_FAIL;
+	}
+
+	printf("Checking watermark validation...\n");
+	if (!ftlh_queue_set_watermarks(queue, LOW, HIGH, watermark, &highs) || errno != EINVAL) {
+		printf("Accepted a low watermark above the high one.\n");
+		return FAIL + 1;
+	}
+	if (!ftlh_queue_set_watermarks(queue, QUEUE_SIZE + 1, LOW, watermark, &highs)) {
+		printf("Accepted a high watermark above the queue size.\n");
+		return FAIL + 2;
+	}
+	if (ftlh_queue_set_watermarks(queue, HIGH, LOW, watermark, &highs)) {
+		printf("Rejected valid watermarks.\n");
+		return FAIL + 3;
+	}
+
+	printf("Filling the queue with try_enqueue...\n");
+	for (n = 1; n <= QUEUE_SIZE; ++n) {
+		if (!ftlh_queue_try_enqueue(queue, (void *)n)) {
+			printf("try_enqueue failed on item %lu of %d.\n", (unsigned long)n, QUEUE_SIZE);
+			return FAIL + 4;
+		}
+		if (highs != (n >= HIGH)) {
+			printf("High watermark ran %d times at %lu items.\n", highs, (unsigned long)n);
+			return FAIL + 5;
+		}
+	}
+	if (ftlh_queue_try_enqueue(queue, (void *)n)) {
+		printf("try_enqueue added to a full queue.\n");
+		return FAIL + 6;
+	}
+
+	printf("Checking that a timed enqueue gives up...\n");
+	ftlh_current_time(&start);
+	if (ftlh_queue_enqueue_timed(queue, (void *)n, 20000)) {
+		printf("Timed enqueue added to a full queue.\n");
+		return FAIL + 7;
+	}
+	ftlh_current_time(&end);
+	usec = ftlh_time_diff_usec(&end, &start);
+	if (usec < 15000 || usec > 2000000) {
+		printf("Timed enqueue gave up after %lu usec.\n", (unsigned long)usec);
+		return FAIL + 8;
+	}
+
+	printf("Draining the queue...\n");
+	for (n = 1; n <= QUEUE_SIZE; ++n) {
+		if (!ftlh_queue_try_dequeue(queue, &value) || value != (void *)n) {
+			printf("Dequeued the wrong item at %lu.\n", (unsigned long)n);
+			return FAIL + 9;
+		}
+		if (lows != (QUEUE_SIZE - n <= LOW)) {
+			printf("Low watermark ran %d times at %lu items.\n", lows, (unsigned long)(QUEUE_SIZE - n));
+			return FAIL + 10;
+		}
+	}
+
+	printf("Checking that a timed enqueue succeeds with room...\n");
+	if (!ftlh_queue_enqueue_timed(queue, (void *)1, 20000)) {
+		printf("Timed enqueue failed on an empty queue.\n");
+		return FAIL + 11;
+	}
+
+	printf("Checking watermarks with bulk operations...\n");
+	{
+		void *batch[QUEUE_SIZE] = {0};
+		ftlh_queue_enqueue_bulk(queue, batch, HIGH);
+		if (highs != 2) {
+			printf("Bulk enqueue did not cross the high watermark.\n");
+			return FAIL + 12;
+		}
+		ftlh_queue_dequeue_bulk(queue, batch, QUEUE_SIZE);
+		if (lows != 2) {
+			printf("Bulk dequeue did not cross the low watermark.\n");
+			return FAIL + 13;
+		}
+	}
+
+	ftlh_queue_destroy(&queue);
+
+	return PASS;
+}
+
+/* For Emacs:
+ * Local Variables:
+ * mode:c
+ * indent-tabs-mode:t
+ * tab-width:4
+ * c-basic-offset:4
+ * End:
+ * For VIM:
+ * vim:set softtabstop=4 shiftwidth=4 tabstop=4 noet:
+ */
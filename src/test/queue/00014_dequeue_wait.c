@@ -0,0 +1,138 @@
+#define _GNU_SOURCE
+#include "ftlh.h"
+#include <stdlib.h>
+#include <stdio.h>
+#include <pthread.h>
+
+#define _UNUSED __attribute__ ((unused))
+#define PASS 0
+#define FAIL 100
+#define SKIP 77
+#define HARD_FAIL 99
+
+#include "ftlh_private.h"
+
+#define ITEMS 50000
+#define THREADS 2
+
+ftlh_queue_t queue = NULL;
+ftlh_atomic64_t received = 0;
+ftlh_atomic64_t sum = 0;
+
+void *producer_thread(void *arg _UNUSED)
+{
+	uintptr_t n = 0;
+
+	for (n = 1; n <= ITEMS; ++n) {
+		ftlh_queue_enqueue(queue, (void *)n);
+		/* Let the consumers run dry now and then, so they go to sleep */
+		if (n % 1000 == 0) {
+			ftlh_yield(1000);
+		}
+	}
+	return NULL;
+}
+
+/* NULL is the stop marker */
+void *consumer_thread(void *arg _UNUSED)
+{
+	void *value = NULL;
+
+	for (;;) {
+		ftlh_queue_dequeue_wait(queue, &value, 0);
+		if (!value) {
+			break;
+		}
+		ftlh_atomic64_add_and_fetch(&sum, (uintptr_t)value);
+		ftlh_atomic64_inc(&received);
+	}
+	return NULL;
+}
+
+void *late_producer(void *arg _UNUSED)
+{
+	ftlh_yield(20000);
+	ftlh_queue_enqueue(queue, (void *)42);
+	return NULL;
+}
+
+int main()
+{
+	pthread_t prods[THREADS], conss[THREADS], late;
+	struct timeval start, end;
+	void *value = NULL;
+	uint64_t usec = 0;
+	int th = 0;
+
+	queue = ftlh_queue_create(1024);
+	if (!queue) {
+		printf("Failed to create queue.\n");
+		return HARD_FAIL;
+	}
+
+	printf("Checking that a wait on an empty queue times out...\n");
+	ftlh_current_time(&start);
+	if (ftlh_queue_dequeue_wait(queue, &value, 20000)) {
+		printf("Dequeued from an empty queue.\n");
+		return FAIL + 1;
+	}
+	ftlh_current_time(&end);
+	usec = ftlh_time_diff_usec(&end, &start);
+	if (usec < 15000 || usec > 2000000) {
+		printf("Wait gave up after %lu usec.\n", (unsigned long)usec);
+		return FAIL + 2;
+	}
+	if (ftlh_atomic32_get(&queue->waiters)) {
+		printf("Timed out consumer is still registered.\n");
+		return FAIL + 3;
+	}
+
+	printf("Checking that a sleeping consumer is woken by a producer...\n");
+	pthread_create(&late, NULL, late_producer, NULL);
+	ftlh_current_time(&start);
+	if (!ftlh_queue_dequeue_wait(queue, &value, 5000000) || value != (void *)42) {
+		printf("Did not receive the item.\n");
+		return FAIL + 4;
+	}
+	ftlh_current_time(&end);
+	pthread_join(late, NULL);
+	if (ftlh_time_diff_usec(&end, &start) > 2000000) {
+		printf("Consumer slept through the enqueue.\n");
+		return FAIL + 5;
+	}
+
+	printf("Checking that no wake up gets lost...\n");
+	for (th = 0; th < THREADS; ++th) {
+		pthread_create(&conss[th], NULL, consumer_thread, NULL);
+		pthread_create(&prods[th], NULL, producer_thread, NULL);
+	}
+	for (th = 0; th < THREADS; ++th) {
+		pthread_join(prods[th], NULL);
+	}
+	for (th = 0; th < THREADS; ++th) {
+		ftlh_queue_enqueue(queue, NULL);
+	}
+	for (th = 0; th < THREADS; ++th) {
+		pthread_join(conss[th], NULL);
+	}
+	if (ftlh_atomic64_get(&received) != THREADS * ITEMS ||
+		ftlh_atomic64_get(&sum) != (uint64_t)THREADS * ITEMS * (ITEMS + 1) / 2) {
+		printf("Received %lu items.\n", (unsigned long)ftlh_atomic64_get(&received));
+		return FAIL + 6;
+	}
+
+	ftlh_queue_destroy(&queue);
+
+	return PASS;
+}
+
+/* For Emacs:
+ * Local Variables:
+ * mode:c
+ * indent-tabs-mode:t
+ * tab-width:4
+ * c-basic-offset:4
+ * End:
+ * For VIM:
+ * vim:set softtabstop=4 shiftwidth=4 tabstop=4 noet:
+ */
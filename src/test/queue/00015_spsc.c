@@ -0,0 +1,114 @@
+#define _GNU_SOURCE
+#include "ftlh.h"
+#include <stdlib.h>
+#include <stdio.h>
+#include <stddef.h>
+#include <pthread.h>
+
+#define _UNUSED __attribute__ ((unused))
+#define PASS 0
+#define FAIL 100
+#define SKIP 77
+#define HARD_FAIL 99
+
+#include "ftlh_private.h"
+
+#define ITEMS 1000000
+#define LINE_OF(field) (offsetof(struct ftlh_spsc_queue_s, field) / FTLH_CACHE_LINE)
+
+ftlh_spsc_queue_t queue = NULL;
+
+void *producer_thread(void *arg _UNUSED)
+{
+	uintptr_t n = 0;
+
+	for (n = 1; n <= ITEMS; ++n) {
+		ftlh_spsc_queue_enqueue(queue, (void *)n);
+	}
+	return NULL;
+}
+
+int main()
+{
+	pthread_t producer;
+	void *value = NULL;
+	uintptr_t n = 0, expected = 1;
+
+	printf("Checking that each side has its own cache line...\n");
+	if (LINE_OF(prod_pos) != LINE_OF(prod_cached_cons) || LINE_OF(cons_pos) != LINE_OF(cons_cached_prod) ||
+		LINE_OF(prod_pos) == LINE_OF(cons_pos) || LINE_OF(prod_pos) == LINE_OF(nodes)) {
+		printf("Queue fields share cache lines.\n");
+		return FAIL + 1;
+	}
+
+	printf("Creating queue...\n");
+	queue = ftlh_spsc_queue_create(100);
+	if (!queue) {
+		printf("Failed to create queue.\n");
+		return HARD_FAIL;
+	}
+	if (ftlh_spsc_queue_size(queue) != 128) {
+		printf("Size 100 was rounded to %lu.\n", (unsigned long)ftlh_spsc_queue_size(queue));
+		return FAIL + 2;
+	}
+
+	printf("Filling and draining the queue...\n");
+	for (n = 0; n < 128; ++n) {
+		if (!ftlh_spsc_queue_try_enqueue(queue, (void *)n)) {
+			printf("Queue was full after %lu items.\n", (unsigned long)n);
+			return FAIL + 3;
+		}
+	}
+	if (ftlh_spsc_queue_try_enqueue(queue, NULL)) {
+		printf("Added to a full queue.\n");
+		return FAIL + 4;
+	}
+	if (ftlh_spsc_queue_approx_items(queue) != 128) {
+		printf("Full queue holds %lu items.\n", (unsigned long)ftlh_spsc_queue_approx_items(queue));
+		return FAIL + 5;
+	}
+	for (n = 0; n < 128; ++n) {
+		if (!ftlh_spsc_queue_try_dequeue(queue, &value) || value != (void *)n) {
+			printf("Item %lu came out as %p.\n", (unsigned long)n, value);
+			return FAIL + 6;
+		}
+	}
+	if (ftlh_spsc_queue_try_dequeue(queue, &value)) {
+		printf("Dequeued from an empty queue.\n");
+		return FAIL + 7;
+	}
+
+	printf("Passing %d items between two threads...\n", ITEMS);
+	pthread_create(&producer, NULL, producer_thread, NULL);
+	while (expected <= ITEMS) {
+		if (!ftlh_spsc_queue_try_dequeue(queue, &value)) {
+			continue;
+		}
+		if (value != (void *)expected) {
+			printf("Expected item %lu, got %p.\n", (unsigned long)expected, value);
+			return FAIL + 8;
+		}
+		++expected;
+	}
+	pthread_join(producer, NULL);
+
+	printf("Destroying queue...\n");
+	ftlh_spsc_queue_destroy(&queue);
+	if (queue) {
+		printf("Queue pointer was not cleared.\n");
+		return FAIL + 9;
+	}
+
+	return PASS;
+}
+
+/* For Emacs:
+ * Local Variables:
+ * mode:c
+ * indent-tabs-mode:t
+ * tab-width:4
+ * c-basic-offset:4
+ * End:
+ * For VIM:
+ * vim:set softtabstop=4 shiftwidth=4 tabstop=4 noet:
+ */
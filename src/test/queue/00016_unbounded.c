@@ -0,0 +1,154 @@
+#define _GNU_SOURCE
+#include "ftlh.h"
+#include <stdlib.h>
+#include <stdio.h>
+#include <pthread.h>
+
+#define _UNUSED __attribute__ ((unused))
+#define PASS 0
+#define FAIL 100
+#define SKIP 77
+#define HARD_FAIL 99
+
+#include "ftlh_private.h"
+
+#define SEGMENT 64
+#define BURST (SEGMENT * 40)
+#define ITEMS 100000
+#define THREADS 2
+
+ftlh_unbounded_queue_t queue = NULL;
+ftlh_atomic64_t producers_done = 0, received = 0, sum = 0;
+
+void *producer_thread(void *arg _UNUSED)
+{
+	uintptr_t n = 0;
+
+	for (n = 1; n <= ITEMS; ++n) {
+		if (!ftlh_unbounded_queue_enqueue(queue, (void *)n)) {
+			printf("Enqueue failed.\n");
+			exit(HARD_FAIL);
+		}
+	}
+	ftlh_atomic64_inc(&producers_done);
+	return NULL;
+}
+
+void *consumer_thread(void *arg _UNUSED)
+{
+	void *value = NULL;
+	uint_fast8_t finished = 0;
+
+	for (;;) {
+		/* Read before trying: if every producer was done by then, an empty
+		 * queue really is the end */
+		finished = (ftlh_atomic64_get(&producers_done) == THREADS);
+		if (ftlh_unbounded_queue_try_dequeue(queue, &value)) {
+			ftlh_atomic64_add_and_fetch(&sum, (uintptr_t)value);
+			ftlh_atomic64_inc(&received);
+		} else if (finished) {
+			break;
+		}
+	}
+	return NULL;
+}
+
+int main()
+{
+	pthread_t prods[THREADS], conss[THREADS];
+	void *value = NULL;
+	uintptr_t n = 0;
+	int th = 0;
+
+	queue = ftlh_unbounded_queue_create(SEGMENT);
+	if (!queue) {
+		printf("Failed to create queue.\n");
+		return HARD_FAIL;
+	}
+
+	printf("Checking an empty queue...\n");
+	if (ftlh_unbounded_queue_try_dequeue(queue, &value)) {
+		printf("Dequeued from an empty queue.\n");
+		return FAIL + 1;
+	}
+
+	printf("Absorbing a burst of %d items without a consumer...\n", BURST);
+	for (n = 0; n < BURST; ++n) {
+		if (!ftlh_unbounded_queue_enqueue(queue, (void *)n)) {
+			printf("Enqueue %lu failed.\n", (unsigned long)n);
+			return FAIL + 2;
+		}
+	}
+	if (ftlh_unbounded_queue_approx_items(queue) != BURST || ftlh_unbounded_queue_segments(queue) != BURST / SEGMENT) {
+		printf("Queue holds %lu items in %lu segments.\n", (unsigned long)ftlh_unbounded_queue_approx_items(queue),
+			   (unsigned long)ftlh_unbounded_queue_segments(queue));
+		return FAIL + 3;
+	}
+
+	printf("Draining in order...\n");
+	for (n = 0; n < BURST; ++n) {
+		if (!ftlh_unbounded_queue_try_dequeue(queue, &value) || value != (void *)n) {
+			printf("Item %lu came out as %p.\n", (unsigned long)n, value);
+			return FAIL + 4;
+		}
+	}
+	if (ftlh_unbounded_queue_try_dequeue(queue, &value)) {
+		printf("Dequeued from a drained queue.\n");
+		return FAIL + 5;
+	}
+
+	printf("Checking that drained segments were given back...\n");
+	if (ftlh_unbounded_queue_segments(queue) > FTLH_SEGMENT_POOL_MAX + 2) {
+		printf("Queue still holds %lu segments.\n", (unsigned long)ftlh_unbounded_queue_segments(queue));
+		return FAIL + 6;
+	}
+
+	printf("Checking that a second burst reuses pooled segments...\n");
+	n = ftlh_unbounded_queue_segments(queue);
+	for (th = 0; th < SEGMENT * 2; ++th) {
+		ftlh_unbounded_queue_enqueue(queue, NULL);
+	}
+	if (ftlh_unbounded_queue_segments(queue) != n) {
+		printf("Allocated new segments with %lu pooled.\n", (unsigned long)n);
+		return FAIL + 7;
+	}
+	while (ftlh_unbounded_queue_try_dequeue(queue, &value)) {
+		if (value) {
+			printf("NULL item came out as %p.\n", value);
+			return FAIL + 8;
+		}
+	}
+
+	printf("Running %d producers and %d consumers...\n", THREADS, THREADS);
+	for (th = 0; th < THREADS; ++th) {
+		pthread_create(&conss[th], NULL, consumer_thread, NULL);
+		pthread_create(&prods[th], NULL, producer_thread, NULL);
+	}
+	for (th = 0; th < THREADS; ++th) {
+		pthread_join(prods[th], NULL);
+	}
+	for (th = 0; th < THREADS; ++th) {
+		pthread_join(conss[th], NULL);
+	}
+	if (ftlh_atomic64_get(&received) != THREADS * ITEMS ||
+		ftlh_atomic64_get(&sum) != (uint64_t)THREADS * ITEMS * (ITEMS + 1) / 2) {
+		printf("Received %lu items.\n", (unsigned long)ftlh_atomic64_get(&received));
+		return FAIL + 9;
+	}
+
+	printf("Destroying queue...\n");
+	ftlh_unbounded_queue_destroy(&queue);
+
+	return PASS;
+}
+
+/* For Emacs:
+ * Local Variables:
+ * mode:c
+ * indent-tabs-mode:t
+ * tab-width:4
+ * c-basic-offset:4
+ * End:
+ * For VIM:
+ * vim:set softtabstop=4 shiftwidth=4 tabstop=4 noet:
+ */
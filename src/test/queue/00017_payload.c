@@ -0,0 +1,171 @@
+#define _GNU_SOURCE
+#include "ftlh.h"
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <pthread.h>
+
+#define _UNUSED __attribute__ ((unused))
+#define PASS 0
+#define FAIL 100
+#define SKIP 77
+#define HARD_FAIL 99
+
+#include "ftlh_private.h"
+
+#define ITEMS 100000
+#define THREADS 2
+
+struct message_s {
+	uint64_t id;
+	uint64_t check;
+	char text[16];
+};
+
+ftlh_queue_t queue = NULL;
+ftlh_atomic64_t producers_done = 0, received = 0, corrupt = 0;
+
+void *producer_thread(void *arg)
+{
+	struct message_s msg;
+	struct message_s *slot = NULL;
+	ftlh_queue_ticket_t ticket = 0;
+	uint64_t n = 0;
+
+	for (n = 1; n <= ITEMS; ++n) {
+		/* Alternate between copying and filling in place */
+		if (n & 1) {
+			memset(&msg, 0, sizeof(msg));
+			msg.id = n;
+			msg.check = ~n;
+			snprintf(msg.text, sizeof(msg.text), "%lu", (unsigned long)(uintptr_t)arg);
+			ftlh_queue_enqueue_copy(queue, &msg);
+		} else {
+			slot = ftlh_queue_reserve(queue, &ticket);
+			slot->id = n;
+			slot->check = ~n;
+			snprintf(slot->text, sizeof(slot->text), "%lu", (unsigned long)(uintptr_t)arg);
+			ftlh_queue_commit(queue, ticket);
+		}
+	}
+	ftlh_atomic64_inc(&producers_done);
+	return NULL;
+}
+
+void *consumer_thread(void *arg _UNUSED)
+{
+	struct message_s msg;
+	const struct message_s *slot = NULL;
+	ftlh_queue_ticket_t ticket = 0;
+	uint_fast8_t finished = 0, got = 0, copy = 0;
+
+	for (;;) {
+		finished = (ftlh_atomic64_get(&producers_done) == THREADS);
+		copy = !copy;
+		if (copy) {
+			got = ftlh_queue_try_dequeue_copy(queue, &msg);
+		} else if ((slot = ftlh_queue_try_acquire(queue, &ticket))) {
+			msg = *slot;
+			ftlh_queue_release(queue, ticket);
+			got = 1;
+		} else {
+			got = 0;
+		}
+
+		if (got) {
+			if (msg.check != ~msg.id || (strcmp(msg.text, "0") && strcmp(msg.text, "1"))) {
+				ftlh_atomic64_inc(&corrupt);
+			}
+			ftlh_atomic64_inc(&received);
+		} else if (finished) {
+			break;
+		}
+	}
+	return NULL;
+}
+
+int main()
+{
+	pthread_t prods[THREADS], conss[THREADS];
+	struct message_s msg, out;
+	ftlh_queue_t big = NULL;
+	uintptr_t n = 0;
+
+	printf("Checking element size limits...\n");
+	if (ftlh_queue_create_payload(64, 0) || errno != EINVAL ||
+		ftlh_queue_create_payload(64, FTLH_QUEUE_MAX_PAYLOAD + 1) || errno != EINVAL) {
+		printf("Accepted an invalid element size.\n");
+		return FAIL + 1;
+	}
+
+	printf("Checking node layout...\n");
+	queue = ftlh_queue_create_payload(64, sizeof(struct message_s));
+	big = ftlh_queue_create_payload(64, 100);
+	if (!queue || !big) {
+		printf("Failed to create queues.\n");
+		return HARD_FAIL;
+	}
+	if (ftlh_queue_elem_size(queue) != sizeof(struct message_s) || queue->node_shift != FTLH_QUEUE_PADDED_NODE_SHIFT ||
+		big->node_shift != FTLH_QUEUE_PADDED_NODE_SHIFT + 1) {
+		printf("Nodes are not whole cache lines.\n");
+		return FAIL + 2;
+	}
+	ftlh_queue_destroy(&big);
+
+	printf("Filling and draining by copy...\n");
+	for (n = 0; n < ftlh_queue_size(queue); ++n) {
+		memset(&msg, 0, sizeof(msg));
+		msg.id = n;
+		if (!ftlh_queue_try_enqueue_copy(queue, &msg)) {
+			printf("Queue was full after %lu elements.\n", (unsigned long)n);
+			return FAIL + 3;
+		}
+	}
+	if (ftlh_queue_try_enqueue_copy(queue, &msg)) {
+		printf("Copied into a full queue.\n");
+		return FAIL + 4;
+	}
+	for (n = 0; n < ftlh_queue_size(queue); ++n) {
+		if (!ftlh_queue_try_dequeue_copy(queue, &out) || out.id != n) {
+			printf("Element %lu came out wrong.\n", (unsigned long)n);
+			return FAIL + 5;
+		}
+	}
+	if (ftlh_queue_try_dequeue_copy(queue, &out) || ftlh_queue_try_acquire(queue, &n)) {
+		printf("Dequeued from an empty queue.\n");
+		return FAIL + 6;
+	}
+
+	printf("Running %d producers and %d consumers...\n", THREADS, THREADS);
+	for (n = 0; n < THREADS; ++n) {
+		pthread_create(&conss[n], NULL, consumer_thread, NULL);
+		pthread_create(&prods[n], NULL, producer_thread, (void *)n);
+	}
+	for (n = 0; n < THREADS; ++n) {
+		pthread_join(prods[n], NULL);
+	}
+	for (n = 0; n < THREADS; ++n) {
+		pthread_join(conss[n], NULL);
+	}
+	if (ftlh_atomic64_get(&received) != THREADS * ITEMS || ftlh_atomic64_get(&corrupt)) {
+		printf("Received %lu elements, %lu corrupt.\n", (unsigned long)ftlh_atomic64_get(&received),
+			   (unsigned long)ftlh_atomic64_get(&corrupt));
+		return FAIL + 7;
+	}
+
+	ftlh_queue_destroy(&queue);
+
+	return PASS;
+}
+
+/* For Emacs:
+ * Local Variables:
+ * mode:c
+ * indent-tabs-mode:t
+ * tab-width:4
+ * c-basic-offset:4
+ * End:
+ * For VIM:
+ * vim:set softtabstop=4 shiftwidth=4 tabstop=4 noet:
+ */
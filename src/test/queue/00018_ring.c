@@ -0,0 +1,228 @@
+#define _GNU_SOURCE
+#include "ftlh.h"
+#include <stdlib.h>
+#include <stdio.h>
+#include <stddef.h>
+#include <pthread.h>
+
+#define _UNUSED __attribute__ ((unused))
+#define PASS 0
+#define FAIL 100
+#define SKIP 77
+#define HARD_FAIL 99
+
+#include "ftlh_private.h"
+
+#define PRODUCERS 2
+#define PER_PRODUCER 100000
+#define ITEMS (PRODUCERS * PER_PRODUCER)
+
+ftlh_ring_t ring = NULL;
+ftlh_ring_consumer_t stage_a = NULL, stage_b = NULL, stage_c = NULL;
+unsigned char *seen_a = NULL, *seen_b = NULL;
+int result_a = PASS, result_b = PASS, result_c = PASS;
+
+void *producer_thread(void *arg)
+{
+	uintptr_t n = 0, base = (uintptr_t)arg * PER_PRODUCER;
+
+	for (n = 0; n < PER_PRODUCER; ++n) {
+		ftlh_ring_publish(ring, (void *)(base + n));
+	}
+	return NULL;
+}
+
+/* Reads every item once, in order per producer; marks it in seen if given and
+ * checks it is marked in both deps if asked. Marking stages only advance once
+ * they have marked the batch. */
+static int consume(ftlh_ring_consumer_t consumer, unsigned char *seen, uint_fast8_t check_deps)
+{
+	void *values[16];
+	uintptr_t last[PRODUCERS], value = 0, producer = 0;
+	uint_fast64_t got = 0, n = 0, count = 0;
+
+	for (n = 0; n < PRODUCERS; ++n) {
+		last[n] = (uintptr_t)-1;
+	}
+
+	while (got < ITEMS) {
+		count = seen ? ftlh_ring_peek_batch(consumer, values, 16) : ftlh_ring_read_batch(consumer, values, 16);
+		if (!count) {
+			ftlh_yield(0);
+			continue;
+		}
+		for (n = 0; n < count; ++n) {
+			value = (uintptr_t)values[n];
+			producer = value / PER_PRODUCER;
+			if (producer >= PRODUCERS || (last[producer] != (uintptr_t)-1 && value != last[producer] + 1)) {
+				printf("Item %lu out of order.\n", (unsigned long)value);
+				return FAIL + 10;
+			}
+			last[producer] = value;
+			if (check_deps && (!seen_a[value] || !seen_b[value])) {
+				printf("Item %lu was read before its dependencies read it.\n", (unsigned long)value);
+				return FAIL + 11;
+			}
+			if (seen) {
+				seen[value] = 1;
+			}
+		}
+		if (seen) {
+			ftlh_ring_advance(consumer, count);
+		}
+		got += count;
+	}
+	return PASS;
+}
+
+void *stage_a_thread(void *arg _UNUSED)
+{
+	result_a = consume(stage_a, seen_a, 0);
+	return NULL;
+}
+
+void *stage_b_thread(void *arg _UNUSED)
+{
+	result_b = consume(stage_b, seen_b, 0);
+	return NULL;
+}
+
+void *stage_c_thread(void *arg _UNUSED)
+{
+	result_c = consume(stage_c, NULL, 1);
+	return NULL;
+}
+
+int main()
+{
+	pthread_t producers[PRODUCERS], threads[3];
+	ftlh_ring_consumer_t deps[2];
+	void *value = NULL;
+	uintptr_t n = 0;
+
+	printf("Creating ring...\n");
+	ring = ftlh_ring_create(100);
+	if (!ring) {
+		printf("Failed to create ring.\n");
+		return HARD_FAIL;
+	}
+
+	stage_a = ftlh_ring_add_consumer(ring, NULL, 0);
+	stage_b = ftlh_ring_add_consumer(ring, NULL, 0);
+	deps[0] = stage_a;
+	deps[1] = stage_b;
+	stage_c = ftlh_ring_add_consumer(ring, deps, 2);
+	if (!stage_a || !stage_b || !stage_c) {
+		printf("Failed to add consumers.\n");
+		return HARD_FAIL;
+	}
+
+	printf("Checking that producers gate on the slowest consumer...\n");
+	for (n = 0; n < 128; ++n) {
+		if (!ftlh_ring_try_publish(ring, (void *)n)) {
+			printf("Ring was full after %lu items.\n", (unsigned long)n);
+			return FAIL + 1;
+		}
+	}
+	if (ftlh_ring_try_publish(ring, NULL)) {
+		printf("Published to a full ring.\n");
+		return FAIL + 2;
+	}
+
+	printf("Checking that a dependent stage waits for its dependencies...\n");
+	if (ftlh_ring_try_read(stage_c, &value)) {
+		printf("Stage C read before stages A and B.\n");
+		return FAIL + 3;
+	}
+	for (n = 0; n < 128; ++n) {
+		if (!ftlh_ring_try_read(stage_a, &value) || value != (void *)n) {
+			printf("Stage A read item %lu as %p.\n", (unsigned long)n, value);
+			return FAIL + 4;
+		}
+	}
+	if (ftlh_ring_try_read(stage_c, &value) || ftlh_ring_try_publish(ring, NULL)) {
+		printf("Stage B's cursor was ignored.\n");
+		return FAIL + 5;
+	}
+	if (ftlh_ring_peek_batch(stage_b, NULL, 20) != 20 || ftlh_ring_try_read(stage_c, &value)) {
+		printf("Peeking moved stage B's cursor.\n");
+		return FAIL + 6;
+	}
+	ftlh_ring_advance(stage_b, 10);
+	for (n = 0; n < 10; ++n) {
+		if (!ftlh_ring_try_read(stage_c, &value) || value != (void *)n) {
+			printf("Stage C read item %lu as %p.\n", (unsigned long)n, value);
+			return FAIL + 7;
+		}
+	}
+	if (ftlh_ring_try_read(stage_c, &value)) {
+		printf("Stage C read past stage B.\n");
+		return FAIL + 8;
+	}
+	for (n = 0; n < 10; ++n) {
+		if (!ftlh_ring_try_publish(ring, NULL)) {
+			printf("Consumed nodes were not reused.\n");
+			return FAIL + 9;
+		}
+	}
+	if (ftlh_ring_try_publish(ring, NULL)) {
+		printf("Published over an unread node.\n");
+		return FAIL + 9;
+	}
+	ftlh_ring_destroy(&ring);
+	if (ring) {
+		printf("Destroy did not clear the pointer.\n");
+		return FAIL + 9;
+	}
+
+	printf("Fanning out %d items from %d producers to a diamond of stages...\n", ITEMS, PRODUCERS);
+	ring = ftlh_ring_create(256);
+	seen_a = calloc(ITEMS, 1);
+	seen_b = calloc(ITEMS, 1);
+	if (!ring || !seen_a || !seen_b) {
+		return HARD_FAIL;
+	}
+	stage_a = ftlh_ring_add_consumer(ring, NULL, 0);
+	stage_b = ftlh_ring_add_consumer(ring, NULL, 0);
+	deps[0] = stage_a;
+	deps[1] = stage_b;
+	stage_c = ftlh_ring_add_consumer(ring, deps, 2);
+	if (!stage_a || !stage_b || !stage_c) {
+		return HARD_FAIL;
+	}
+
+	pthread_create(&threads[0], NULL, stage_a_thread, NULL);
+	pthread_create(&threads[1], NULL, stage_b_thread, NULL);
+	pthread_create(&threads[2], NULL, stage_c_thread, NULL);
+	for (n = 0; n < PRODUCERS; ++n) {
+		pthread_create(&producers[n], NULL, producer_thread, (void *)n);
+	}
+	for (n = 0; n < PRODUCERS; ++n) {
+		pthread_join(producers[n], NULL);
+	}
+	for (n = 0; n < 3; ++n) {
+		pthread_join(threads[n], NULL);
+	}
+
+	if (result_a != PASS || result_b != PASS || result_c != PASS) {
+		return result_a != PASS ? result_a : result_b != PASS ? result_b : result_c;
+	}
+
+	ftlh_ring_destroy(&ring);
+	free(seen_a);
+	free(seen_b);
+
+	printf("PASSED\n");
+	return PASS;
+}
+
+/* For Emacs:
+ * Local Variables:
+ * mode:c
+ * indent-tabs-mode:t
+ * tab-width:4
+ * c-basic-offset:4
+ * End:
+ * For VIM:
+ * vim:set softtabstop=4 shiftwidth=4 tabstop=4 noet:
+ */
@@ -0,0 +1,80 @@
+
+#define _GNU_SOURCE
+#include "ftlh.h"
+#include <stdlib.h>
+#include <stdio.h>
+
+#define _UNUSED __attribute__ ((unused))
+#define PASS 0
+#define FAIL 100
+#define SKIP 77
+#define HARD_FAIL 99
+
+#include "ftlh_private.h"
+
+int main()
+{
+	ftlh_hash_table_t table = NULL;
+	struct ftlh_slot_array_s *array = NULL;
+
+	printf("Starting FTLH library...\n");
+	ftlh_start();
+
+	printf("Creating hash table...\n");
+	table = ftlh_hash_table_create(1000);
+	if (!table) {
+		printf("Failed to create hash table.\n");
+		return FAIL;
+	}
+
+	printf("Checking table registration...\n");
+	if (ftlh_atomic_ptr_get(&ftlh_globals.tables[table->id]) != table || table->id == 0) {
+		printf("Table is not registered with the workers.\n");
+		return 101;
+	}
+
+	printf("Checking capacity...\n");
+	if (ftlh_hash_table_capacity(table) * 3 / 4 <= 1000 ||
+		(ftlh_hash_table_capacity(table) & (ftlh_hash_table_capacity(table) - 1)) != 0)
+	{
+		printf("Table capacity is wrong: %lu\n", ftlh_hash_table_capacity(table));
+		return 102;
+	}
+
+	printf("Checking slot array alignment...\n");
+	array = ftlh_atomic_ptr_get(&table->slots);
+	if (((uintptr_t)array->slots & (FTLH_CACHE_LINE - 1)) != 0) {
+		printf("Slots are not cache line aligned.\n");
+		return 103;
+	}
+
+	printf("Checking that the table is empty...\n");
+	if (ftlh_hash_table_items(table) != 0 || ftlh_hash_table_load_factor(table) != 0) {
+		printf("New table is not empty.\n");
+		return 104;
+	}
+
+	printf("Destroying hash table...\n");
+	ftlh_hash_table_destroy(&table);
+	if (table) {
+		printf("Destroyed table was not cleared.\n");
+		return 105;
+	}
+
+	printf("Stopping FTLH...\n");
+	ftlh_stop();
+
+	printf("Success.\n");
+	return PASS;
+}
+
+/* For Emacs:
+ * Local Variables:
+ * mode:c
+ * indent-tabs-mode:t
+ * tab-width:4
+ * c-basic-offset:4
+ * End:
+ * For VIM:
+ * vim:set softtabstop=4 shiftwidth=4 tabstop=4 noet:
+ */
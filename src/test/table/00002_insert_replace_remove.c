@@ -0,0 +1,110 @@
+
+#define _GNU_SOURCE
+#include "ftlh.h"
+#include <stdlib.h>
+#include <stdio.h>
+
+#define _UNUSED __attribute__ ((unused))
+#define PASS 0
+#define FAIL 100
+#define SKIP 77
+#define HARD_FAIL 99
+
+#include "ftlh_private.h"
+
+int main()
+{
+	ftlh_hash_table_t table = NULL;
+	ftlh_key_t key = NULL;
+	void *value = NULL;
+
+	printf("Starting FTLH library...\n");
+	ftlh_start();
+
+	printf("Creating hash table...\n");
+	table = ftlh_hash_table_create(16);
+	if (!table) {
+		printf("Failed to create hash table.\n");
+		return FAIL;
+	}
+
+	printf("Inserting a key...\n");
+	key = ftlh_build_key_concat("alpha", NULL);
+	if (!ftlh_insert(table, key, (void *)1)) {
+		printf("Insert failed.\n");
+		return 101;
+	}
+	if (key->owner != table || ftlh_hash_table_items(table) != 1) {
+		printf("Inserted key is not owned by the table.\n");
+		return 102;
+	}
+
+	printf("Inserting a duplicate key...\n");
+	key = ftlh_build_key_concat("alpha", NULL);
+	if (ftlh_insert(table, key, (void *)2)) {
+		printf("Duplicate insert succeeded.\n");
+		return 103;
+	}
+	if (key->owner || ftlh_hash_table_items(table) != 1) {
+		printf("Failed insert changed the table.\n");
+		return 104;
+	}
+
+	printf("Replacing the key...\n");
+	value = ftlh_replace(table, key, (void *)3);
+	if (value != (void *)1 || key->owner != table) {
+		printf("Replace returned %p instead of the old value.\n", value);
+		return 105;
+	}
+
+	printf("Replacing a missing key...\n");
+	key = ftlh_build_key_concat("beta", NULL);
+	value = ftlh_replace(table, key, (void *)4);
+	if (value != (void *)4 || ftlh_hash_table_items(table) != 2) {
+		printf("Replace did not insert the missing key.\n");
+		return 106;
+	}
+
+	printf("Removing a key...\n");
+	key = ftlh_build_key_concat("alpha", NULL);
+	value = ftlh_remove(table, key);
+	if (value != (void *)3 || ftlh_hash_table_items(table) != 1) {
+		printf("Remove returned %p instead of the stored value.\n", value);
+		return 107;
+	}
+
+	printf("Removing the key again...\n");
+	value = ftlh_remove(table, key);
+	if (value != NULL) {
+		printf("Second remove found the key.\n");
+		return 108;
+	}
+	ftlh_key_free(&key);
+
+	printf("Reinserting the removed key...\n");
+	key = ftlh_build_key_concat("alpha", NULL);
+	if (!ftlh_insert(table, key, (void *)5)) {
+		printf("Reinsert failed.\n");
+		return 109;
+	}
+
+	printf("Destroying hash table...\n");
+	ftlh_hash_table_destroy(&table);
+
+	printf("Stopping FTLH...\n");
+	ftlh_stop();
+
+	printf("Success.\n");
+	return PASS;
+}
+
+/* For Emacs:
+ * Local Variables:
+ * mode:c
+ * indent-tabs-mode:t
+ * tab-width:4
+ * c-basic-offset:4
+ * End:
+ * For VIM:
+ * vim:set softtabstop=4 shiftwidth=4 tabstop=4 noet:
+ */
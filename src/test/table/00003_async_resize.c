@@ -0,0 +1,116 @@
+
+#define _GNU_SOURCE
+#include "ftlh.h"
+#include <stdlib.h>
+#include <stdio.h>
+
+#define _UNUSED __attribute__ ((unused))
+#define PASS 0
+#define FAIL 100
+#define SKIP 77
+#define HARD_FAIL 99
+
+#include "ftlh_private.h"
+
+#define ITEM_COUNT 100000
+
+ftlh_atomic64_t inserted = 0, failed = 0;
+
+void insert_done(ftlh_hash_table_t _UNUSED table, ftlh_key_t _UNUSED key, void _UNUSED *value, uint_fast8_t status)
+{
+	if (status) {
+		ftlh_atomic64_inc(&inserted);
+	} else {
+		ftlh_atomic64_inc(&failed);
+	}
+}
+
+int main()
+{
+	ftlh_hash_table_t table = NULL;
+	ftlh_key_t key = NULL;
+	uint64_t n = 0, capacity = 0;
+
+	printf("Starting FTLH library...\n");
+	ftlh_start();
+
+	printf("Creating a small hash table...\n");
+	table = ftlh_hash_table_create(16);
+	if (!table) {
+		printf("Failed to create hash table.\n");
+		return FAIL;
+	}
+	capacity = ftlh_hash_table_capacity(table);
+
+	printf("Inserting %d keys asynchronously...\n", ITEM_COUNT);
+	for (n = 0; n < ITEM_COUNT; ++n) {
+		key = ftlh_build_key_binary(&n, sizeof(n));
+		ftlh_insert_async(table, key, (void *)(uintptr_t)(n + 1), insert_done);
+	}
+
+	/* Insert one duplicate so a failure callback is exercised too */
+	n = 0;
+	key = ftlh_build_key_binary(&n, sizeof(n));
+	ftlh_insert_async(table, key, NULL, insert_done);
+
+	while (ftlh_atomic64_get(&inserted) + ftlh_atomic64_get(&failed) != ITEM_COUNT + 1) {
+		ftlh_yield(1000);
+	}
+
+	printf("Checking counts...\n");
+	if (ftlh_atomic64_get(&inserted) != ITEM_COUNT || ftlh_atomic64_get(&failed) != 1 ||
+		ftlh_hash_table_items(table) != ITEM_COUNT)
+	{
+		printf("Inserted %lu, failed %lu, items %lu\n", ftlh_atomic64_get(&inserted),
+			   ftlh_atomic64_get(&failed), ftlh_hash_table_items(table));
+		return 101;
+	}
+
+	printf("Checking that the table grew...\n");
+	printf("Capacity %lu -> %lu, load factor %lf\n", capacity, ftlh_hash_table_capacity(table),
+		   ftlh_hash_table_load_factor(table));
+	if (ftlh_hash_table_capacity(table) <= capacity || ftlh_hash_table_load_factor(table) > 0.75) {
+		printf("Table did not grow correctly.\n");
+		return 102;
+	}
+
+	printf("Removing every other key...\n");
+	for (n = 0; n < ITEM_COUNT; n += 2) {
+		key = ftlh_build_key_binary(&n, sizeof(n));
+		ftlh_remove_async(table, key);
+	}
+
+	/* A synchronous call on the same table finishes after all earlier requests */
+	n = 1;
+	key = ftlh_build_key_binary(&n, sizeof(n));
+	if (ftlh_remove(table, key) != (void *)2) {
+		printf("Remove returned the wrong value.\n");
+		return 103;
+	}
+	ftlh_key_free(&key);
+
+	if (ftlh_hash_table_items(table) != ITEM_COUNT / 2 - 1) {
+		printf("Items after removal: %lu\n", ftlh_hash_table_items(table));
+		return 104;
+	}
+
+	printf("Destroying hash table...\n");
+	ftlh_hash_table_destroy(&table);
+
+	printf("Stopping FTLH...\n");
+	ftlh_stop();
+
+	printf("Success.\n");
+	return PASS;
+}
+
+/* For Emacs:
+ * Local Variables:
+ * mode:c
+ * indent-tabs-mode:t
+ * tab-width:4
+ * c-basic-offset:4
+ * End:
+ * For VIM:
+ * vim:set softtabstop=4 shiftwidth=4 tabstop=4 noet:
+ */
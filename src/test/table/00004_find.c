@@ -0,0 +1,93 @@
+
+#define _GNU_SOURCE
+#include "ftlh.h"
+#include <stdlib.h>
+#include <stdio.h>
+
+#define _UNUSED __attribute__ ((unused))
+#define PASS 0
+#define FAIL 100
+#define SKIP 77
+#define HARD_FAIL 99
+
+#include "ftlh_private.h"
+
+int main()
+{
+	ftlh_hash_table_t table = NULL;
+	ftlh_key_t key = NULL, lookup = NULL;
+	void *value = NULL;
+
+	printf("Starting FTLH library...\n");
+	ftlh_start();
+
+	printf("Creating hash table...\n");
+	table = ftlh_hash_table_create(16);
+	if (!table) {
+		printf("Failed to create hash table.\n");
+		return FAIL;
+	}
+
+	lookup = ftlh_build_key_concat("alpha", NULL);
+
+	printf("Looking up a key in an empty table...\n");
+	if (ftlh_find(table, lookup) != NULL || ftlh_find_hashed(table, lookup, ftlh_hash_key(lookup), NULL)) {
+		printf("Found a key in an empty table.\n");
+		return 101;
+	}
+
+	printf("Looking up an inserted key...\n");
+	key = ftlh_build_key_concat("alpha", NULL);
+	ftlh_insert(table, key, (void *)1);
+	if (ftlh_find(table, lookup) != (void *)1) {
+		printf("Inserted key was not found.\n");
+		return 102;
+	}
+
+	printf("Looking up a key stored with a NULL value...\n");
+	key = ftlh_build_key_concat("beta", NULL);
+	ftlh_insert(table, key, NULL);
+	key = ftlh_build_key_concat("beta", NULL);
+	value = (void *)1;
+	if (!ftlh_find_hashed(table, key, ftlh_hash_key(key), &value) || value != NULL) {
+		printf("Key with a NULL value was not found.\n");
+		return 103;
+	}
+	ftlh_key_free(&key);
+
+	printf("Looking up a replaced key...\n");
+	key = ftlh_build_key_concat("alpha", NULL);
+	ftlh_replace(table, key, (void *)2);
+	if (ftlh_find(table, lookup) != (void *)2) {
+		printf("Replaced value was not found.\n");
+		return 104;
+	}
+
+	printf("Looking up a removed key...\n");
+	ftlh_remove(table, lookup);
+	if (ftlh_find_hashed(table, lookup, ftlh_hash_key(lookup), NULL)) {
+		printf("Removed key was found.\n");
+		return 105;
+	}
+	ftlh_key_free(&lookup);
+
+	printf("Destroying hash table...\n");
+	ftlh_hash_table_destroy(&table);
+
+	printf("Stopping FTLH...\n");
+	ftlh_stop();
+
+	printf("Success.\n");
+	return PASS;
+}
+
+/* For Emacs:
+ * Local Variables:
+ * mode:c
+ * indent-tabs-mode:t
+ * tab-width:4
+ * c-basic-offset:4
+ * End:
+ * For VIM:
+ * vim:set softtabstop=4 shiftwidth=4 tabstop=4 noet:
+ */
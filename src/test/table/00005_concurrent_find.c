@@ -0,0 +1,129 @@
+
+#define _GNU_SOURCE
+#include "ftlh.h"
+#include <stdlib.h>
+#include <stdio.h>
+
+#define _UNUSED __attribute__ ((unused))
+#define PASS 0
+#define FAIL 100
+#define SKIP 77
+#define HARD_FAIL 99
+
+#include "ftlh_private.h"
+#include <pthread.h>
+
+#define KEY_COUNT 20000
+#define STABLE_COUNT 1000
+#define READER_COUNT 4
+#define WRITE_ROUNDS 10
+
+ftlh_hash_table_t table = NULL;
+ftlh_atomic64_t writer_done = 0, bad_reads = 0, lookups = 0;
+
+void *reader_thread(void *arg)
+{
+	uint64_t seed = (uintptr_t)arg, n = 0, count = 0;
+	ftlh_key_t key = NULL;
+	void *value = NULL;
+
+	while (!ftlh_atomic64_get(&writer_done)) {
+		seed = seed * 6364136223846793005ULL + 1442695040888963407ULL;
+		n = (seed >> 33) % KEY_COUNT;
+		key = ftlh_build_key_binary(&n, sizeof(n));
+
+		if (ftlh_find_hashed(table, key, ftlh_hash_key(key), &value)) {
+			if (value != (void *)(uintptr_t)(n + 1)) {
+				ftlh_atomic64_inc(&bad_reads);
+			}
+		} else if (n < STABLE_COUNT) {
+			/* These keys are replaced but never removed */
+			ftlh_atomic64_inc(&bad_reads);
+		}
+
+		ftlh_key_free(&key);
+		++count;
+	}
+	ftlh_atomic64_add_and_fetch(&lookups, count);
+
+	return NULL;
+}
+
+int main()
+{
+	pthread_t readers[READER_COUNT];
+	ftlh_key_t key = NULL;
+	uint64_t n = 0, round = 0;
+
+	printf("Starting FTLH library...\n");
+	ftlh_start();
+
+	printf("Creating a small hash table so readers race with resizes...\n");
+	table = ftlh_hash_table_create(16);
+	if (!table) {
+		printf("Failed to create hash table.\n");
+		return FAIL;
+	}
+
+	for (n = 0; n < STABLE_COUNT; ++n) {
+		key = ftlh_build_key_binary(&n, sizeof(n));
+		ftlh_insert_async(table, key, (void *)(uintptr_t)(n + 1), NULL);
+	}
+	key = ftlh_build_key_binary(&n, sizeof(n));
+	ftlh_remove(table, key);
+	ftlh_key_free(&key);
+
+	printf("Starting %d reader threads...\n", READER_COUNT);
+	for (n = 0; n < READER_COUNT; ++n) {
+		pthread_create(&readers[n], NULL, reader_thread, (void *)(uintptr_t)(n + 1));
+	}
+
+	printf("Inserting, replacing and removing keys under the readers...\n");
+	for (round = 0; round < WRITE_ROUNDS; ++round) {
+		for (n = STABLE_COUNT; n < KEY_COUNT; ++n) {
+			key = ftlh_build_key_binary(&n, sizeof(n));
+			if (round % 2 == 0) {
+				ftlh_insert_async(table, key, (void *)(uintptr_t)(n + 1), NULL);
+			} else {
+				ftlh_remove_async(table, key);
+			}
+		}
+
+		/* Synchronous replaces also wait for the async requests above */
+		for (n = round; n < STABLE_COUNT; n += STABLE_COUNT / 10) {
+			key = ftlh_build_key_binary(&n, sizeof(n));
+			ftlh_replace(table, key, (void *)(uintptr_t)(n + 1));
+		}
+	}
+
+	ftlh_atomic64_set(&writer_done, 1);
+	for (n = 0; n < READER_COUNT; ++n) {
+		pthread_join(readers[n], NULL);
+	}
+
+	printf("Lookups: %lu, bad reads: %lu\n", ftlh_atomic64_get(&lookups), ftlh_atomic64_get(&bad_reads));
+	if (ftlh_atomic64_get(&bad_reads) != 0) {
+		printf("Readers saw inconsistent values.\n");
+		return 101;
+	}
+
+	printf("Destroying hash table...\n");
+	ftlh_hash_table_destroy(&table);
+
+	printf("Stopping FTLH...\n");
+	ftlh_stop();
+
+	printf("Success.\n");
+	return PASS;
+}
+
+/* For Emacs:
+ * Local Variables:
+ * mode:c
+ * indent-tabs-mode:t
+ * tab-width:4
+ * c-basic-offset:4
+ * End:
+ * For VIM:
+ * vim:set softtabstop=4 shiftwidth=4 tabstop=4 noet:
+ */
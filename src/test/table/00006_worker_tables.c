@@ -0,0 +1,106 @@
+#define _GNU_SOURCE
+#include "ftlh.h"
+#include <stdlib.h>
+#include <stdio.h>
+
+#define _UNUSED __attribute__ ((unused))
+#define PASS 0
+#define FAIL 100
+#define SKIP 77
+#define HARD_FAIL 99
+
+#include "ftlh_private.h"
+
+#define THREADS 2
+#define TABLES 6
+
+static uint64_t list_count(uint_fast32_t thread)
+{
+	struct ftlh_table_list_s *list = ftlh_atomic_ptr_get(&ftlh_globals.threads[thread].tables);
+	return list ? list->count : 0;
+}
+
+int main()
+{
+	struct ftlh_hash_table_s *tables[TABLES];
+	ftlh_key_t key = NULL;
+	uint64_t n = 0;
+
+	printf("Starting FTLH library with %d workers...\n", THREADS);
+	ftlh_start_advanced(1024 * 1024, THREADS);
+
+	printf("Creating %d hash tables...\n", TABLES);
+	for (n = 0; n < TABLES; ++n) {
+		tables[n] = ftlh_hash_table_create(100);
+		if (!tables[n]) {
+			printf("Failed to create hash table.\n");
+			return FAIL;
+		}
+	}
+
+	printf("Checking the worker table lists...\n");
+	if (list_count(0) != TABLES / THREADS || list_count(1) != TABLES / THREADS) {
+		printf("Tables are not spread over the workers: %lu / %lu\n", list_count(0), list_count(1));
+		return 101;
+	}
+
+	printf("Checking that every table is serviced...\n");
+	for (n = 0; n < TABLES; ++n) {
+		key = ftlh_build_key_printf("table-%lu", n);
+		if (!ftlh_insert(tables[n], key, (void *)(uintptr_t)(n + 1))) {
+			printf("Insert into table %lu failed.\n", n);
+			return 102;
+		}
+	}
+
+	printf("Destroying the tables of worker 0...\n");
+	for (n = 0; n < TABLES; ++n) {
+		if (tables[n]->worker == &ftlh_globals.threads[0]) {
+			ftlh_hash_table_destroy(&tables[n]);
+		}
+	}
+	if (list_count(0) != 0 || list_count(1) != TABLES / THREADS) {
+		printf("Destroyed tables are still listed: %lu / %lu\n", list_count(0), list_count(1));
+		return 103;
+	}
+
+	printf("Creating a table on the emptied worker...\n");
+	for (n = 0; n < TABLES; ++n) {
+		if (!tables[n]) {
+			tables[n] = ftlh_hash_table_create(100);
+			break;
+		}
+	}
+	if (!tables[n] || tables[n]->worker != &ftlh_globals.threads[0] || list_count(0) != 1) {
+		printf("New table did not go to the least loaded worker.\n");
+		return 104;
+	}
+
+	printf("Destroying the remaining tables...\n");
+	for (n = 0; n < TABLES; ++n) {
+		if (tables[n]) {
+			ftlh_hash_table_destroy(&tables[n]);
+		}
+	}
+	if (list_count(0) != 0 || list_count(1) != 0) {
+		printf("Worker lists are not empty.\n");
+		return 105;
+	}
+
+	printf("Stopping FTLH...\n");
+	ftlh_stop();
+
+	printf("Success.\n");
+	return PASS;
+}
+
+/* For Emacs:
+ * Local Variables:
+ * mode:c
+ * indent-tabs-mode:t
+ * tab-width:4
+ * c-basic-offset:4
+ * End:
+ * For VIM:
+ * vim:set softtabstop=4 shiftwidth=4 tabstop=4 noet:
+ */
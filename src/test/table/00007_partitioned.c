@@ -0,0 +1,153 @@
+#define _GNU_SOURCE
+#include "ftlh.h"
+#include <stdlib.h>
+#include <stdio.h>
+
+#define _UNUSED __attribute__ ((unused))
+#define PASS 0
+#define FAIL 100
+#define SKIP 77
+#define HARD_FAIL 99
+
+#include "ftlh_private.h"
+
+#define THREADS 4
+#define PART_BITS 2
+#define KEY_COUNT 10000
+
+ftlh_hash_table_t table = NULL;
+ftlh_atomic64_t callbacks = 0;
+ftlh_atomic64_t wrong_table = 0;
+
+static void insert_done(ftlh_hash_table_t cb_table, ftlh_key_t key _UNUSED, void *value _UNUSED, uint_fast8_t status)
+{
+	if (cb_table != table || !status) {
+		ftlh_atomic64_inc(&wrong_table);
+	}
+	ftlh_atomic64_inc(&callbacks);
+}
+
+int main()
+{
+	ftlh_key_t key = NULL;
+	uint64_t n = 0, m = 0, per_part = 0;
+
+	printf("Starting FTLH library with %d workers...\n", THREADS);
+	ftlh_start_advanced(1024 * 1024, THREADS);
+
+	printf("Rejecting too many partition bits...\n");
+	if (ftlh_hash_table_create_partitioned(100, FTLH_MAX_PARTITION_BITS + 1)) {
+		printf("Created a table with too many partitions.\n");
+		return 101;
+	}
+
+	printf("Creating a table with %d partitions...\n", 1 << PART_BITS);
+	table = ftlh_hash_table_create_partitioned(KEY_COUNT, PART_BITS);
+	if (!table) {
+		printf("Failed to create hash table.\n");
+		return FAIL;
+	}
+
+	printf("Checking that every partition has its own worker...\n");
+	for (n = 0; n < (1 << PART_BITS); ++n) {
+		if (table->parts[n]->parent != table) {
+			printf("Partition %lu does not point back to the table.\n", n);
+			return 102;
+		}
+		for (m = 0; m < n; ++m) {
+			if (table->parts[n]->worker == table->parts[m]->worker) {
+				printf("Partitions %lu and %lu share a worker.\n", m, n);
+				return 103;
+			}
+		}
+	}
+
+	printf("Inserting %d keys asynchronously...\n", KEY_COUNT);
+	for (n = 0; n < KEY_COUNT; ++n) {
+		ftlh_insert_async(table, ftlh_build_key_printf("key-%lu", n), (void *)(uintptr_t)(n + 1), insert_done);
+	}
+	while (ftlh_atomic64_get(&callbacks) != KEY_COUNT) {
+		ftlh_yield(1000);
+	}
+	if (ftlh_atomic64_get(&wrong_table)) {
+		printf("Callbacks did not receive the partitioned table.\n");
+		return 104;
+	}
+	if (ftlh_hash_table_items(table) != KEY_COUNT) {
+		printf("Table holds %lu items instead of %d.\n", ftlh_hash_table_items(table), KEY_COUNT);
+		return 105;
+	}
+
+	printf("Checking that the keys are spread over the partitions...\n");
+	for (n = 0; n < (1 << PART_BITS); ++n) {
+		per_part = ftlh_hash_table_items(table->parts[n]);
+		if (per_part < KEY_COUNT / (1 << PART_BITS) / 2) {
+			printf("Partition %lu only holds %lu keys.\n", n, per_part);
+			return 106;
+		}
+	}
+
+	printf("Finding every key...\n");
+	for (n = 0; n < KEY_COUNT; ++n) {
+		key = ftlh_build_key_printf("key-%lu", n);
+		if (ftlh_find(table, key) != (void *)(uintptr_t)(n + 1)) {
+			printf("Key %lu was not found.\n", n);
+			return 107;
+		}
+		ftlh_key_free(&key);
+	}
+
+	printf("Replacing and removing through the table...\n");
+	key = ftlh_build_key_printf("key-%lu", (uint64_t)7);
+	if (ftlh_replace(table, key, (void *)1234) != (void *)8) {
+		printf("Replace did not return the old value.\n");
+		return 108;
+	}
+	key = ftlh_build_key_printf("key-%lu", (uint64_t)7);
+	if (ftlh_remove(table, key) != (void *)1234 || ftlh_find(table, key) != NULL) {
+		printf("Remove did not return the replaced value.\n");
+		return 109;
+	}
+	ftlh_key_free(&key);
+	if (ftlh_hash_table_items(table) != KEY_COUNT - 1) {
+		printf("Remove did not update the item count.\n");
+		return 110;
+	}
+
+	printf("Checking capacity and load factor...\n");
+	if (ftlh_hash_table_capacity(table) * 3 / 4 <= KEY_COUNT - 1 ||
+		ftlh_hash_table_load_factor(table) <= 0 || ftlh_hash_table_load_factor(table) > 0.75)
+	{
+		printf("Capacity %lu / load factor %f are wrong.\n", ftlh_hash_table_capacity(table),
+			   ftlh_hash_table_load_factor(table));
+		return 111;
+	}
+
+	printf("Destroying hash table...\n");
+	ftlh_hash_table_destroy(&table);
+	for (n = 0; n < THREADS; ++n) {
+		if (ftlh_atomic_ptr_get(&ftlh_globals.threads[n].tables)
+			&& ((struct ftlh_table_list_s *)ftlh_atomic_ptr_get(&ftlh_globals.threads[n].tables))->count)
+		{
+			printf("Worker %lu still owns a partition.\n", n);
+			return 112;
+		}
+	}
+
+	printf("Stopping FTLH...\n");
+	ftlh_stop();
+
+	printf("Success.\n");
+	return PASS;
+}
+
+/* For Emacs:
+ * Local Variables:
+ * mode:c
+ * indent-tabs-mode:t
+ * tab-width:4
+ * c-basic-offset:4
+ * End:
+ * For VIM:
+ * vim:set softtabstop=4 shiftwidth=4 tabstop=4 noet:
+ */
@@ -0,0 +1,129 @@
+#define _GNU_SOURCE
+#include "ftlh.h"
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+
+#define _UNUSED __attribute__ ((unused))
+#define PASS 0
+#define FAIL 100
+#define SKIP 77
+#define HARD_FAIL 99
+
+#include "ftlh_private.h"
+
+int main()
+{
+	ftlh_hash_table_t table = NULL;
+	ftlh_key_t key = NULL;
+	ftlh_key_view_t view, other;
+	char buf[64];
+	void *value = NULL;
+
+	printf("Starting FTLH library...\n");
+	ftlh_start();
+
+	printf("Creating hash table...\n");
+	table = ftlh_hash_table_create(16);
+	if (!table) {
+		printf("Failed to create hash table.\n");
+		return FAIL;
+	}
+
+	printf("Checking that a view hashes like a key...\n");
+	key = ftlh_build_key_concat("alpha", NULL);
+	view = ftlh_key_view("alpha", 5);
+	if (view.len != 5 || ftlh_hash_neq(view.hash, ftlh_hash_key(key))) {
+		printf("View and key over the same bytes differ.\n");
+		return 101;
+	}
+
+	printf("Finding a key inserted with ftlh_insert() through a view...\n");
+	if (!ftlh_insert(table, key, (void *)1) || ftlh_find_view(table, &view) != (void *)1) {
+		printf("View did not find the inserted key.\n");
+		return 102;
+	}
+
+	printf("Inserting through a view over memory which is then reused...\n");
+	strcpy(buf, "beta");
+	other = ftlh_key_view(buf, strlen(buf));
+	if (!ftlh_insert_view(table, &other, (void *)2)) {
+		printf("Insert through a view failed.\n");
+		return 103;
+	}
+	if (ftlh_insert_view(table, &other, (void *)3) || ftlh_insert_view(table, &view, (void *)3)) {
+		printf("Inserted an existing key through a view.\n");
+		return 104;
+	}
+	memset(buf, 'x', sizeof(buf));
+	other = ftlh_key_view("beta", 4);
+	if (ftlh_find_view(table, &other) != (void *)2) {
+		printf("The table did not keep its own copy of the key bytes.\n");
+		return 105;
+	}
+	key = ftlh_build_key_concat("beta", NULL);
+	if (ftlh_find(table, key) != (void *)2) {
+		printf("A key did not find the key inserted through a view.\n");
+		return 106;
+	}
+	ftlh_key_free(&key);
+
+	printf("Replacing through a view...\n");
+	if (ftlh_replace_view(table, &view, (void *)4) != (void *)1 || ftlh_find_view(table, &view) != (void *)4) {
+		printf("Replacing an existing key through a view failed.\n");
+		return 107;
+	}
+	other = ftlh_key_view("gamma", 5);
+	if (ftlh_replace_view(table, &other, (void *)5) != (void *)5 || ftlh_find_view(table, &other) != (void *)5) {
+		printf("Replacing a new key through a view did not insert it.\n");
+		return 108;
+	}
+
+	printf("Finding a NULL value and a missing key through views...\n");
+	other = ftlh_key_view("", 0);
+	if (!ftlh_insert_view(table, &other, NULL)) {
+		printf("Inserting the empty key failed.\n");
+		return 109;
+	}
+	value = (void *)1;
+	if (!ftlh_find_view_value(table, &other, &value) || value != NULL) {
+		printf("Key with a NULL value was not found.\n");
+		return 110;
+	}
+	other = ftlh_key_view("delta", 5);
+	if (ftlh_find_view_value(table, &other, NULL) || ftlh_find_view(table, &other)) {
+		printf("Found a missing key.\n");
+		return 111;
+	}
+
+	printf("Removing through a view...\n");
+	if (ftlh_remove_view(table, &view) != (void *)4 || ftlh_find_view(table, &view) ||
+		ftlh_remove_view(table, &view)) {
+		printf("Removing through a view failed.\n");
+		return 112;
+	}
+	if (ftlh_hash_table_items(table) != 3) {
+		printf("Table holds %lu items.\n", (unsigned long)ftlh_hash_table_items(table));
+		return 113;
+	}
+
+	printf("Destroying hash table...\n");
+	ftlh_hash_table_destroy(&table);
+
+	printf("Stopping FTLH...\n");
+	ftlh_stop();
+
+	printf("Success.\n");
+	return PASS;
+}
+
+/* For Emacs:
+ * Local Variables:
+ * mode:c
+ * indent-tabs-mode:t
+ * tab-width:4
+ * c-basic-offset:4
+ * End:
+ * For VIM:
+ * vim:set softtabstop=4 shiftwidth=4 tabstop=4 noet:
+ */
@@ -0,0 +1,171 @@
+#define _GNU_SOURCE
+#include "ftlh.h"
+#include <stdlib.h>
+#include <stdio.h>
+
+#define _UNUSED __attribute__ ((unused))
+#define PASS 0
+#define FAIL 100
+#define SKIP 77
+#define HARD_FAIL 99
+
+#include "ftlh_private.h"
+#include <pthread.h>
+
+#define KEY_COUNT 20000
+#define STABLE_COUNT 1000
+#define READER_COUNT 2
+#define WRITE_ROUNDS 5
+
+ftlh_hash_table_t table = NULL;
+ftlh_atomic64_t writer_done = 0, bad_reads = 0;
+
+/* Keys are spread over the whole 64-bit range, including both sentinels */
+static uint64_t key_of(uint64_t n)
+{
+	return n == 0 ? 0 : (n == 1 ? ~(uint64_t)0 : n * UINT64_C(0x9e3779b97f4a7c15));
+}
+
+void *reader_thread(void *arg)
+{
+	uint64_t seed = (uintptr_t)arg, n = 0;
+	void *value = NULL;
+
+	while (!ftlh_atomic64_get(&writer_done)) {
+		seed = seed * 6364136223846793005ULL + 1442695040888963407ULL;
+		n = (seed >> 33) % KEY_COUNT;
+
+		if (ftlh_find_u64_value(table, key_of(n), &value)) {
+			if (value != (void *)(uintptr_t)(n + 1)) {
+				ftlh_atomic64_inc(&bad_reads);
+			}
+		} else if (n < STABLE_COUNT) {
+			/* These keys are replaced but never removed */
+			ftlh_atomic64_inc(&bad_reads);
+		}
+	}
+
+	return NULL;
+}
+
+int main()
+{
+	pthread_t readers[READER_COUNT];
+	ftlh_key_t key = NULL;
+	void *value = NULL;
+	uint64_t n = 0, round = 0;
+
+	printf("Starting FTLH library...\n");
+	ftlh_start();
+
+	printf("Creating u64 hash table...\n");
+	table = ftlh_hash_table_create_u64(16);
+	if (!table) {
+		printf("Failed to create hash table.\n");
+		return FAIL;
+	}
+
+	printf("Inserting, replacing and removing the sentinel keys...\n");
+	if (!ftlh_insert_u64(table, 0, (void *)1) || !ftlh_insert_u64(table, ~(uint64_t)0, NULL) ||
+		!ftlh_insert_u64(table, 42, (void *)3) || ftlh_insert_u64(table, 0, (void *)4)) {
+		printf("Inserts gave the wrong results.\n");
+		return 101;
+	}
+	value = (void *)1;
+	if (ftlh_find_u64(table, 0) != (void *)1 || !ftlh_find_u64_value(table, ~(uint64_t)0, &value) || value != NULL ||
+		ftlh_find_u64(table, 42) != (void *)3 || ftlh_find_u64_value(table, 43, NULL)) {
+		printf("Lookups gave the wrong results.\n");
+		return 102;
+	}
+	if (ftlh_replace_u64(table, 0, (void *)5) != (void *)1 || ftlh_replace_u64(table, 7, (void *)6) != (void *)6 ||
+		ftlh_find_u64(table, 0) != (void *)5 || ftlh_find_u64(table, 7) != (void *)6) {
+		printf("Replaces gave the wrong results.\n");
+		return 103;
+	}
+	if (ftlh_hash_table_items(table) != 4) {
+		printf("Table holds %lu items.\n", (unsigned long)ftlh_hash_table_items(table));
+		return 104;
+	}
+	if (ftlh_remove_u64(table, 0) != (void *)5 || ftlh_remove_u64(table, 42) != (void *)3 ||
+		ftlh_remove_u64(table, 42) || ftlh_find_u64_value(table, 0, NULL) || ftlh_find_u64_value(table, 42, NULL)) {
+		printf("Removes gave the wrong results.\n");
+		return 105;
+	}
+	if (!ftlh_insert_u64(table, 42, (void *)7) || ftlh_find_u64(table, 42) != (void *)7) {
+		printf("Reinserting a removed key failed.\n");
+		return 106;
+	}
+
+	printf("Checking that key objects are refused...\n");
+	key = ftlh_build_key_concat("alpha", NULL);
+	if (ftlh_insert(table, key, NULL) || ftlh_find(table, key)) {
+		printf("A u64 table accepted an ftlh_key_t.\n");
+		return 107;
+	}
+	ftlh_key_free(&key);
+	ftlh_hash_table_destroy(&table);
+
+	printf("Growing a partitioned u64 table under concurrent readers...\n");
+	table = ftlh_hash_table_create_u64_partitioned(16, 2);
+	if (!table) {
+		printf("Failed to create partitioned hash table.\n");
+		return FAIL;
+	}
+	for (n = 0; n < STABLE_COUNT; ++n) {
+		ftlh_insert_u64(table, key_of(n), (void *)(uintptr_t)(n + 1));
+	}
+	for (n = 0; n < READER_COUNT; ++n) {
+		pthread_create(&readers[n], NULL, reader_thread, (void *)(uintptr_t)(n + 1));
+	}
+	for (round = 0; round < WRITE_ROUNDS; ++round) {
+		for (n = STABLE_COUNT; n < KEY_COUNT; ++n) {
+			ftlh_insert_u64(table, key_of(n), (void *)(uintptr_t)(n + 1));
+		}
+		for (n = 0; n < STABLE_COUNT; ++n) {
+			ftlh_replace_u64(table, key_of(n), (void *)(uintptr_t)(n + 1));
+		}
+		for (n = STABLE_COUNT; n < KEY_COUNT; ++n) {
+			if (ftlh_remove_u64(table, key_of(n)) != (void *)(uintptr_t)(n + 1)) {
+				printf("Removing key %lu gave the wrong value.\n", (unsigned long)n);
+				return 108;
+			}
+		}
+	}
+	ftlh_atomic64_set(&writer_done, 1);
+	for (n = 0; n < READER_COUNT; ++n) {
+		pthread_join(readers[n], NULL);
+	}
+
+	if (ftlh_atomic64_get(&bad_reads)) {
+		printf("Readers saw %lu bad values.\n", (unsigned long)ftlh_atomic64_get(&bad_reads));
+		return 109;
+	}
+	if (ftlh_hash_table_items(table) != STABLE_COUNT) {
+		printf("Table holds %lu items.\n", (unsigned long)ftlh_hash_table_items(table));
+		return 110;
+	}
+	if (ftlh_hash_table_load_factor(table) > 0.75) {
+		printf("Tombstones were not cleaned up; load factor is %f.\n", ftlh_hash_table_load_factor(table));
+		return 111;
+	}
+
+	printf("Destroying hash table...\n");
+	ftlh_hash_table_destroy(&table);
+
+	printf("Stopping FTLH...\n");
+	ftlh_stop();
+
+	printf("Success.\n");
+	return PASS;
+}
+
+/* For Emacs:
+ * Local Variables:
+ * mode:c
+ * indent-tabs-mode:t
+ * tab-width:4
+ * c-basic-offset:4
+ * End:
+ * For VIM:
+ * vim:set softtabstop=4 shiftwidth=4 tabstop=4 noet:
+ */
@@ -0,0 +1,201 @@
+#define _GNU_SOURCE
+#include "ftlh.h"
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+
+#define _UNUSED __attribute__ ((unused))
+#define PASS 0
+#define FAIL 100
+#define SKIP 77
+#define HARD_FAIL 99
+
+#include "ftlh_private.h"
+
+#define KEY_COUNT 5000
+
+ftlh_atomic64_t custom_calls = 0;
+
+/* A deliberately poor hash, to check the table really uses the one it is given */
+static ftlh_hash_t custom_hash(const void *loc, size_t len)
+{
+	ftlh_atomic64_inc(&custom_calls);
+	return ftlh_hash_wy(loc, len) & 0xffff000000000fffULL;
+}
+
+static uint64_t fmix64(uint64_t h)
+{
+	h ^= h >> 33;
+	h *= 0xff51afd7ed558ccdULL;
+	h ^= h >> 33;
+	h *= 0xc4ceb53fe1a85363ULL;
+	h ^= h >> 33;
+	return h;
+}
+
+static int check_table(ftlh_hash_func_t hash_func, uint_fast8_t partition_bits, int fail)
+{
+	ftlh_hash_table_t table = NULL;
+	ftlh_key_t key = NULL;
+	ftlh_key_view_t view;
+	char buf[32];
+	uint64_t n = 0;
+	int len = 0;
+
+	table = ftlh_hash_table_create_hashed(16, partition_bits, hash_func);
+	if (!table || ftlh_hash_table_hash_func(table) != (hash_func ? hash_func : ftlh_hash_best())) {
+		printf("Failed to create a table with the given hash function.\n");
+		return fail;
+	}
+
+	/* Keys are built for ftlh_hash_best(), whatever the table uses */
+	for (n = 0; n < KEY_COUNT; ++n) {
+		key = ftlh_build_key_printf("key-%lu", (unsigned long)n);
+		if (!ftlh_insert(table, key, (void *)(uintptr_t)(n + 1))) {
+			printf("Insert %lu failed.\n", (unsigned long)n);
+			return fail + 1;
+		}
+	}
+
+	for (n = 0; n < KEY_COUNT; ++n) {
+		len = snprintf(buf, sizeof(buf), "key-%lu", (unsigned long)n);
+		view = ftlh_key_view(buf, len);
+		if (ftlh_find_view(table, &view) != (void *)(uintptr_t)(n + 1)) {
+			printf("A default view did not find key %lu.\n", (unsigned long)n);
+			return fail + 2;
+		}
+		view = ftlh_hash_table_key_view(table, buf, len);
+		if (ftlh_find_view(table, &view) != (void *)(uintptr_t)(n + 1)) {
+			printf("A table view did not find key %lu.\n", (unsigned long)n);
+			return fail + 3;
+		}
+		key = ftlh_build_key_binary(buf, len);
+		if (!ftlh_find_hashed(table, key, ftlh_hash_key(key), NULL) ||
+			ftlh_remove(table, key) != (void *)(uintptr_t)(n + 1) || ftlh_find(table, key)) {
+			printf("Finding and removing key %lu failed.\n", (unsigned long)n);
+			return fail + 4;
+		}
+		ftlh_key_free(&key);
+	}
+
+	if (ftlh_hash_table_items(table) != 0) {
+		printf("Table still holds %lu items.\n", (unsigned long)ftlh_hash_table_items(table));
+		return fail + 5;
+	}
+
+	ftlh_hash_table_destroy(&table);
+	return PASS;
+}
+
+int main()
+{
+	ftlh_key_t key1 = NULL, key2 = NULL;
+	ftlh_hash_table_t table = NULL;
+	ftlh_hash_func_t funcs[3] = { ftlh_hash_city, ftlh_hash_crc32c, ftlh_hash_wy };
+	unsigned char bytes[256];
+	uint64_t n = 0, f = 0, len = 0;
+	int result = PASS;
+
+	printf("Checking the built-in hash functions...\n");
+	if (ftlh_hash_crc32c("123456789", 9) != fmix64((UINT64_C(9) << 32) | 0xe3069283)) {
+		printf("CRC32C of the check string is wrong.\n");
+		return 101;
+	}
+	if (ftlh_hash_city("abc", 3) != ftlh_hash("abc", 3)) {
+		printf("ftlh_hash_city() does not match ftlh_hash().\n");
+		return 102;
+	}
+	if (ftlh_hash_best() != ftlh_hash_crc32c && ftlh_hash_best() != ftlh_hash_wy) {
+		printf("ftlh_hash_best() picked an unexpected function.\n");
+		return 103;
+	}
+	for (n = 0; n < sizeof(bytes); ++n) {
+		bytes[n] = (unsigned char)(n * 7 + 1);
+	}
+	for (f = 0; f < 3; ++f) {
+		for (len = 0; len < sizeof(bytes); ++len) {
+			/* Every length reads only its own bytes, and every byte counts */
+			if (funcs[f](bytes, len) != funcs[f](bytes, len)) {
+				printf("Hash function %lu is not deterministic.\n", (unsigned long)f);
+				return 104;
+			}
+			if (len && funcs[f](bytes, len) == funcs[f](bytes, len - 1)) {
+				printf("Hash function %lu ignored a length change at %lu.\n", (unsigned long)f, (unsigned long)len);
+				return 105;
+			}
+			if (len) {
+				bytes[len - 1] ^= 0x40;
+				n = funcs[f](bytes, len);
+				bytes[len - 1] ^= 0x40;
+				if (n == funcs[f](bytes, len)) {
+					printf("Hash function %lu ignored the last byte at length %lu.\n", (unsigned long)f, (unsigned long)len);
+					return 106;
+				}
+			}
+		}
+	}
+
+	printf("Checking that keys built for different functions compare equal...\n");
+	key1 = ftlh_build_key_concat("alpha", NULL);
+	key2 = ftlh_key_clone(key1);
+	if (!key1 || !key2 || key1->hash_func != ftlh_hash_best() || key2->hash_func != key1->hash_func) {
+		printf("Keys were not built with ftlh_hash_best().\n");
+		return 107;
+	}
+	key2->hash_func = ftlh_hash_city;
+	key2->hash = ftlh_hash_city(key2->str, key2->len);
+	if (!ftlh_key_eq(key1, key2)) {
+		printf("Equal keys hashed by different functions compared unequal.\n");
+		return 108;
+	}
+	ftlh_key_free(&key1);
+	ftlh_key_free(&key2);
+
+	printf("Starting FTLH library...\n");
+	ftlh_start();
+
+	printf("Using each hash function in plain and partitioned tables...\n");
+	for (f = 0; f < 3 && result == PASS; ++f) {
+		result = check_table(funcs[f], (uint_fast8_t)f, 110 + f * 10);
+	}
+	if (result == PASS) {
+		result = check_table(NULL, 0, 140);
+	}
+	if (result == PASS) {
+		result = check_table(custom_hash, 2, 150);
+	}
+	if (result != PASS) {
+		return result;
+	}
+	if (!ftlh_atomic64_get(&custom_calls)) {
+		printf("The custom hash function was never called.\n");
+		return 160;
+	}
+
+	printf("Checking that a stored key takes on the table's hash function...\n");
+	table = ftlh_hash_table_create_hashed(16, 0, ftlh_hash_city);
+	key1 = ftlh_build_key_concat("beta", NULL);
+	if (!table || !ftlh_insert(table, key1, NULL) || key1->hash_func != ftlh_hash_city ||
+		key1->hash != ftlh_hash_city("beta", 4)) {
+		printf("The stored key was not rehashed with the table's function.\n");
+		return 161;
+	}
+	ftlh_hash_table_destroy(&table);
+
+	printf("Stopping FTLH...\n");
+	ftlh_stop();
+
+	printf("Success.\n");
+	return PASS;
+}
+
+/* For Emacs:
+ * Local Variables:
+ * mode:c
+ * indent-tabs-mode:t
+ * tab-width:4
+ * c-basic-offset:4
+ * End:
+ * For VIM:
+ * vim:set softtabstop=4 shiftwidth=4 tabstop=4 noet:
+ */